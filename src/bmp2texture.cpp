@@ -1,193 +1,682 @@
+#include <stdio.h>
+
 #include "./slim/platforms/win32_bitmap.h"
-#include "./slim/serialization/texture.h"
+#include "./slim/serialization/texture_atlas.h"
+#include "./slim/core/jobs.h"
+
+// Mip levels are built from planes of float components (one per color channel), each level downsampled from the one
+// before it and then quantized into planes of byte components, from which the texel quads (or the compressed blocks)
+// of every level are assembled at the end. Each of these steps is done in bands of rows that are spread across threads,
+// and the filtering and quantization within a row are done SIMD_WIDTH components at a time.
+// Given multiple files to convert, whole files are spread across threads instead (when there are enough of them).
+//
+// In atlas mode, the bitmaps are instead packed into the pages of a texture atlas (see TextureAtlas), the mip levels
+// of each page built from its padded first level (see packAtlas) the same way.
+
+#define MIP_BAND_ROWS 16 // A multiple of TEXTURE_BLOCK_SIZE, so that bands of rows are also bands of blocks
+#define MIP_MAX_LEVEL_COUNT 32
+
+#define ATLAS_MAX_MIP_COUNT 6 // The padding (and alignment) of atlas rectangles doubles with each mip level
+#define ATLAS_DEFAULT_PAGE_SIZE 2048
+
+enum MipFilter {
+    MipFilter_Box,
+    MipFilter_Lanczos
+};
 
+// A Lanczos kernel (a = 2) stretched for downsampling by 2, sampled at the 8 source texels around each target texel
+// (at distances of 0.5, 1.5, 2.5 and 3.5 source texels from its center), normalized to sum to 1:
+struct LanczosWeights {
+    f32 weights[8];
+
+    LanczosWeights() {
+        f32 sum = 0;
+        for (u32 i = 0; i < 8; i++) {
+            f32 x = ((f32)i - 3.5f) * 0.5f;
+            f32 pi_x = x * (f32)PI;
+            weights[i] = (sinf(pi_x) / pi_x) * (sinf(pi_x * 0.5f) / (pi_x * 0.5f));
+            sum += weights[i];
+        }
+        for (f32 &weight : weights) weight /= sum;
+    }
+};
 
-struct PixelQuad {
-    Pixel TL, TR, BL, BR;
+static const LanczosWeights lanczos_weights;
 
-    Color getAverageColor() const {
-        return {
-                0.25f * (TL.color.r + TR.color.r + BL.color.r + BR.color.r),
-                0.25f * (TL.color.g + TR.color.g + BL.color.g + BR.color.g),
-                0.25f * (TL.color.b + TR.color.b + BL.color.b + BR.color.b)
-        };
+INLINE u32 wrappedOrClamped(i32 coordinate, u32 size, bool wrap) {
+    if ((u32)coordinate < size) return (u32)coordinate;
+    if (wrap) {
+        // Coordinates can be any number of sizes away (as in the padding of atlas rectangles around small bitmaps):
+        i32 wrapped = coordinate % (i32)size;
+        return (u32)(wrapped < 0 ? wrapped + (i32)size : wrapped);
     }
-};
+    return coordinate < 0 ? 0 : size - 1;
+}
 
-struct TextureMipLoader {
-    u32 width, height;
-    Pixel *texels;
-    PixelQuad *texel_quads;
-
-    void init(u32 Width, u32 Height) {
-        width = Width;
-        height = Height;
-        texels = new Pixel[width * height];
-        texel_quads = new PixelQuad[(width + 1) * (height + 1)];
-    }
-
-    void load(bool wrap) {
-        PixelQuad *TL, *TR, *BL, *BR;
-        bool L, R, T, B;
-        const u32 last_y = height - 1;
-        const u32 last_x = width - 1;
-        const u32 l = 0;
-        const u32 r = width;
-        const u32 stride = width + 1;
-        Pixel *texel = texels;
-        PixelQuad *top_texel_quad_line = texel_quads;
-        PixelQuad *bottom_texel_quad_line = top_texel_quad_line + height * stride;
-        PixelQuad *current_line = top_texel_quad_line, *next_line = top_texel_quad_line + stride;
-        for (u32 y = 0; y < height; y++, current_line += stride, next_line += stride) {
-            T = (y == 0);
-            B = (y == last_y);
-
-            for (u32 x = 0; x < width; x++, texel++) {
-                TL = current_line + x;
-                TR = current_line + x + 1;
-                BL = next_line + x;
-                BR = next_line + x + 1;
-
-                L = (x == 0);
-                R = (x == last_x);
-
-                TL->BR = TR->BL = BL->TR = BR->TL = *texel;
-                if (     L) TL->BL = BL->TL = *texel;
-                else if (R) TR->BR = BR->TR = *texel;
-                if (wrap) {
-                    if (     L) current_line[r].BR = next_line[r].TR = *texel;
-                    else if (R) current_line[l].BL = next_line[l].TL = *texel;
-                    if (T) {
-                        bottom_texel_quad_line[x].BR = bottom_texel_quad_line[x + 1].BL = *texel;
-                        if (     L) bottom_texel_quad_line[r].BR = *texel;
-                        else if (R) bottom_texel_quad_line[l].BL = *texel;
-                    } else if (B) {
-                        top_texel_quad_line[x].TR = top_texel_quad_line[x + 1].TL = *texel;
-                        if (     L) top_texel_quad_line[r].TR = *texel;
-                        else if (R) top_texel_quad_line[l].TL = *texel;
-                    }
-                } else {
-                    if (T) {
-                        TL->TR = TR->TL = *texel;
-
-                        if (     L) TL->TL = *texel;
-                        else if (R) TR->TR = *texel;
-
-                    } else if (B) {
-                        BL->BR = BR->BL = *texel;
-
-                        if (     L) BL->BL = *texel;
-                        else if (R) BR->BR = *texel;
-                    }
-                }
-            }
+u32 getMipCount(u32 width, u32 height, bool mipmap) {
+    u32 mip_count = 1;
+    if (mipmap)
+        while (width > 4 && height > 4 && mip_count < MIP_MAX_LEVEL_COUNT) {
+            width /= 2;
+            height /= 2;
+            mip_count++;
         }
+
+    return mip_count;
+}
+
+// Truncating, as (u8)(component * FLOAT_TO_COLOR_COMPONENT) does:
+void quantizeRow(const f32 *components, u8 *byte_components, u32 count) {
+    u32 x = 0;
+#if SIMD_WIDTH > 1
+    i32 values[SIMD_WIDTH];
+    const f32_lanes scale = simd::set(FLOAT_TO_COLOR_COMPONENT);
+    for (; x + SIMD_WIDTH <= count; x += SIMD_WIDTH) {
+        simd::storeInt(values, simd::toInt(simd::mul(simd::load(components + x), scale)));
+        for (u32 i = 0; i < SIMD_WIDTH; i++) byte_components[x + i] = (u8)values[i];
     }
-};
+#endif
+    for (; x < count; x++) byte_components[x] = (u8)(components[x] * FLOAT_TO_COLOR_COMPONENT);
+}
 
-void loadMips(Texture &texture, TextureMipLoader *mips) {
-    TextureMipLoader *current_mip = mips;
-    TextureMipLoader *next_mip = current_mip + 1;
+// Average each 2x2 texels of a pair of source rows (a last odd column is dropped):
+void boxFilterRow(const f32 *top, const f32 *bottom, f32 *target, u32 target_width) {
+    u32 x = 0;
+#if SIMD_WIDTH > 1
+    const f32_lanes quarter = simd::set(0.25f);
+    for (; x + SIMD_WIDTH <= target_width; x += SIMD_WIDTH) {
+        f32_lanes top_left_and_right[2]    = {simd::load(top    + 2 * x), simd::load(top    + 2 * x + SIMD_WIDTH)};
+        f32_lanes bottom_left_and_right[2] = {simd::load(bottom + 2 * x), simd::load(bottom + 2 * x + SIMD_WIDTH)};
+        f32_lanes TL = simd::evenLanes(top_left_and_right[0], top_left_and_right[1]);
+        f32_lanes TR = simd::oddLanes( top_left_and_right[0], top_left_and_right[1]);
+        f32_lanes BL = simd::evenLanes(bottom_left_and_right[0], bottom_left_and_right[1]);
+        f32_lanes BR = simd::oddLanes( bottom_left_and_right[0], bottom_left_and_right[1]);
+        simd::store(target + x, simd::mul(quarter, simd::add(simd::add(simd::add(TL, TR), BL), BR)));
+    }
+#endif
+    for (; x < target_width; x++)
+        target[x] = 0.25f * (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1]);
+}
 
-    u32 mip_width  = texture.width;
-    u32 mip_height = texture.height;
+// Filter 8 source rows (vertically) into a row of the source's width:
+void lanczosFilterColumns(const f32 **rows, f32 *target, u32 width) {
+    const f32 *w = lanczos_weights.weights;
+    u32 x = 0;
+#if SIMD_WIDTH > 1
+    f32_lanes weights[8];
+    for (u32 i = 0; i < 8; i++) weights[i] = simd::set(w[i]);
+    for (; x + SIMD_WIDTH <= width; x += SIMD_WIDTH) {
+        f32_lanes sum = simd::mul(weights[0], simd::load(rows[0] + x));
+        for (u32 i = 1; i < 8; i++) sum = simd::mulAdd(weights[i], simd::load(rows[i] + x), sum);
+        simd::store(target + x, sum);
+    }
+#endif
+    for (; x < width; x++) {
+        f32 sum = w[0] * rows[0][x];
+        for (u32 i = 1; i < 8; i++) sum = fast_mul_add(w[i], rows[i][x], sum);
+        target[x] = sum;
+    }
+}
 
-    PixelQuad *colors_quad;
-    u32 stride, offset, start;
+// Filter a row (horizontally) into a row of half its width, clamping the results (the kernel has negative lobes).
+// Taps reaching beyond the edges are wrapped or clamped, so only the interior of the row is filtered in lanes:
+INLINE f32 lanczosFilterTexel(const f32 *row, u32 x, u32 width, bool wrap) {
+    const f32 *w = lanczos_weights.weights;
+    f32 sum = w[0] * row[wrappedOrClamped((i32)(2 * x) - 3, width, wrap)];
+    for (u32 i = 1; i < 8; i++)
+        sum = fast_mul_add(w[i], row[wrappedOrClamped((i32)(2 * x + i) - 3, width, wrap)], sum);
+    return clampedValue(sum, 0.0f, 1.0f);
+}
 
-    while (mip_width > 4 && mip_height > 4) {
-        start = mip_width + 1;
-        stride = start * 2;
+void lanczosFilterRow(const f32 *row, f32 *target, u32 width, u32 target_width, bool wrap) {
+    u32 x = 0;
+    for (; x < 2 && x < target_width; x++) target[x] = lanczosFilterTexel(row, x, width, wrap);
+#if SIMD_WIDTH > 1
+    f32_lanes weights[8];
+    for (u32 i = 0; i < 8; i++) weights[i] = simd::set(lanczos_weights.weights[i]);
+    const f32_lanes zero = simd::set(0.0f);
+    const f32_lanes one  = simd::set(1.0f);
+    for (; 2 * (x + SIMD_WIDTH) + 4 <= width; x += SIMD_WIDTH) {
+        const f32 *taps = row + 2 * x - 3;
+        f32_lanes sum = simd::mul(weights[0], simd::evenLanes(simd::load(taps), simd::load(taps + SIMD_WIDTH)));
+        for (u32 i = 1; i < 8; i++)
+            sum = simd::mulAdd(weights[i], simd::evenLanes(simd::load(taps + i), simd::load(taps + i + SIMD_WIDTH)), sum);
+        sum = simd::select(simd::lessThan(sum, zero), zero, sum);
+        sum = simd::select(simd::lessThan(one, sum), one, sum);
+        simd::store(target + x, sum);
+    }
+#endif
+    for (; x < target_width; x++) target[x] = lanczosFilterTexel(row, x, width, wrap);
+}
 
-        mip_width  /= 2;
-        mip_height /= 2;
+struct MipLevel {
+    u32 width, height;
+    f32 *R, *G, *B;      // Float components (only valid while this level or the next one is being built)
+    u8 *byte_R, *byte_G, *byte_B;
+    u32 band_count;      // Of texel quad rows (or block rows) to assemble
+};
 
-        next_mip->init(mip_width, mip_height);
+struct MipChainBuilder {
+    Texture &texture;
+    u8 *components; // Of the bitmap (or null, for a first level that's filled in directly, see levels[0])
+    MipFilter filter;
+    MipLevel levels[MIP_MAX_LEVEL_COUNT];
+    f32 *float_components[2]; // Alternating between the levels being built (each level downsamples the one before it)
+    u8 *byte_components;
+    f32 *scratch_rows;         // A row for each worker (for the vertical pass of the Lanczos filter)
+    u32 current_level{0};
+
+    MipChainBuilder(Texture &texture, u8 *components, MipFilter filter, u32 worker_count) :
+            texture{texture}, components{components}, filter{filter} {
+        u32 mip_width  = texture.width;
+        u32 mip_height = texture.height;
+        u64 byte_count = 0;
+        for (u32 i = 0; i < texture.mip_count; i++, mip_width /= 2, mip_height /= 2) {
+            MipLevel &level = levels[i];
+            level.width  = mip_width;
+            level.height = mip_height;
+            if (texture.flags.compression)
+                level.band_count = (mip_height + MIP_BAND_ROWS - 1) / MIP_BAND_ROWS;
+            else
+                level.band_count = (mip_height + MIP_BAND_ROWS) / MIP_BAND_ROWS; // Of the height + 1 texel quad rows
+            byte_count += (u64)mip_width * mip_height * 3;
+        }
 
-        for (u32 y = 0; y < mip_height; y++) {
-            offset = start + 1;
+        float_components[0] = new f32[(u64)texture.width * texture.height * 3];
+        float_components[1] = texture.mip_count > 1 ? new f32[(u64)levels[1].width * levels[1].height * 3] : nullptr;
+        byte_components = new u8[byte_count];
+        scratch_rows = filter == MipFilter_Lanczos ? new f32[(u64)texture.width * worker_count] : nullptr;
+
+        u8 *level_byte_components = byte_components;
+        for (u32 i = 0; i < texture.mip_count; i++) {
+            MipLevel &level = levels[i];
+            u64 texel_count = (u64)level.width * level.height;
+            level.R = float_components[i & 1];
+            level.G = level.R + texel_count;
+            level.B = level.G + texel_count;
+            level.byte_R = level_byte_components;
+            level.byte_G = level.byte_R + texel_count;
+            level.byte_B = level.byte_G + texel_count;
+            level_byte_components += texel_count * 3;
+        }
+    }
+
+    ~MipChainBuilder() {
+        delete[] float_components[0];
+        delete[] float_components[1];
+        delete[] byte_components;
+        delete[] scratch_rows;
+    }
 
-            for (u32 x = 0; x < mip_width; x++) {
-                colors_quad = current_mip->texel_quads + offset;
-                next_mip->texels[mip_width * y + x].color = colors_quad->getAverageColor();
-                offset += 2;
+    void build(JobPool *pool) {
+        for (current_level = 0; current_level < texture.mip_count; current_level++) {
+            u32 band_count = (levels[current_level].height + MIP_BAND_ROWS - 1) / MIP_BAND_ROWS;
+            if (pool)
+                pool->run(_buildBandProc, this, band_count);
+            else
+                for (u32 i = 0; i < band_count; i++) buildBand(i, 0);
+        }
+
+        texture.mips = new TextureMip[texture.mip_count];
+        u32 band_count = 0;
+        for (u32 i = 0; i < texture.mip_count; i++) {
+            TextureMip &mip = texture.mips[i];
+            mip.width  = levels[i].width;
+            mip.height = levels[i].height;
+            mip.tiled  = texture.flags.tile;
+            mip.wrap   = texture.flags.wrap;
+            mip.compression = (u8)texture.flags.compression;
+            if (mip.compression)
+                mip.blocks = new u8[TextureMip::GetContentSize(mip.width, mip.height, false, mip.compression)];
+            else
+                mip.texel_quads = new TexelQuad[TextureMip::GetTexelQuadCount(mip.width, mip.height, mip.tiled)]();
+            band_count += levels[i].band_count;
+        }
+        if (pool)
+            pool->run(_assembleBandProc, this, band_count);
+        else
+            for (u32 i = 0; i < band_count; i++) assembleBand(i);
+    }
+
+    // Build a band of rows of the current level (converting the bitmap's pixels for the first level):
+    void buildBand(u32 band, u32 worker_index) {
+        const MipLevel &level = levels[current_level];
+        const u32 first_y = band * MIP_BAND_ROWS;
+        const u32 end_y = first_y + MIP_BAND_ROWS < level.height ? first_y + MIP_BAND_ROWS : level.height;
+        for (u32 y = first_y; y < end_y; y++) {
+            const u64 offset = (u64)level.width * y;
+            if (current_level == 0) {
+                if (components) convertRow(y);
+            } else if (filter == MipFilter_Lanczos)
+                lanczosFilter(y, scratch_rows + (u64)texture.width * worker_index);
+            else {
+                const MipLevel &source = levels[current_level - 1];
+                const u64 top = (u64)source.width * (2 * y);
+                const u64 bottom = top + source.width;
+                boxFilterRow(source.R + top, source.R + bottom, level.R + offset, level.width);
+                boxFilterRow(source.G + top, source.G + bottom, level.G + offset, level.width);
+                boxFilterRow(source.B + top, source.B + bottom, level.B + offset, level.width);
             }
+            quantizeRow(level.R + offset, level.byte_R + offset, level.width);
+            quantizeRow(level.G + offset, level.byte_G + offset, level.width);
+            quantizeRow(level.B + offset, level.byte_B + offset, level.width);
+        }
+    }
 
-            start += stride;
+    void convertRow(u32 y) {
+        const MipLevel &level = levels[0];
+        const u32 component_count = texture.flags.alpha ? 4 : 3;
+        u8 *component = components + (u64)level.width * y * component_count;
+        const u64 offset = (u64)level.width * y;
+        Pixel pixel;
+        for (u32 x = 0; x < level.width; x++) {
+            component = componentsToPixel(component, &pixel, texture);
+            level.R[offset + x] = pixel.color.r;
+            level.G[offset + x] = pixel.color.g;
+            level.B[offset + x] = pixel.color.b;
         }
+    }
+
+    void lanczosFilter(u32 y, f32 *scratch_row) {
+        const MipLevel &level = levels[current_level];
+        const MipLevel &source = levels[current_level - 1];
+        const bool wrap = texture.flags.wrap;
+        const f32 *source_planes[3] = {source.R, source.G, source.B};
+        f32 *target_planes[3] = {level.R, level.G, level.B};
+        const f32 *rows[8];
+        for (u32 c = 0; c < 3; c++) {
+            for (u32 i = 0; i < 8; i++)
+                rows[i] = source_planes[c] + (u64)source.width * wrappedOrClamped((i32)(2 * y + i) - 3, source.height, wrap);
+            lanczosFilterColumns(rows, scratch_row, source.width);
+            lanczosFilterRow(scratch_row, target_planes[c] + (u64)level.width * y, source.width, level.width, wrap);
+        }
+    }
+
+    // Assemble a band of texel quad rows (or compress a band of block rows) of any level:
+    void assembleBand(u32 band) {
+        u32 level_index = 0;
+        while (band >= levels[level_index].band_count) band -= levels[level_index++].band_count;
+        const MipLevel &level = levels[level_index];
+        TextureMip &mip = texture.mips[level_index];
+        if (mip.compression) {
+            compressTextureMip(mip, level.byte_R, level.byte_G, level.byte_B,
+                               band * (MIP_BAND_ROWS / TEXTURE_BLOCK_SIZE), (band + 1) * (MIP_BAND_ROWS / TEXTURE_BLOCK_SIZE));
+            return;
+        }
+
+        // The texel quad at (x, y) has the texels at (x-1, y-1) to (x, y) as its corners (wrapped or clamped):
+        const bool wrap = texture.flags.wrap;
+        const u32 first_y = band * MIP_BAND_ROWS;
+        const u32 end_y = first_y + MIP_BAND_ROWS <= level.height ? first_y + MIP_BAND_ROWS : level.height + 1;
+        for (u32 y = first_y; y < end_y; y++) {
+            const u64 top    = (u64)level.width * wrappedOrClamped((i32)y - 1, level.height, wrap);
+            const u64 bottom = (u64)level.width * wrappedOrClamped((i32)y,     level.height, wrap);
+            for (u32 x = 0; x <= level.width; x++) {
+                const u32 left  = wrappedOrClamped((i32)x - 1, level.width, wrap);
+                const u32 right = wrappedOrClamped((i32)x,     level.width, wrap);
+                TexelQuad &texel_quad = mip.texel_quads[mip.texelQuadOffset(x, y)];
+                texel_quad.R.TL = level.byte_R[top + left];
+                texel_quad.G.TL = level.byte_G[top + left];
+                texel_quad.B.TL = level.byte_B[top + left];
+
+                texel_quad.R.TR = level.byte_R[top + right];
+                texel_quad.G.TR = level.byte_G[top + right];
+                texel_quad.B.TR = level.byte_B[top + right];
+
+                texel_quad.R.BL = level.byte_R[bottom + left];
+                texel_quad.G.BL = level.byte_G[bottom + left];
+                texel_quad.B.BL = level.byte_B[bottom + left];
+
+                texel_quad.R.BR = level.byte_R[bottom + right];
+                texel_quad.G.BR = level.byte_G[bottom + right];
+                texel_quad.B.BR = level.byte_B[bottom + right];
+            }
+        }
+    }
+
+private:
+    static void _buildBandProc(void *data, u32 job_index, u32 worker_index) {
+        ((MipChainBuilder*)data)->buildBand(job_index, worker_index);
+    }
+
+    static void _assembleBandProc(void *data, u32 job_index, u32 worker_index) {
+        ((MipChainBuilder*)data)->assembleBand(job_index);
+    }
+};
+
+struct TextureConversion {
+    char *bitmap_file_path;
+    char *texture_file_path;
+    bool converted;
+};
 
-        next_mip->load(texture.flags.wrap);
+struct Conversions {
+    TextureConversion *conversions;
+    ImageFlags flags;
+    MipFilter filter;
+};
 
-        current_mip++;
-        next_mip++;
+void freeMips(Texture &texture) {
+    for (u32 i = 0; i < texture.mip_count; i++) {
+        if (texture.mips[i].compression)
+            delete[] texture.mips[i].blocks;
+        else
+            delete[] texture.mips[i].texel_quads;
     }
+    delete[] texture.mips;
+    texture.mips = nullptr;
 }
 
-int main(int argc, char *argv[]) {
+// Convert a bitmap file to a texture file, spreading the work on it across the given pool's workers (if given one):
+bool convert(char *bitmap_file_path, char *texture_file_path, ImageFlags flags, MipFilter filter, JobPool *pool) {
     Texture texture;
+    texture.flags = flags;
 
-    char* bitmap_file_path = argv[1];
-    char* texture_file_path = argv[2];
-    for (u8 i = 3; i < (u8)argc; i++) {
-        if (     argv[i][0] == '-' && argv[i][1] == 'f') texture.flags.flip = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'c') texture.flags.channel = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'l') texture.flags.linear = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 't') texture.flags.tile = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'm') texture.flags.mipmap = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'w') texture.flags.wrap = true;
-        else return 0;
-    }
+    // Compressed textures are laid out in blocks already:
+    if (texture.flags.compression) texture.flags.tile = false;
 
+    // When tiled, it's the texel quads that get laid out in blocks (below) rather than the bitmap's pixels:
+    bool tile = texture.flags.tile;
+    texture.flags.tile = false;
     u8* components = loadBitmap(bitmap_file_path, texture);
+    texture.flags.tile = tile;
+    if (!components) return false;
+
+    texture.mip_count = getMipCount(texture.width, texture.height, texture.flags.mipmap);
+
+    {
+        MipChainBuilder builder{texture, components, filter, pool ? pool->worker_count : 1};
+        builder.build(pool);
+    }
+    delete[] components;
+
+    bool saved = save(texture, texture_file_path);
+    freeMips(texture);
+
+    return saved;
+}
 
-    u32 mip_width  = texture.width;
-    u32 mip_height = texture.height;
-    texture.mip_count = 1;
-    if (texture.flags.mipmap)
-        while (mip_width > 4 && mip_height > 4) {
-            mip_width /= 2;
-            mip_height /= 2;
-            texture.mip_count++;
+void convertProc(void *data, u32 job_index, u32 worker_index) {
+    Conversions &conversions = *(Conversions*)data;
+    TextureConversion &conversion = conversions.conversions[job_index];
+    conversion.converted = convert(conversion.bitmap_file_path, conversion.texture_file_path,
+                                   conversions.flags, conversions.filter, nullptr);
+}
+
+// A bitmap being packed into a texture atlas, as planes of float components:
+struct AtlasBitmap {
+    Texture info;
+    f32 *R, *G, *B;
+    u32 cell_width, cell_height; // Of its rectangle along with its padding (rounded up to the alignment)
+};
+
+// Resample a bitmap to the given size (bilinearly, with its texels wrapped around or clamped at its edges):
+void resampleAtlasBitmap(AtlasBitmap &bitmap, u32 width, u32 height, bool wrap) {
+    const u32 source_width  = bitmap.info.width;
+    const u32 source_height = bitmap.info.height;
+    const u64 texel_count = (u64)width * height;
+    f32 *R = new f32[texel_count * 3];
+    f32 *G = R + texel_count;
+    f32 *B = G + texel_count;
+    for (u32 y = 0; y < height; y++) {
+        const f32 source_y = ((f32)y + 0.5f) * (f32)source_height / (f32)height - 0.5f;
+        const i32 top = (i32)floorf(source_y);
+        const f32 v = source_y - (f32)top;
+        const u64 top_row    = (u64)source_width * wrappedOrClamped(top,     source_height, wrap);
+        const u64 bottom_row = (u64)source_width * wrappedOrClamped(top + 1, source_height, wrap);
+        for (u32 x = 0; x < width; x++) {
+            const f32 source_x = ((f32)x + 0.5f) * (f32)source_width / (f32)width - 0.5f;
+            const i32 left = (i32)floorf(source_x);
+            const f32 u = source_x - (f32)left;
+            const u32 left_x  = wrappedOrClamped(left,     source_width, wrap);
+            const u32 right_x = wrappedOrClamped(left + 1, source_width, wrap);
+            const f32 TL = (1 - u) * (1 - v), TR = u * (1 - v), BL = (1 - u) * v, BR = u * v;
+            const u64 t = (u64)width * y + x;
+            R[t] = TL * bitmap.R[top_row + left_x] + TR * bitmap.R[top_row + right_x] + BL * bitmap.R[bottom_row + left_x] + BR * bitmap.R[bottom_row + right_x];
+            G[t] = TL * bitmap.G[top_row + left_x] + TR * bitmap.G[top_row + right_x] + BL * bitmap.G[bottom_row + left_x] + BR * bitmap.G[bottom_row + right_x];
+            B[t] = TL * bitmap.B[top_row + left_x] + TR * bitmap.B[top_row + right_x] + BL * bitmap.B[bottom_row + left_x] + BR * bitmap.B[bottom_row + right_x];
         }
+    }
+    delete[] bitmap.R;
+    bitmap.R = R;
+    bitmap.G = G;
+    bitmap.B = B;
+    bitmap.info.width = width;
+    bitmap.info.height = height;
+}
 
-    auto *mips = new TextureMipLoader[texture.mip_count];
-    mips->init(texture.width, texture.height);
-    componentsToPixels(components, texture, mips->texels);
-    mips->load(texture.flags.wrap);
-    if (texture.flags.mipmap) loadMips(texture, mips);
+// Pack bitmap files into the pages of a texture atlas file: Rectangles are placed tallest first onto shelves (rows)
+// that are filled from left to right, starting a new shelf (and then a new page) once out of room.
+// The pages get as many mip levels as the smallest of the bitmaps would have (up to ATLAS_MAX_MIP_COUNT), and each
+// rectangle is padded by (and aligned to) the texel size of the last of them, so that filtering any mip level never
+// reaches into a neighbouring rectangle. Bitmaps whose sizes are not multiples of that texel size get resampled up to
+// the next ones, so that their rectangles cover whole texels of every mip level. The padding is doubled for the wider Lanczos filter, and compressed pages
+// align rectangles to the blocks of every mip level.
+bool packAtlas(char **bitmap_file_paths, u32 bitmap_count, char *atlas_file_path,
+               ImageFlags flags, MipFilter filter, u32 page_size, JobPool *pool) {
+    if (flags.compression) flags.tile = false;
+
+    AtlasBitmap *bitmaps = new AtlasBitmap[bitmap_count]();
+    u32 mip_count = flags.mipmap ? ATLAS_MAX_MIP_COUNT : 1;
+    bool packed = true;
+    for (u32 i = 0; i < bitmap_count && packed; i++) {
+        AtlasBitmap &bitmap = bitmaps[i];
+        bitmap.info.flags = flags;
+        bitmap.info.flags.tile = false;
+        u8 *components = loadBitmap(bitmap_file_paths[i], bitmap.info);
+        if (!components) {
+            printf("Failed to load %s\n", bitmap_file_paths[i]);
+            packed = false;
+            break;
+        }
 
-    texture.mips = new TextureMip[texture.mip_count];
-    TextureMip *mip = texture.mips;
-    TextureMipLoader *loader_mip = mips;
-    for (u16 i = 0; i < texture.mip_count; i++, mip++, loader_mip++) {
-        mip->width  = loader_mip->width;
-        mip->height = loader_mip->height;
-        mip->texel_quads = new TexelQuad[(mip->width + 1) * (mip->height + 1)];
+        const u64 texel_count = (u64)bitmap.info.width * bitmap.info.height;
+        bitmap.R = new f32[texel_count * 3];
+        bitmap.G = bitmap.R + texel_count;
+        bitmap.B = bitmap.G + texel_count;
+        u8 *component = components;
+        Pixel pixel;
+        for (u64 t = 0; t < texel_count; t++) {
+            component = componentsToPixel(component, &pixel, bitmap.info);
+            bitmap.R[t] = pixel.color.r;
+            bitmap.G[t] = pixel.color.g;
+            bitmap.B[t] = pixel.color.b;
+        }
+        delete[] components;
 
-        TexelQuad *texel_quad = mip->texel_quads;
-        PixelQuad *loader_texel_quad = loader_mip->texel_quads;
-        u32 texel_quads_count = (u32)(mip->width + 1) * (u32)(mip->height + 1);
-        for (u32 t = 0; t < texel_quads_count; t++, texel_quad++, loader_texel_quad++) {
-            texel_quad->R.TL = (u8)(loader_texel_quad->TL.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.TL = (u8)(loader_texel_quad->TL.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.TL = (u8)(loader_texel_quad->TL.color.b * FLOAT_TO_COLOR_COMPONENT);
+        u32 bitmap_mip_count = getMipCount(bitmap.info.width, bitmap.info.height, flags.mipmap);
+        if (bitmap_mip_count < mip_count) mip_count = bitmap_mip_count;
+    }
 
-            texel_quad->R.TR = (u8)(loader_texel_quad->TR.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.TR = (u8)(loader_texel_quad->TR.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.TR = (u8)(loader_texel_quad->TR.color.b * FLOAT_TO_COLOR_COMPONENT);
+    const u32 padding = (filter == MipFilter_Lanczos ? 2 : 1) << (mip_count - 1);
+    const u32 alignment = flags.compression ? TEXTURE_BLOCK_SIZE << (mip_count - 1) : 1 << (mip_count - 1);
+    const u32 last_mip_texel_size = 1 << (mip_count - 1);
+    u32 *order = new u32[bitmap_count];
+    for (u32 i = 0; i < bitmap_count && packed; i++) {
+        AtlasBitmap &bitmap = bitmaps[i];
+        const u32 width  = (bitmap.info.width  + last_mip_texel_size - 1) / last_mip_texel_size * last_mip_texel_size;
+        const u32 height = (bitmap.info.height + last_mip_texel_size - 1) / last_mip_texel_size * last_mip_texel_size;
+        if (width != bitmap.info.width || height != bitmap.info.height)
+            resampleAtlasBitmap(bitmap, width, height, flags.wrap);
+
+        bitmap.cell_width  = (bitmap.info.width  + 2 * padding + alignment - 1) / alignment * alignment;
+        bitmap.cell_height = (bitmap.info.height + 2 * padding + alignment - 1) / alignment * alignment;
+
+        u32 j = i;
+        for (; j > 0 && bitmaps[order[j - 1]].cell_height < bitmap.cell_height; j--) order[j] = order[j - 1];
+        order[j] = i;
+    }
 
-            texel_quad->R.BL = (u8)(loader_texel_quad->BL.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.BL = (u8)(loader_texel_quad->BL.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.BL = (u8)(loader_texel_quad->BL.color.b * FLOAT_TO_COLOR_COMPONENT);
+    TextureAtlas atlas;
+    atlas.rect_count = bitmap_count;
+    atlas.rects = new TextureAtlasRect[bitmap_count];
+    u32 page_widths[TEXTURE_ATLAS_MAX_PAGE_COUNT];
+    u32 page_heights[TEXTURE_ATLAS_MAX_PAGE_COUNT];
+    u32 x = 0, y = 0, shelf_height = 0;
+    for (u32 i = 0; i < bitmap_count && packed; i++) {
+        const AtlasBitmap &bitmap = bitmaps[order[i]];
+        if (bitmap.cell_width > page_size || bitmap.cell_height > page_size) {
+            printf("%s does not fit in a page of %ux%u (padded)\n", bitmap_file_paths[order[i]], page_size, page_size);
+            packed = false;
+            break;
+        }
 
-            texel_quad->R.BR = (u8)(loader_texel_quad->BR.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.BR = (u8)(loader_texel_quad->BR.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.BR = (u8)(loader_texel_quad->BR.color.b * FLOAT_TO_COLOR_COMPONENT);
+        if (x + bitmap.cell_width > page_size) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+        if (!atlas.page_count || y + bitmap.cell_height > page_size) {
+            if (atlas.page_count == TEXTURE_ATLAS_MAX_PAGE_COUNT) {
+                printf("The bitmaps do not fit in %u pages of %ux%u\n", TEXTURE_ATLAS_MAX_PAGE_COUNT, page_size, page_size);
+                packed = false;
+                break;
+            }
+            page_widths[atlas.page_count] = page_heights[atlas.page_count] = 0;
+            atlas.page_count++;
+            x = y = shelf_height = 0;
+        }
+
+        TextureAtlasRect &rect = atlas.rects[order[i]];
+        rect.page = atlas.page_count - 1;
+        rect.x = x + padding;
+        rect.y = y + padding;
+        rect.width  = bitmap.info.width;
+        rect.height = bitmap.info.height;
+        rect.wrap = flags.wrap;
+
+        x += bitmap.cell_width;
+        if (bitmap.cell_height > shelf_height) shelf_height = bitmap.cell_height;
+        if (x > page_widths[rect.page]) page_widths[rect.page] = x;
+        if (y + shelf_height > page_heights[rect.page]) page_heights[rect.page] = y + shelf_height;
+    }
 
+    for (u32 p = 0; p < atlas.page_count && packed; p++) {
+        Texture &page = atlas.pages[p];
+        page.flags = flags;
+        page.flags.mipmap = mip_count > 1;
+        page.flags.wrap = false;
+        page.flags.alpha = false;
+        page.updateDimensions(page_widths[p], page_heights[p]);
+        page.mip_count = mip_count;
+
+        MipChainBuilder builder{page, nullptr, filter, pool ? pool->worker_count : 1};
+        const MipLevel &level = builder.levels[0];
+        const u64 texel_count = (u64)page.width * page.height;
+        for (u64 t = 0; t < texel_count; t++) level.R[t] = level.G[t] = level.B[t] = 0;
+
+        // Fill each rectangle's cell with the texels of its bitmap, wrapped around (or clamped) into the padding:
+        for (u32 i = 0; i < bitmap_count; i++) {
+            const TextureAtlasRect &rect = atlas.rects[i];
+            if (rect.page != p)
+                continue;
+
+            const AtlasBitmap &bitmap = bitmaps[i];
+            for (u32 cell_y = 0; cell_y < bitmap.cell_height; cell_y++) {
+                const u64 source = (u64)bitmap.info.width * wrappedOrClamped((i32)cell_y - (i32)padding, bitmap.info.height, rect.wrap);
+                const u64 target = (u64)page.width * (rect.y - padding + cell_y) + (rect.x - padding);
+                for (u32 cell_x = 0; cell_x < bitmap.cell_width; cell_x++) {
+                    const u32 source_x = wrappedOrClamped((i32)cell_x - (i32)padding, bitmap.info.width, rect.wrap);
+                    level.R[target + cell_x] = bitmap.R[source + source_x];
+                    level.G[target + cell_x] = bitmap.G[source + source_x];
+                    level.B[target + cell_x] = bitmap.B[source + source_x];
+                }
+            }
         }
+        builder.build(pool);
     }
 
-    save(texture, texture_file_path);
+    if (packed)
+        packed = save(atlas, atlas_file_path);
+
+    for (u32 p = 0; p < atlas.page_count; p++)
+        if (atlas.pages[p].mips)
+            freeMips(atlas.pages[p]);
+    for (u32 i = 0; i < bitmap_count; i++)
+        delete[] bitmaps[i].R;
+    delete[] bitmaps;
+    delete[] atlas.rects;
+    delete[] order;
 
-    return 0;
-}
\ No newline at end of file
+    return packed;
+}
+
+int main(int argc, char *argv[]) {
+    Conversions conversions;
+    conversions.conversions = new TextureConversion[argc];
+    conversions.filter = MipFilter_Box;
+    ImageFlags &flags = conversions.flags;
+
+    // File paths are given in pairs (a bitmap file and the texture file to convert it to), with flags applying to all.
+    // In atlas mode, the bitmap files are given first instead, followed by the atlas file to pack them into:
+    char **file_paths = new char*[argc];
+    u32 file_path_count = 0;
+    u32 page_size = ATLAS_DEFAULT_PAGE_SIZE;
+    bool atlas = false;
+    for (i32 i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            file_paths[file_path_count] = argv[i];
+            if (file_path_count & 1)
+                conversions.conversions[file_path_count / 2].texture_file_path = argv[i];
+            else
+                conversions.conversions[file_path_count / 2].bitmap_file_path = argv[i];
+            file_path_count++;
+        }
+        else if (argv[i][1] == 'f') flags.flip = true;
+        else if (argv[i][1] == 'c') flags.channel = true;
+        else if (argv[i][1] == 'l') flags.linear = true;
+        else if (argv[i][1] == 't') flags.tile = true;
+        else if (argv[i][1] == 'm') flags.mipmap = true;
+        else if (argv[i][1] == 'w') flags.wrap = true;
+        else if (argv[i][1] == 'b') flags.compression = TextureCompression_BC1;
+        else if (argv[i][1] == 'n') flags.compression = TextureCompression_BC5;
+        else if (argv[i][1] == 's') conversions.filter = MipFilter_Lanczos;
+        else if (argv[i][1] == 'a') atlas = true;
+        else if (argv[i][1] == 'p') {
+            page_size = 0;
+            for (char *digit = argv[i] + 2; *digit >= '0' && *digit <= '9'; digit++)
+                page_size = page_size * 10 + (u32)(*digit - '0');
+        }
+        else return 0;
+    }
+
+    JobPool pool;
+    pool.setWorkerCount(os::getProcessorCount());
+
+    if (atlas) {
+        if (file_path_count < 2) {
+            printf((char*)("Bitmap files to pack need to be provided, followed by the atlas file to pack them into\n"));
+            return 1;
+        }
+        if (!packAtlas(file_paths, file_path_count - 1, file_paths[file_path_count - 1], flags, conversions.filter, page_size, &pool)) {
+            printf("Failed to pack the bitmaps into %s\n", file_paths[file_path_count - 1]);
+            return 1;
+        }
+        return 0;
+    }
+    if (file_path_count < 2 || file_path_count & 1) {
+        printf((char*)("Pairs of file paths need to be provided: "
+                       "A bitmap file to convert and a texture file to convert it to (per pair)\n"));
+        return 1;
+    }
+
+    u32 conversion_count = file_path_count / 2;
+    if (conversion_count > 1 && conversion_count >= pool.worker_count)
+        pool.run(convertProc, &conversions, conversion_count);
+    else
+        for (u32 i = 0; i < conversion_count; i++) {
+            TextureConversion &conversion = conversions.conversions[i];
+            conversion.converted = convert(conversion.bitmap_file_path, conversion.texture_file_path,
+                                           flags, conversions.filter, &pool);
+        }
+
+    int result = 0;
+    for (u32 i = 0; i < conversion_count; i++)
+        if (!conversions.conversions[i].converted) {
+            printf("Failed to convert %s to %s\n", conversions.conversions[i].bitmap_file_path,
+                                                    conversions.conversions[i].texture_file_path);
+            result = 1;
+        }
+
+    return result;
+}
@@ -70,6 +70,7 @@ struct ClippingExample : SlimApp {
             if (controls::is_pressed::ctrl) {
                 if (key == 'W') draw_wireframe = !draw_wireframe;
                 if (key == 'A') viewport.canvas.antialias = viewport.canvas.antialias == NoAA ? SSAA : NoAA;
+                if (key == 'D') raterizer.setDeferredShading(!raterizer.deferred_shading);
             }
         }
 
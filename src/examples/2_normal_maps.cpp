@@ -76,6 +76,9 @@ struct NormalMapsExample : SlimApp {
 
         dog_material.texture_ids[0] = 2;
         dog_material.texture_ids[1] = 3;
+
+        // Have the rasterizer sample the normal maps ahead of shading (for multiple pixels at a time):
+        floor_material.presampled_textures = dog_material.presampled_textures = 1 << 1;
     }
 
     void OnRender() override {
@@ -133,7 +136,7 @@ struct NormalMapsExample : SlimApp {
                 mouse::wheel_scrolled = false;
                 wheel_scroll_handled = true;
                 material.normal_magnitude += mouse::wheel_scroll_amount * 0.001f;
-                material.normal_magnitude = clampedValue(material.normal_magnitude, 0, 4);
+                material.normal_magnitude = clampedValue(material.normal_magnitude, 0.0f, 4.0f);
                 NormalMagnitude.value = material.normal_magnitude;
             }
         } else if (!controls::is_pressed::alt) viewport.updateNavigation(delta_time);
@@ -21,13 +21,30 @@ static ColorID MIP_LEVEL_COLORS[9] = {
 };
 void shadeDebugHybridTextured(Shaded &shaded, const Scene &scene) {
     Texture &texture = scene.textures[shaded.material->texture_count > 1 ? shaded.material->texture_ids[0] : 0];
-    i32 mip_level = (i32)Texture::GetMipLevel(texture, shaded.uv_area);
-    mip_level += (i32)shaded.material->shininess;
-    if (mip_level >= (i32)texture.mip_count)
+    i32 mip_offset = (i32)shaded.material->shininess;
+    f32 uv_area = shaded.uv_area;
+    if (texture.isAnisotropic()) {
+        bool major_is_x;
+        uv_area /= (f32)texture.probeCount(uv_area, shaded.dUVdx, shaded.dUVdy, major_is_x);
+    }
+    i32 mip_level = (i32)Texture::GetMipLevel(texture, uv_area) + mip_offset;
+    f32 blend = 0;
+    if (texture.trilinear) {
+        f32 level_of_detail = texture.levelOfDetail(uv_area) + (f32)mip_offset;
+        if (level_of_detail < 0) level_of_detail = 0;
+        mip_level = (i32)level_of_detail;
+        blend = level_of_detail - (f32)mip_level;
+    }
+    if (mip_level >= (i32)texture.mip_count - 1) {
         mip_level = (i32)texture.mip_count - 1;
-    if (mip_level < 0)
-        mip_level = 0;
-    shaded.color = shaded.coords.x > (i32)shaded.material->roughness ? MIP_LEVEL_COLORS[mip_level] : texture.mips[mip_level].sample(shaded.u, shaded.v).color;
+        blend = 0;
+    }
+    if (mip_level < (i32)texture.first_resident_mip)
+        mip_level = (i32)texture.first_resident_mip;
+    if (shaded.coords.x > (i32)shaded.material->roughness)
+        shaded.color = Color{MIP_LEVEL_COLORS[mip_level]}.lerpTo(Color{MIP_LEVEL_COLORS[mip_level + (blend > 0)]}, blend);
+    else
+        shaded.color = (mip_offset ? texture.mips[mip_level].sample(shaded.u, shaded.v) : texture.sample(shaded.u, shaded.v, shaded.uv_area, shaded.dUVdx, shaded.dUVdy)).color;
 }
 
 
@@ -41,16 +58,26 @@ struct NormalMapsExample : SlimApp {
     Viewport viewport{canvas, &camera};
 
     bool draw_wireframe = false;
+    bool trilinear = false;
+    bool anisotropic = false;
 
     HUDLine Fps{      (char*)"Fps      : "};
     HUDLine Wireframe{(char*)"Wireframe: ",
                       (char*)"Off",
                       (char*)"On",
                       &draw_wireframe, true, Grey};
+    HUDLine Filtering{(char*)"Filtering: ",
+                      (char*)"Bilinear",
+                      (char*)"Trilinear",
+                      &trilinear, true, Grey};
+    HUDLine Anisotropy{(char*)"Anisotropy: ",
+                       (char*)"Off",
+                       (char*)"8x",
+                       &anisotropic, true, Grey};
     HUDLine Antialias{(char*)"Antialias: ", Grey};
     HUDLine NormalMagnitude{(char*)"Normal Magnitude: "}, *hud_lines{&Fps};
 
-    HUDSettings hud_settings{4,1.2f};
+    HUDSettings hud_settings{6,1.2f};
     HUD hud{hud_settings, hud_lines};
 
     // Scene:
@@ -135,6 +162,14 @@ struct NormalMapsExample : SlimApp {
                     dog_material.texture_ids[1] = 3;
                 }
             }
+            if (key == 'L') {
+                trilinear = !trilinear;
+                for (Texture &texture : textures) texture.trilinear = trilinear;
+            }
+            if (key == 'I') {
+                anisotropic = !anisotropic;
+                for (Texture &texture : textures) texture.max_anisotropy = anisotropic ? 8 : 1;
+            }
             if (key == '1') {
                 floor_material.shininess -= 1;
                 dog_material.shininess -= 1;
@@ -185,7 +220,7 @@ struct NormalMapsExample : SlimApp {
                 mouse::wheel_scrolled = false;
                 wheel_scroll_handled = true;
                 material.normal_magnitude += mouse::wheel_scroll_amount * 0.001f;
-                material.normal_magnitude = clampedValue(material.normal_magnitude, 0, 4);
+                material.normal_magnitude = clampedValue(material.normal_magnitude, 0.0f, 4.0f);
                 NormalMagnitude.value = material.normal_magnitude;
             }
         } else if (!controls::is_pressed::alt) viewport.updateNavigation(delta_time);
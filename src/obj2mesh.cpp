@@ -10,9 +10,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <unordered_set>
+#include <unordered_map>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <math.h>
 
+#ifdef _WIN32
 #include "./slim/platforms/win32_base.h"
+#else
+#include "./slim/platforms/linux_base.h"
+#endif
 #include "./slim/scene/bvh_builder.h"
+#include "./slim/scene/meshlet_builder.h"
 #include "./slim/serialization/mesh.h"
 
 // Or using the single-header file:
@@ -25,7 +35,432 @@ enum VertexAttributes {
     VertexAttributes_PositionsUVsAndNormals
 };
 
-int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_order = false, f32 scale = 1, float rotY = 0) {
+// The position, normal and uv indices of a triangle corner, identifying a vertex of a welded mesh:
+struct CornerIndices {
+    u32 position, normal, uv;
+
+    bool operator==(const CornerIndices &other) const {
+        return position == other.position && normal == other.normal && uv == other.uv;
+    }
+};
+
+struct CornerIndicesHash {
+    size_t operator()(const CornerIndices &corner) const {
+        u64 hash = corner.position;
+        hash = hash * 0x9E3779B97F4A7C15ull + corner.normal;
+        hash = hash * 0x9E3779B97F4A7C15ull + corner.uv;
+        return (size_t)(hash ^ (hash >> 32));
+    }
+};
+
+// Make each unique combination of position, normal and uv (of any triangle corner) a vertex of its own,
+// so that all vertex attributes can be fetched using the position indices alone:
+void weld(const Mesh &mesh, Mesh &welded, memory::MonotonicAllocator &memory_allocator) {
+    std::unordered_map<CornerIndices, u32, CornerIndicesHash> vertex_ids;
+    std::vector<CornerIndices> vertices;
+    std::vector<TriangleVertexIndices> triangles(mesh.triangle_count);
+    std::vector<u32> vertex_id_of_position(mesh.vertex_count, 0);
+
+    vertex_ids.reserve(mesh.vertex_count);
+    vertices.reserve(mesh.vertex_count);
+    for (u32 t = 0; t < mesh.triangle_count; t++) {
+        for (u8 i = 0; i < 3; i++) {
+            CornerIndices corner;
+            corner.position = mesh.vertex_position_indices[t].ids[i];
+            corner.normal   = mesh.normals_count ? mesh.vertex_normal_indices[t].ids[i] : 0;
+            corner.uv       = mesh.uvs_count     ? mesh.vertex_uvs_indices[t].ids[i]    : 0;
+
+            auto found = vertex_ids.find(corner);
+            u32 vertex_id;
+            if (found == vertex_ids.end()) {
+                vertex_id = (u32)vertices.size();
+                vertex_ids[corner] = vertex_id;
+                vertices.push_back(corner);
+                vertex_id_of_position[corner.position] = vertex_id;
+            } else
+                vertex_id = found->second;
+
+            triangles[t].ids[i] = vertex_id;
+        }
+    }
+
+    welded.welded = true;
+    welded.aabb = mesh.aabb;
+    welded.bvh.node_count = mesh.bvh.node_count;
+    welded.bvh.height = mesh.bvh.height;
+    welded.triangle_count = mesh.triangle_count;
+    welded.edge_count = mesh.edge_count;
+    welded.vertex_count = (u32)vertices.size();
+    welded.normals_count = mesh.normals_count ? welded.vertex_count : 0;
+    welded.uvs_count     = mesh.uvs_count     ? welded.vertex_count : 0;
+
+    memory_allocator = memory::MonotonicAllocator{getSizeInBytes(welded)};
+    allocateMemory(welded, &memory_allocator);
+
+    for (u32 v = 0; v < welded.vertex_count; v++) {
+        const CornerIndices &vertex = vertices[v];
+        welded.vertex_positions[v] = mesh.vertex_positions[vertex.position];
+        if (welded.normals_count) welded.vertex_normals[v] = mesh.vertex_normals[vertex.normal];
+        if (welded.uvs_count)     welded.vertex_uvs[v]     = mesh.vertex_uvs[vertex.uv];
+    }
+    for (u32 t = 0; t < welded.triangle_count; t++)
+        welded.vertex_position_indices[t] = triangles[t];
+
+    // Edges connect positions, so they're kept as they are (just pointing at one of the vertices at each position):
+    for (u32 e = 0; e < welded.edge_count; e++) {
+        welded.edge_vertex_indices[e].from = vertex_id_of_position[mesh.edge_vertex_indices[e].from];
+        welded.edge_vertex_indices[e].to   = vertex_id_of_position[mesh.edge_vertex_indices[e].to];
+    }
+}
+
+// Levels of detail keep halving the triangle count of the previous one, down to about this many triangles:
+#define LOD_MIN_TRIANGLE_COUNT 64
+#define LOD_MAX_COUNT 8
+
+// Edges of the mesh's border are kept in place by this much more than its surface is:
+#define LOD_BORDER_WEIGHT 10
+
+// A symmetric 4x4 matrix that sums the squared distances of a point to a set of (weighted) planes:
+struct Quadric {
+    f64 xx{0}, xy{0}, xz{0}, xw{0}, yy{0}, yz{0}, yw{0}, zz{0}, zw{0}, ww{0};
+
+    void addPlane(const vec3 &normal, f64 d, f64 weight = 1) {
+        const f64 x = normal.x, y = normal.y, z = normal.z;
+        xx += weight * x * x; xy += weight * x * y; xz += weight * x * z; xw += weight * x * d;
+        yy += weight * y * y; yz += weight * y * z; yw += weight * y * d;
+        zz += weight * z * z; zw += weight * z * d;
+        ww += weight * d * d;
+    }
+
+    Quadric operator + (const Quadric &rhs) const {
+        return {xx + rhs.xx, xy + rhs.xy, xz + rhs.xz, xw + rhs.xw, yy + rhs.yy,
+                yz + rhs.yz, yw + rhs.yw, zz + rhs.zz, zw + rhs.zw, ww + rhs.ww};
+    }
+
+    f64 error(const vec3 &point) const {
+        const f64 x = point.x, y = point.y, z = point.z;
+        return x * (xx * x + 2 * (xy * y + xz * z + xw)) +
+               y * (yy * y + 2 * (yz * z + yw)) +
+               z * (zz * z + 2 * zw) + ww;
+    }
+};
+
+struct PointKey {
+    u32 x, y, z;
+
+    bool operator==(const PointKey &other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+struct PointKeyHash {
+    size_t operator()(const PointKey &key) const {
+        u64 hash = key.x;
+        hash = hash * 0x9E3779B97F4A7C15ull + key.y;
+        hash = hash * 0x9E3779B97F4A7C15ull + key.z;
+        return (size_t)(hash ^ (hash >> 32));
+    }
+};
+
+// Moving a point (with all of its triangle corners) onto a neighbouring one, at the cost of the quadric error there:
+struct Collapse {
+    f64 cost;
+    u32 from, to;
+    u32 from_version, to_version;
+
+    bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+// Simplifies a mesh by quadric edge collapses (Garland-Heckbert), each moving a point onto one of its neighbours
+// (so levels of detail only ever use vertices of the mesh itself), cheapest first.
+// Points are the distinct vertex positions: Corners of different vertices at the same position (across uv or
+// normal seams of welded meshes) move together, each taking on the vertex of the corresponding corner at the
+// target point (in a triangle that gets collapsed away along with the edge).
+// Collapses that would flip a triangle over, or pinch the surface (the two points sharing neighbours other than the
+// ones across the collapsed edge) are skipped. The error of a level of detail is the square root of the largest
+// quadric error of its collapses (sums of squared distances, so not less than the distance to any of the planes).
+struct LODBuilder {
+    const Mesh &mesh;
+    std::vector<CornerIndices> corners;
+    std::vector<u32> corner_points;
+    std::vector<vec3> points;
+    std::vector<Quadric> quadrics;
+    std::vector<u32> versions;
+    std::vector<std::vector<u32>> point_triangles;
+    std::vector<bool> removed_triangles;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> collapses;
+    std::vector<u32> shared, moved, neighbours, from_neighbours, to_neighbours; // Scratch lists of a collapse
+    u32 live_triangle_count;
+    f64 max_cost{0};
+
+    explicit LODBuilder(const Mesh &mesh) : mesh{mesh},
+            corners(mesh.triangle_count * 3), corner_points(mesh.triangle_count * 3),
+            removed_triangles(mesh.triangle_count, false), live_triangle_count{mesh.triangle_count} {
+        std::unordered_map<PointKey, u32, PointKeyHash> point_ids;
+        std::vector<u32> point_of_position(mesh.vertex_count);
+        for (u32 v = 0; v < mesh.vertex_count; v++) {
+            const vec3 &position = mesh.vertex_positions[v];
+            PointKey key;
+            memcpy(&key, &position, sizeof(PointKey));
+            auto found = point_ids.find(key);
+            if (found == point_ids.end()) {
+                point_ids[key] = (u32)points.size();
+                point_of_position[v] = (u32)points.size();
+                points.push_back(position);
+            } else
+                point_of_position[v] = found->second;
+        }
+        quadrics.resize(points.size());
+        versions.resize(points.size(), 0);
+        point_triangles.resize(points.size());
+
+        for (u32 t = 0; t < mesh.triangle_count; t++)
+            for (u8 i = 0; i < 3; i++) {
+                CornerIndices &corner = corners[t * 3 + i];
+                corner.position = mesh.vertex_position_indices[t].ids[i];
+                corner.normal = mesh.normals_count && !mesh.welded ? mesh.vertex_normal_indices[t].ids[i] : 0;
+                corner.uv     = mesh.uvs_count     && !mesh.welded ? mesh.vertex_uvs_indices[t].ids[i]    : 0;
+                corner_points[t * 3 + i] = point_of_position[corner.position];
+                point_triangles[corner_points[t * 3 + i]].push_back(t);
+            }
+
+        // Each point starts with the planes of its triangles, and of the border edges it is on
+        // (planes through those edges, perpendicular to their triangle). Degenerate triangles have no plane, but
+        // their edges still count as shared (e.g. at the poles of a UV sphere), so as not to be taken for borders:
+        std::unordered_map<u64, u32> edge_triangles;
+        for (u32 t = 0; t < mesh.triangle_count; t++) {
+            const u32 *p = &corner_points[t * 3];
+            vec3 normal = (points[p[1]] - points[p[0]]).cross(points[p[2]] - points[p[0]]);
+            if (normal.nonZero()) {
+                normal = normal.normalized();
+                for (u8 i = 0; i < 3; i++) quadrics[p[i]].addPlane(normal, -normal.dot(points[p[0]]));
+            }
+            for (u8 i = 0; i < 3; i++) {
+                u32 a = p[i], b = p[(i + 1) % 3];
+                if (a == b)
+                    continue;
+
+                u64 key = a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+                auto found = edge_triangles.find(key);
+                if (found == edge_triangles.end()) edge_triangles[key] = t;
+                else found->second = 0xFFFFFFFF;
+            }
+        }
+        for (auto &edge : edge_triangles) {
+            if (edge.second == 0xFFFFFFFF)
+                continue;
+
+            const u32 *p = &corner_points[edge.second * 3];
+            vec3 normal = (points[p[1]] - points[p[0]]).cross(points[p[2]] - points[p[0]]);
+            u32 a = (u32)(edge.first >> 32), b = (u32)edge.first;
+            vec3 border_normal = (points[b] - points[a]).cross(normal);
+            if (!border_normal.nonZero())
+                continue;
+
+            border_normal = border_normal.normalized();
+            f64 d = -border_normal.dot(points[a]);
+            quadrics[a].addPlane(border_normal, d, LOD_BORDER_WEIGHT);
+            quadrics[b].addPlane(border_normal, d, LOD_BORDER_WEIGHT);
+        }
+
+        for (u32 point = 0; point < (u32)points.size(); point++) pushCollapses(point, true);
+    }
+
+    // Collapse edges until at most the given number of triangles are left (or no more edges can be collapsed):
+    bool simplify(u32 target_triangle_count) {
+        while (live_triangle_count > target_triangle_count && !collapses.empty()) {
+            Collapse collapse = collapses.top();
+            collapses.pop();
+            if (collapse.from_version != versions[collapse.from] ||
+                collapse.to_version   != versions[collapse.to])
+                continue;
+
+            if (tryCollapse(collapse.from, collapse.to) && collapse.cost > max_cost)
+                max_cost = collapse.cost;
+        }
+        return live_triangle_count <= target_triangle_count;
+    }
+
+    f32 error() const { return (f32)sqrt(max_cost > 0 ? max_cost : 0); }
+
+    // Append the triangles that are left (and the vertices they use) as a level of detail:
+    void addLOD(std::vector<MeshLOD> &lods, std::vector<CornerIndices> &triangles,
+                std::vector<u32> &position_ids, std::vector<u32> &normal_ids) const {
+        const bool separate_normals = mesh.normals_count && !mesh.welded;
+        MeshLOD lod;
+        lod.error = error();
+        lod.first_triangle = (u32)(triangles.size() / 3);
+        lod.first_position = (u32)position_ids.size();
+        lod.first_normal = separate_normals ? (u32)normal_ids.size() : lod.first_position;
+        std::vector<bool> listed_positions(mesh.vertex_count, false), listed_normals(mesh.normals_count, false);
+        for (u32 t = 0; t < mesh.triangle_count; t++) {
+            if (removed_triangles[t])
+                continue;
+
+            for (u8 i = 0; i < 3; i++) {
+                const CornerIndices &corner = corners[t * 3 + i];
+                triangles.push_back(corner);
+                if (!listed_positions[corner.position]) {
+                    listed_positions[corner.position] = true;
+                    position_ids.push_back(corner.position);
+                }
+                if (separate_normals && !listed_normals[corner.normal]) {
+                    listed_normals[corner.normal] = true;
+                    normal_ids.push_back(corner.normal);
+                }
+            }
+        }
+        lod.triangle_count = (u32)(triangles.size() / 3) - lod.first_triangle;
+        lod.position_count = (u32)position_ids.size() - lod.first_position;
+        lod.normal_count = separate_normals ? (u32)normal_ids.size() - lod.first_normal :
+                           (mesh.normals_count ? lod.position_count : 0);
+        lods.push_back(lod);
+    }
+
+private:
+    void pushCollapse(u32 from, u32 to) {
+        collapses.push({(quadrics[from] + quadrics[to]).error(points[to]), from, to, versions[from], versions[to]});
+    }
+
+    // Push the collapses of the edges of a point (in both directions), or only those of its edges to points that come
+    // after it (for pushing each edge once when going over all points):
+    void pushCollapses(u32 point, bool only_later = false) {
+        neighbours.clear();
+        addNeighbours(point, neighbours);
+        for (u32 other : neighbours)
+            if (!only_later || other > point) {
+                pushCollapse(point, other);
+                pushCollapse(other, point);
+            }
+    }
+
+    bool hasPoint(u32 t, u32 point) const {
+        const u32 *p = &corner_points[t * 3];
+        return p[0] == point || p[1] == point || p[2] == point;
+    }
+
+    void addNeighbours(u32 point, std::vector<u32> &neighbours) const {
+        for (u32 t : point_triangles[point])
+            if (!removed_triangles[t])
+                for (u8 i = 0; i < 3; i++) {
+                    u32 other = corner_points[t * 3 + i];
+                    if (other != point && std::find(neighbours.begin(), neighbours.end(), other) == neighbours.end())
+                        neighbours.push_back(other);
+                }
+    }
+
+    bool tryCollapse(u32 from, u32 to) {
+        shared.clear();
+        moved.clear();
+        for (u32 t : point_triangles[from])
+            if (!removed_triangles[t])
+                (hasPoint(t, to) ? shared : moved).push_back(t);
+        if (shared.empty())
+            return false;
+
+        from_neighbours.clear();
+        to_neighbours.clear();
+        addNeighbours(from, from_neighbours);
+        addNeighbours(to, to_neighbours);
+        u32 common_count = 0;
+        for (u32 neighbour : from_neighbours)
+            if (std::find(to_neighbours.begin(), to_neighbours.end(), neighbour) != to_neighbours.end())
+                common_count++;
+        if (common_count != shared.size())
+            return false;
+
+        for (u32 t : moved) {
+            const u32 *p = &corner_points[t * 3];
+            vec3 moved_points[3];
+            for (u8 i = 0; i < 3; i++) moved_points[i] = points[p[i] == from ? to : p[i]];
+            vec3 before = (points[p[1]] - points[p[0]]).cross(points[p[2]] - points[p[0]]);
+            vec3 after = (moved_points[1] - moved_points[0]).cross(moved_points[2] - moved_points[0]);
+            if (!after.nonZero() || (before.nonZero() && before.normalized().dot(after.normalized()) < 0.2f))
+                return false;
+        }
+
+        for (u32 t : moved)
+            for (u8 i = 0; i < 3; i++) {
+                if (corner_points[t * 3 + i] != from)
+                    continue;
+
+                corner_points[t * 3 + i] = to;
+                corners[t * 3 + i] = targetCorner(corners[t * 3 + i], from, to);
+                point_triangles[to].push_back(t);
+            }
+        for (u32 t : shared) {
+            removed_triangles[t] = true;
+            live_triangle_count--;
+        }
+        point_triangles[from].clear();
+        std::vector<u32> &to_triangles = point_triangles[to];
+        to_triangles.erase(std::remove_if(to_triangles.begin(), to_triangles.end(),
+                                          [this](u32 t) { return (bool)removed_triangles[t]; }), to_triangles.end());
+        quadrics[to] = quadrics[to] + quadrics[from];
+        versions[from]++;
+        versions[to]++;
+        pushCollapses(to);
+        return true;
+    }
+
+    // The corner at the target point of a collapsed triangle that has the same vertex at the moved point:
+    CornerIndices targetCorner(const CornerIndices &corner, u32 from, u32 to) const {
+        u32 target = shared[0] * 3;
+        for (u32 t : shared)
+            for (u8 i = 0; i < 3; i++)
+                if (corner_points[t * 3 + i] == from && corners[t * 3 + i] == corner)
+                    target = t * 3;
+        while (corner_points[target] != to) target++;
+        return corners[target];
+    }
+};
+
+// Generate levels of detail for a mesh, in memory of their own. Each one halves the triangle count of the previous
+// one, until getting down to about LOD_MIN_TRIANGLE_COUNT triangles or simplification stalls:
+void buildLODs(Mesh &mesh) {
+    std::vector<MeshLOD> lods;
+    std::vector<CornerIndices> triangles;
+    std::vector<u32> position_ids, normal_ids;
+    LODBuilder lod_builder{mesh};
+    u32 triangle_count = mesh.triangle_count;
+    while (lods.size() < LOD_MAX_COUNT && triangle_count / 2 >= LOD_MIN_TRIANGLE_COUNT) {
+        lod_builder.simplify(triangle_count / 2);
+        if (lod_builder.live_triangle_count > triangle_count * 3 / 4)
+            break;
+
+        triangle_count = lod_builder.live_triangle_count;
+        lod_builder.addLOD(lods, triangles, position_ids, normal_ids);
+    }
+
+    mesh.lod_count = (u32)lods.size();
+    mesh.lod_triangle_count = (u32)(triangles.size() / 3);
+    mesh.lod_position_id_count = (u32)position_ids.size();
+    mesh.lod_normal_id_count = (u32)normal_ids.size();
+    if (!mesh.lod_count)
+        return;
+
+    memory::MonotonicAllocator memory_allocator{getLODsSizeInBytes(mesh)};
+    allocateLODs(mesh, &memory_allocator);
+    for (u32 i = 0; i < mesh.lod_count; i++) mesh.lods[i] = lods[i];
+    for (u32 t = 0; t < mesh.lod_triangle_count; t++)
+        for (u8 i = 0; i < 3; i++) {
+            const CornerIndices &corner = triangles[t * 3 + i];
+            mesh.lod_vertex_position_indices[t].ids[i] = corner.position;
+            if (mesh.lod_vertex_normal_indices != mesh.lod_vertex_position_indices) mesh.lod_vertex_normal_indices[t].ids[i] = corner.normal;
+            if (mesh.lod_vertex_uvs_indices    != mesh.lod_vertex_position_indices) mesh.lod_vertex_uvs_indices[t].ids[i]    = corner.uv;
+        }
+    for (u32 i = 0; i < mesh.lod_position_id_count; i++) mesh.lod_position_ids[i] = position_ids[i];
+    for (u32 i = 0; i < mesh.lod_normal_id_count;   i++) mesh.lod_normal_ids[i]   = normal_ids[i];
+}
+
+// Partition the (leaf-ordered) triangles of a mesh into meshlets, in memory of their own:
+void buildMeshlets(Mesh &mesh) {
+    MeshletBuilder meshlet_builder;
+    meshlet_builder.count(mesh);
+    memory::MonotonicAllocator memory_allocator{getMeshletsSizeInBytes(mesh)};
+    allocateMeshlets(mesh, &memory_allocator);
+    meshlet_builder.build(mesh);
+}
+
+int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_order = false, f32 scale = 1, float rotY = 0, bool weld_vertices = false) {
     const u8 v1_id = 0;
     const u8 v2_id = invert_winding_order ? 2 : 1;
     const u8 v3_id = invert_winding_order ? 1 : 2;
@@ -230,8 +665,20 @@ int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_orde
             mesh.vertex_positions[i] -= centroid;
     }
 
-    builder.buildMesh(mesh);
-    save(mesh, mesh_file_path);
+    if (weld_vertices) {
+        Mesh welded;
+        memory::MonotonicAllocator welded_memory_allocator;
+        weld(mesh, welded, welded_memory_allocator);
+        builder.buildMesh(welded);
+        buildMeshlets(welded);
+        buildLODs(welded);
+        save(welded, mesh_file_path);
+    } else {
+        builder.buildMesh(mesh);
+        buildMeshlets(mesh);
+        buildLODs(mesh);
+        save(mesh, mesh_file_path);
+    }
 
     return 0;
 }
@@ -242,24 +689,29 @@ int main(int argc, char *argv[]) {
                        "An '.obj' file (input) then a '.mesh' file (output), "
                        "an optional flag '-invert_winding_order' for inverting winding order"
                        "an optional flag 'scale:<float>' for scaling the mesh,"
-                       "an optional flag 'rotY:<float> for rotating the mesh around Y"
+                       "an optional flag 'rotY:<float> for rotating the mesh around Y, "
+                       "an optional flag '-weld' for a single index per vertex (each unique position/normal/uv being a vertex)"
                        ));
         return 0;
     } else if (argc == 3 || // 2 arguments
                argc == 4 || // 3 arguments
                argc == 5 || // 4 arguments
-               argc == 6    // 5 arguments
+               argc == 6 || // 5 arguments
+               argc == 7    // 6 arguments
             ) {
         char *obj_file_path = argv[1];
         char *mesh_file_path = argv[2];
         if (argc == 3) return obj2mesh(obj_file_path, mesh_file_path);
 
         bool invert_winding_order = false;
+        bool weld_vertices = false;
         float scale{1}, rotY{0};
         for (u32 i = 3; i < (u32)argc; i++) {
             char *arg = argv[i];
             if (strcmp(arg, (char *) "-invert_winding_order") == 0)
                 invert_winding_order = true;
+            else if (strcmp(arg, (char *) "-weld") == 0)
+                weld_vertices = true;
             else {
                 char *scale_arg_prefix = (char *) "scale:";
                 bool is_scale_arg = true;
@@ -282,7 +734,7 @@ int main(int argc, char *argv[]) {
                 }
             }
         }
-        return obj2mesh(obj_file_path, mesh_file_path, invert_winding_order, scale, rotY);
+        return obj2mesh(obj_file_path, mesh_file_path, invert_winding_order, scale, rotY, weld_vertices);
     }
 
     printf((char*)("Exactly 2 file paths need to be provided: "
@@ -292,4 +744,4 @@ int main(int argc, char *argv[]) {
 }
 
 
-//suzanne.obj suzanne.mesh -invert_winding_order scale:2 rotY:90
\ No newline at end of file
+//suzanne.obj suzanne.mesh -invert_winding_order scale:2 rotY:90 -weld
\ No newline at end of file
@@ -38,4 +38,8 @@ struct SlimApp {
 
 SlimApp* createApp();
 
-#include "./platforms/win32.h"
\ No newline at end of file
+#ifdef _WIN32
+#include "./platforms/win32.h"
+#else
+#include "./platforms/linux.h"
+#endif
\ No newline at end of file
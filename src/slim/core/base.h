@@ -101,10 +101,17 @@
 
 typedef unsigned char      u8;
 typedef unsigned short     u16;
-typedef unsigned long int  u32;
 typedef unsigned long long u64;
 typedef signed   short     i16;
+typedef signed   long long i64;
+#ifdef _WIN32
+typedef unsigned long int  u32;
 typedef signed   long int  i32;
+#else
+// 'long' is 64 bits wide on LP64 platforms:
+typedef unsigned int       u32;
+typedef signed   int       i32;
+#endif
 
 typedef float  f32;
 typedef double f64;
@@ -141,6 +148,8 @@ typedef double f64;
 #define MAX_HEIGHT 2160
 #define MAX_WINDOW_SIZE (MAX_WIDTH * MAX_HEIGHT)
 
+#define MAX_THREAD_COUNT 64
+
 #define DEFAULT_WIDTH 240
 #define DEFAULT_HEIGHT 180
 
@@ -797,6 +806,52 @@ struct Color {
     }
 };
 
+// Canvases hold linear colors: Colors drawn to them are decoded from a gamma of 2 (squared), and are encoded back to it
+// (square-rooted) when displayed. Bitmaps are decoded from a gamma of 2.2 as they are loaded.
+// Decoding 8-bit components is done through a table (holding the exact results), while encoding to 8-bit components
+// is exact by default, or done through a table when SLIM_APPROXIMATE_GAMMA is defined (off by at most 1).
+// The encoding table is indexed by the leading bits of a float (its exponent and top mantissa bits), covering 16
+// octaves below 1 (anything darker encodes to 0) in steps small enough for the square root to change by under 1/512.
+#define BITMAP_GAMMA 2.2f
+#define GAMMA_ENCODE_MANTISSA_BITS 8
+#define GAMMA_ENCODE_OCTAVES 16
+#define GAMMA_ENCODE_TABLE_SIZE ((GAMMA_ENCODE_OCTAVES << GAMMA_ENCODE_MANTISSA_BITS) + 1)
+#define GAMMA_ENCODE_FIRST_BITS (0x3F800000u - (GAMMA_ENCODE_OCTAVES << 23)) // Of 2^-16
+
+struct GammaTables {
+    f32 bitmap_decode[256];
+    u8 display_encode[GAMMA_ENCODE_TABLE_SIZE];
+
+    GammaTables() {
+        for (u32 i = 0; i < 256; i++) bitmap_decode[i] = powf((f32)i * COLOR_COMPONENT_TO_FLOAT, BITMAP_GAMMA);
+
+        // Each entry holds the encoding of the middle of the range of components it covers:
+        for (u32 i = 0; i < GAMMA_ENCODE_TABLE_SIZE; i++) {
+            union { u32 bits; f32 component; };
+            bits = GAMMA_ENCODE_FIRST_BITS + (i << (23 - GAMMA_ENCODE_MANTISSA_BITS)) + (1u << (22 - GAMMA_ENCODE_MANTISSA_BITS));
+            display_encode[i] = component >= 1.0f ? MAX_COLOR_VALUE : (u8)(FLOAT_TO_COLOR_COMPONENT * sqrtf(component));
+        }
+    }
+};
+
+GammaTables gamma_tables;
+
+INLINE_XPU Color decodeDisplayGamma(const Color &color) {
+    return color * color;
+}
+
+INLINE_XPU u8 encodeDisplayGamma(f32 component) {
+#if defined(SLIM_APPROXIMATE_GAMMA) && !defined(__CUDA_ARCH__)
+    union { f32 value; u32 bits; };
+    value = component;
+    if ((i32)bits < (i32)GAMMA_ENCODE_FIRST_BITS) return 0; // Also for negative components
+    u32 index = (bits - GAMMA_ENCODE_FIRST_BITS) >> (23 - GAMMA_ENCODE_MANTISSA_BITS);
+    return index < GAMMA_ENCODE_TABLE_SIZE ? gamma_tables.display_encode[index] : MAX_COLOR_VALUE;
+#else
+    return (u8)(component > 1.0f ? MAX_COLOR_VALUE : (FLOAT_TO_COLOR_COMPONENT * sqrt(component)));
+#endif
+}
+
 struct Pixel {
     Color color;
     f32 opacity;
@@ -866,10 +921,7 @@ struct Pixel {
     }
 
     INLINE_XPU u32 asContent() const {
-        u8 R = (u8)(color.r > 1.0f ? MAX_COLOR_VALUE : (FLOAT_TO_COLOR_COMPONENT * sqrt(color.r)));
-        u8 G = (u8)(color.g > 1.0f ? MAX_COLOR_VALUE : (FLOAT_TO_COLOR_COMPONENT * sqrt(color.g)));
-        u8 B = (u8)(color.b > 1.0f ? MAX_COLOR_VALUE : (FLOAT_TO_COLOR_COMPONENT * sqrt(color.b)));
-        return R << 16 | G << 8 | B;
+        return encodeDisplayGamma(color.r) << 16 | encodeDisplayGamma(color.g) << 8 | encodeDisplayGamma(color.b);
     }
 };
 
@@ -972,6 +1024,7 @@ union ImageFlags {
         unsigned int mipmap:1;
         unsigned int flip:1;
         unsigned int wrap:1;
+        unsigned int compression:2; // A TextureCompression (for textures)
     };
     u32 flags = 0;
 };
@@ -992,10 +1045,20 @@ struct PixelImage : Image<Pixel> {};
 struct FloatImage : Image<f32> {};
 struct ByteColorImage : Image<ByteColor> {};
 
+// A coarse depth bound for a square block of depths (see Canvas):
+struct DepthTile {
+    f32 max_depth; // No depth within the block is further than this
+    bool dirty;    // Depths within the block were lowered since the bound was last computed
+};
+
+#define DEPTH_TILE_SHIFT 3
+#define DEPTH_TILE_SIZE (1 << DEPTH_TILE_SHIFT)
+
 #define PIXEL_SIZE (sizeof(Pixel))
 #define CANVAS_PIXELS_SIZE (MAX_WINDOW_SIZE * PIXEL_SIZE * 4)
 #define CANVAS_DEPTHS_SIZE (MAX_WINDOW_SIZE * sizeof(f32) * 4)
-#define CANVAS_SIZE (CANVAS_PIXELS_SIZE + CANVAS_DEPTHS_SIZE)
+#define CANVAS_DEPTH_TILES_SIZE (((MAX_WINDOW_SIZE * 4) >> (DEPTH_TILE_SHIFT * 2)) * sizeof(DepthTile))
+#define CANVAS_SIZE (CANVAS_PIXELS_SIZE + CANVAS_DEPTHS_SIZE + CANVAS_DEPTH_TILES_SIZE)
 
 struct Dimensions {
     u32 width_times_height{(u32)DEFAULT_WIDTH * (u32)DEFAULT_HEIGHT};
@@ -1067,6 +1130,7 @@ namespace controls {
 
 namespace os {
     void* getMemory(u64 size, u64 base = 0);
+    void freeMemory(void *memory, u64 size);
     void setWindowTitle(char* str);
     void setWindowCapture(bool on);
     void setCursorVisibility(bool on);
@@ -1075,6 +1139,14 @@ namespace os {
     void* openFileForWriting(const char* file_path);
     bool readFromFile(void *out, unsigned long, void *handle);
     bool writeToFile(void *out, unsigned long, void *handle);
+    bool setFilePosition(u64 position, void *handle);
+
+    u32 getProcessorCount();
+    bool createThread(void (*thread_proc)(void *data), void *data);
+    void* createSemaphore(u32 initial_count = 0);
+    void signalSemaphore(void *semaphore, u32 count = 1);
+    void waitForSemaphore(void *semaphore);
+    i32 atomicIncrement(volatile i32 *value);
 }
 
 namespace timers {
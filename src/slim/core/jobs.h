@@ -0,0 +1,90 @@
+#pragma once
+
+#include "./base.h"
+
+typedef void (*JobProc)(void *data, u32 job_index, u32 worker_index);
+
+struct JobPool;
+
+struct JobWorker {
+    JobPool *pool;
+    u32 index;
+};
+
+struct JobPool {
+    JobWorker workers[MAX_THREAD_COUNT];
+    void *start_semaphore{nullptr};
+    void *done_semaphore{nullptr};
+
+    JobProc job_proc{nullptr};
+    void *job_data{nullptr};
+    volatile i32 next_job{0};
+    i32 job_count{0};
+
+    u32 worker_count{1};  // Including the calling thread
+    u32 thread_count{0};  // Spawned worker threads (never shut down)
+
+    // Worker threads are spawned lazily and kept parked on a semaphore between runs.
+    // Lowering the worker count leaves surplus threads parked (they are only woken up as needed).
+    void setWorkerCount(u32 count) {
+        if (count < 1) count = 1;
+        if (count > MAX_THREAD_COUNT) count = MAX_THREAD_COUNT;
+
+        if (count > 1 && !start_semaphore) {
+            start_semaphore = os::createSemaphore();
+            done_semaphore  = os::createSemaphore();
+        }
+
+        while (thread_count + 1 < count) {
+            JobWorker &worker = workers[thread_count];
+            worker.pool = this;
+            worker.index = thread_count + 1;
+            if (!os::createThread(_workerProc, &worker))
+                break;
+
+            thread_count++;
+        }
+
+        worker_count = thread_count + 1;
+        if (worker_count > count) worker_count = count;
+    }
+
+    // Run 'count' jobs across all the workers and the calling thread, returning once all of them are done.
+    // Jobs are handed out in index order, but may complete in any order.
+    void run(JobProc proc, void *data, u32 count) {
+        if (!count) return;
+        if (worker_count == 1 || count == 1) {
+            for (u32 i = 0; i < count; i++) proc(data, i, 0);
+            return;
+        }
+
+        job_proc = proc;
+        job_data = data;
+        job_count = (i32)count;
+        next_job = 0;
+
+        u32 woken_count = worker_count - 1;
+        if (woken_count > count - 1) woken_count = count - 1;
+
+        os::signalSemaphore(start_semaphore, woken_count);
+        _work(0);
+        for (u32 i = 0; i < woken_count; i++) os::waitForSemaphore(done_semaphore);
+    }
+
+private:
+    INLINE void _work(u32 worker_index) {
+        i32 job_index;
+        while ((job_index = os::atomicIncrement(&next_job) - 1) < job_count)
+            job_proc(job_data, (u32)job_index, worker_index);
+    }
+
+    static void _workerProc(void *data) {
+        JobWorker &worker = *(JobWorker*)data;
+        JobPool &pool = *worker.pool;
+        while (true) {
+            os::waitForSemaphore(pool.start_semaphore);
+            pool._work(worker.index);
+            os::signalSemaphore(pool.done_semaphore);
+        }
+    }
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "./base.h"
+#include "../math/vec2.h"
+#include "../math/simd.h"
 
 struct TexelQuadComponent {
     u8 TL, TR, BL, BR;
@@ -10,9 +12,207 @@ struct TexelQuad {
     TexelQuadComponent R, G, B;
 };
 
+// Texel quads are laid out in rows, or for textures flagged as tiled in square blocks (each laid out in rows),
+// so that sampling along any direction in texture space mostly stays within the same few cache lines:
+#define TEXEL_QUAD_BLOCK_SHIFT 2
+#define TEXEL_QUAD_BLOCK_SIZE (1 << TEXEL_QUAD_BLOCK_SHIFT)
+#define TEXEL_QUAD_BLOCK_MASK (TEXEL_QUAD_BLOCK_SIZE - 1)
+
+// Textures can instead be block-compressed, storing their texels (rather than texel quads) in blocks of 4x4:
+// BC1 (for colors) as 2 RGB565 endpoints and a 2-bit index per texel into a palette interpolated between them,
+// BC5 (for normal maps) as a BC4 block for each of red and green (2 8-bit endpoints and a 3-bit index per texel),
+// with blue reconstructed as the remaining component of a unit normal. That is 0.5 and 1 byte per texel
+// (as opposed to 12 for texel quads). Blocks are decoded on demand while sampling (see TextureMip::texelQuad).
+enum TextureCompression {
+    TextureCompression_None,
+    TextureCompression_BC1,
+    TextureCompression_BC5
+};
+
+#define TEXTURE_BLOCK_SHIFT 2
+#define TEXTURE_BLOCK_SIZE (1 << TEXTURE_BLOCK_SHIFT)
+#define TEXTURE_BLOCK_MASK (TEXTURE_BLOCK_SIZE - 1)
+#define TEXTURE_BLOCK_TEXEL_COUNT (TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE)
+
+struct BC1Block {
+    u16 color0, color1; // RGB565, with color0 > color1 for a palette of 4 colors
+    u32 indices;        // 2 bits per texel, row by row from the lowest bits
+};
+
+struct BC4Block {
+    u8 value0, value1; // With value0 > value1 for a palette of 8 values
+    u8 indices[6];     // 3 bits per texel, row by row from the lowest bits
+};
+
+struct BC5Block {
+    BC4Block red, green;
+};
+
+// Decodes single texels of compressed blocks, computing just the palette entries that they index
+// (which are the same as those of the palettes that GetPalette computes for encoding):
+struct TextureBlockDecoder {
+    INLINE_XPU static void DecodeRGB565(u16 color, i32 &R, i32 &G, i32 &B) {
+        R = (color >> 11) & 31;
+        G = (color >> 5) & 63;
+        B = color & 31;
+        R = (R << 3) | (R >> 2);
+        G = (G << 2) | (G >> 4);
+        B = (B << 3) | (B >> 2);
+    }
+
+    INLINE_XPU static void GetPalette(const BC1Block &bc1, u8 *R, u8 *G, u8 *B) {
+        i32 R0, G0, B0, R1, G1, B1;
+        DecodeRGB565(bc1.color0, R0, G0, B0);
+        DecodeRGB565(bc1.color1, R1, G1, B1);
+        R[0] = (u8)R0; G[0] = (u8)G0; B[0] = (u8)B0;
+        R[1] = (u8)R1; G[1] = (u8)G1; B[1] = (u8)B1;
+        if (bc1.color0 > bc1.color1) {
+            R[2] = (u8)((2*R0 + R1) / 3); G[2] = (u8)((2*G0 + G1) / 3); B[2] = (u8)((2*B0 + B1) / 3);
+            R[3] = (u8)((R0 + 2*R1) / 3); G[3] = (u8)((G0 + 2*G1) / 3); B[3] = (u8)((B0 + 2*B1) / 3);
+        } else {
+            R[2] = (u8)((R0 + R1) / 2); G[2] = (u8)((G0 + G1) / 2); B[2] = (u8)((B0 + B1) / 2);
+            R[3] = G[3] = B[3] = 0;
+        }
+    }
+
+    INLINE_XPU static void GetPalette(const BC4Block &bc4, u8 *values) {
+        const i32 value0 = bc4.value0;
+        const i32 value1 = bc4.value1;
+        values[0] = (u8)value0;
+        values[1] = (u8)value1;
+        if (value0 > value1)
+            for (i32 i = 1; i < 7; i++) values[i + 1] = (u8)(((7 - i) * value0 + i * value1) / 7);
+        else {
+            for (i32 i = 1; i < 5; i++) values[i + 1] = (u8)(((5 - i) * value0 + i * value1) / 5);
+            values[6] = 0;
+            values[7] = 255;
+        }
+    }
+
+    // Palette entries 2 and up are evenly spaced from endpoint 0 to endpoint 1 in the given number of steps,
+    // so every entry weighs the endpoints by whole steps (entries 0 and 1 fully weighing one of them).
+    // Entries are computed from their weights rather than by branching on their (unpredictable) indices, dividing by
+    // the number of steps through a 16-bit fixed-point reciprocal (rounded up, which is exact for sums up to 7 * 255):
+    INLINE_XPU static i32 GetWeight1(i32 index, i32 steps) { return index - 1 + (i32)(index == 0) + (i32)(index == 1) * steps; }
+
+    INLINE_XPU static u8 DecodeBC1Component(i32 value0, i32 value1, i32 index, bool four_colors) {
+        const i32 steps = four_colors ? 3 : 2;
+        const i32 weight1 = GetWeight1(index, steps);
+        const i32 sum = (steps - weight1) * value0 + weight1 * value1;
+        const i32 value = (sum * (four_colors ? 21846 : 32768)) >> 16;
+        return (u8)(four_colors || index != 3 ? value : 0);
+    }
+
+    INLINE_XPU static u8 DecodeBC4(const BC4Block &bc4, u32 texel_index) {
+        const u32 bit = 3 * texel_index;
+        const u32 byte = bit >> 3;
+        u32 bits = bc4.indices[byte];
+        if (byte < 5) bits |= (u32)bc4.indices[byte + 1] << 8;
+        const i32 index = (i32)((bits >> (bit & 7)) & 7);
+
+        const i32 value0 = bc4.value0;
+        const i32 value1 = bc4.value1;
+        const bool eight_values = value0 > value1;
+        const i32 steps = eight_values ? 7 : 5;
+        const i32 weight1 = GetWeight1(index, steps);
+        const i32 sum = (steps - weight1) * value0 + weight1 * value1;
+        const i32 value = (sum * (eight_values ? 9363 : 13108)) >> 16;
+        return (u8)(eight_values || index < 6 ? value : (index - 6) * 255);
+    }
+
+    // Reconstruct the normal's z component (encoded in the [0, 255] range, as are x and y):
+    INLINE_XPU static u8 DecodeNormalZ(u8 R, u8 G) {
+        const f32 x = fast_mul_add((f32)R, 2.0f / 255.0f, -1.0f);
+        const f32 y = fast_mul_add((f32)G, 2.0f / 255.0f, -1.0f);
+        const f32 z_squared = fast_mul_add(-y, y, fast_mul_add(-x, x, 1.0f));
+        return (u8)fast_mul_add(z_squared > 0 ? sqrtf(z_squared) : 0.0f, 127.5f, 128.0f);
+    }
+
+    // Decode a texel of a block (given its index within it, row by row):
+    INLINE_XPU static void Decode(const u8 *block, u8 compression, u32 texel_index, u8 &R, u8 &G, u8 &B) {
+        if (compression == TextureCompression_BC1) {
+            const BC1Block &bc1 = *(const BC1Block*)block;
+            const i32 index = (i32)((bc1.indices >> (2 * texel_index)) & 3);
+            const bool four_colors = bc1.color0 > bc1.color1;
+            i32 R0, G0, B0, R1, G1, B1;
+            DecodeRGB565(bc1.color0, R0, G0, B0);
+            DecodeRGB565(bc1.color1, R1, G1, B1);
+            R = DecodeBC1Component(R0, R1, index, four_colors);
+            G = DecodeBC1Component(G0, G1, index, four_colors);
+            B = DecodeBC1Component(B0, B1, index, four_colors);
+            return;
+        }
+
+        const BC5Block &bc5 = *(const BC5Block*)block;
+        R = DecodeBC4(bc5.red, texel_index);
+        G = DecodeBC4(bc5.green, texel_index);
+        B = DecodeNormalZ(R, G);
+    }
+};
+
 struct TextureMip {
     u32 width, height;
-    TexelQuad *texel_quads;
+    union {
+        TexelQuad *texel_quads;
+        u8 *blocks; // When compressed
+    };
+    bool tiled{false};
+    bool wrap{false}; // Only needed when compressed, as texel quads already hold their wrapped around texels
+    u8 compression{TextureCompression_None};
+
+    INLINE_XPU static u32 GetBlockCount(u32 width, u32 height) {
+        return ((width + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT) * ((height + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT);
+    }
+
+    INLINE_XPU static u32 GetBlockSize(u8 compression) {
+        return compression == TextureCompression_BC1 ? sizeof(BC1Block) : sizeof(BC5Block);
+    }
+
+    INLINE_XPU static u32 GetContentSize(u32 width, u32 height, bool tiled, u8 compression) {
+        if (compression == TextureCompression_None) return GetTexelQuadCount(width, height, tiled) * sizeof(TexelQuad);
+        return GetBlockCount(width, height) * GetBlockSize(compression);
+    }
+
+    // There are (width + 1) x (height + 1) texel quads, padded to whole blocks when tiled:
+    INLINE_XPU static u32 GetTexelQuadCount(u32 width, u32 height, bool tiled) {
+        if (!tiled) return (width + 1) * (height + 1);
+
+        u32 block_columns = (width  + TEXEL_QUAD_BLOCK_SIZE) >> TEXEL_QUAD_BLOCK_SHIFT;
+        u32 block_rows    = (height + TEXEL_QUAD_BLOCK_SIZE) >> TEXEL_QUAD_BLOCK_SHIFT;
+        return (block_columns * block_rows) << (TEXEL_QUAD_BLOCK_SHIFT * 2);
+    }
+
+    INLINE_XPU u32 texelQuadOffset(u32 x, u32 y) const {
+        if (!tiled) return y * (width + 1) + x;
+
+        u32 block_columns = (width + TEXEL_QUAD_BLOCK_SIZE) >> TEXEL_QUAD_BLOCK_SHIFT;
+        u32 block = (y >> TEXEL_QUAD_BLOCK_SHIFT) * block_columns + (x >> TEXEL_QUAD_BLOCK_SHIFT);
+        return (block << (TEXEL_QUAD_BLOCK_SHIFT * 2)) + ((y & TEXEL_QUAD_BLOCK_MASK) << TEXEL_QUAD_BLOCK_SHIFT) + (x & TEXEL_QUAD_BLOCK_MASK);
+    }
+
+    // The texel quad at (x, y) has the texels from (x - 1, y - 1) to (x, y) at its corners, wrapped around or clamped
+    // at the edges (as bmp2texture lays out texel quads). When compressed, just those 4 texels get decoded:
+    INLINE_XPU TexelQuad texelQuad(u32 x, u32 y) const {
+        if (!compression) return texel_quads[texelQuadOffset(x, y)];
+
+        const u32 left   = x ? x - 1 : (wrap ? width - 1 : 0);
+        const u32 right  = x < width ? x : (wrap ? 0 : width - 1);
+        const u32 top    = y ? y - 1 : (wrap ? height - 1 : 0);
+        const u32 bottom = y < height ? y : (wrap ? 0 : height - 1);
+        TexelQuad texel_quad;
+        decodeTexel(left,  top,    texel_quad.R.TL, texel_quad.G.TL, texel_quad.B.TL);
+        decodeTexel(right, top,    texel_quad.R.TR, texel_quad.G.TR, texel_quad.B.TR);
+        decodeTexel(left,  bottom, texel_quad.R.BL, texel_quad.G.BL, texel_quad.B.BL);
+        decodeTexel(right, bottom, texel_quad.R.BR, texel_quad.G.BR, texel_quad.B.BR);
+        return texel_quad;
+    }
+
+    INLINE_XPU void decodeTexel(u32 x, u32 y, u8 &R, u8 &G, u8 &B) const {
+        const u32 block_columns = (width + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT;
+        const u32 block_index = (y >> TEXTURE_BLOCK_SHIFT) * block_columns + (x >> TEXTURE_BLOCK_SHIFT);
+        TextureBlockDecoder::Decode(blocks + block_index * GetBlockSize(compression), compression,
+                                    ((y & TEXTURE_BLOCK_MASK) << TEXTURE_BLOCK_SHIFT) | (x & TEXTURE_BLOCK_MASK), R, G, B);
+    }
 
     INLINE_XPU Pixel sample(f32 u, f32 v) const {
         if (u > 1) u -= (f32)((u32)u);
@@ -31,7 +231,7 @@ struct TextureMip {
         const f32 bl = b * l * COLOR_COMPONENT_TO_FLOAT;
         const f32 br = b * r * COLOR_COMPONENT_TO_FLOAT;
 
-        const TexelQuad texel_quad = texel_quads[y * (width + 1) + x];
+        const TexelQuad texel_quad = texelQuad(x, y);
         return {
                 fast_mul_add((f32)texel_quad.R.BR, br, fast_mul_add((f32)texel_quad.R.BL, bl, fast_mul_add((f32)texel_quad.R.TR, tr, (f32)texel_quad.R.TL * tl))),
                 fast_mul_add((f32)texel_quad.G.BR, br, fast_mul_add((f32)texel_quad.G.BL, bl, fast_mul_add((f32)texel_quad.G.TR, tr, (f32)texel_quad.G.TL * tl))),
@@ -39,18 +239,208 @@ struct TextureMip {
                 1.0f
         };
     }
+
+#if SIMD_WIDTH > 1
+    // Sample SIMD_WIDTH texture coordinates at once, producing exactly what sample(u, v) would for each.
+    // Texel quads are gathered as 32-bit words per color component (one byte per corner) and widened in place.
+    // Note: All lanes need to hold valid texture coordinates (as unused lanes would still be fetched from).
+    INLINE void sample(f32_lanes u, f32_lanes v, f32_lanes &R, f32_lanes &G, f32_lanes &B) const {
+        const f32_lanes one = simd::set(1.0f);
+        const f32_lanes half = simd::set(0.5f);
+        const f32_lanes component_to_float = simd::set(COLOR_COMPONENT_TO_FLOAT);
+        u = simd::sub(u, simd::and_(simd::lessThan(one, u), simd::toFloat(simd::toInt(u))));
+        v = simd::sub(v, simd::and_(simd::lessThan(one, v), simd::toFloat(simd::toInt(v))));
+
+        const f32_lanes U = simd::add(simd::mul(u, simd::set((f32)width)),  half);
+        const f32_lanes V = simd::add(simd::mul(v, simd::set((f32)height)), half);
+        const i32_lanes x = simd::toInt(U);
+        const i32_lanes y = simd::toInt(V);
+        const f32_lanes r = simd::sub(U, simd::toFloat(x));
+        const f32_lanes b = simd::sub(V, simd::toFloat(y));
+        const f32_lanes l = simd::sub(one, r);
+        const f32_lanes t = simd::sub(one, b);
+        const f32_lanes tl = simd::mul(simd::mul(t, l), component_to_float);
+        const f32_lanes tr = simd::mul(simd::mul(t, r), component_to_float);
+        const f32_lanes bl = simd::mul(simd::mul(b, l), component_to_float);
+        const f32_lanes br = simd::mul(simd::mul(b, r), component_to_float);
+
+        if (compression) {
+            sampleBlocks(x, y, tl, tr, bl, br, R, G, B);
+            return;
+        }
+
+        i32_lanes offsets;
+        const u8 *texel_quad_bytes = (const u8*)texel_quads;
+        if (tiled) {
+            const i32_lanes block_mask = simd::setInt(TEXEL_QUAD_BLOCK_MASK);
+            const i32_lanes block = simd::add(
+                    simd::mul(simd::shiftRight(y, TEXEL_QUAD_BLOCK_SHIFT), simd::setInt((i32)((width + TEXEL_QUAD_BLOCK_SIZE) >> TEXEL_QUAD_BLOCK_SHIFT))),
+                    simd::shiftRight(x, TEXEL_QUAD_BLOCK_SHIFT));
+            offsets = simd::add(simd::add(
+                    simd::shiftLeft(block, TEXEL_QUAD_BLOCK_SHIFT * 2),
+                    simd::shiftLeft(simd::and_(y, block_mask), TEXEL_QUAD_BLOCK_SHIFT)),
+                    simd::and_(x, block_mask));
+        } else
+            offsets = simd::add(simd::mul(y, simd::setInt((i32)width + 1)), x);
+        offsets = simd::mul(offsets, simd::setInt((i32)sizeof(TexelQuad)));
+        R = blend(simd::gather(texel_quad_bytes,                                  offsets), tl, tr, bl, br);
+        G = blend(simd::gather(texel_quad_bytes + sizeof(TexelQuadComponent),     offsets), tl, tr, bl, br);
+        B = blend(simd::gather(texel_quad_bytes + sizeof(TexelQuadComponent) * 2, offsets), tl, tr, bl, br);
+    }
+
+    // Weigh the 4 corners of a texel quad component (packed as bytes, TL being the lowest one):
+    static INLINE f32_lanes blend(i32_lanes component, f32_lanes tl, f32_lanes tr, f32_lanes bl, f32_lanes br) {
+        const i32_lanes byte = simd::setInt(0xFF);
+        const f32_lanes TL = simd::toFloat(simd::and_(component, byte));
+        const f32_lanes TR = simd::toFloat(simd::and_(simd::shiftRight(component, 8), byte));
+        const f32_lanes BL = simd::toFloat(simd::and_(simd::shiftRight(component, 16), byte));
+        const f32_lanes BR = simd::toFloat(simd::shiftRight(component, 24));
+        return simd::mulAdd(BR, br, simd::mulAdd(BL, bl, simd::mulAdd(TR, tr, simd::mul(TL, tl))));
+    }
+
+    // Decode the 4 texels at the corners of the texel quad of each lane (as texelQuad does) a corner at a time,
+    // gathering the words holding their endpoints and indices straight from their blocks, then weigh them:
+    INLINE void sampleBlocks(i32_lanes x, i32_lanes y, f32_lanes tl, f32_lanes tr, f32_lanes bl, f32_lanes br,
+                             f32_lanes &R, f32_lanes &G, f32_lanes &B) const {
+        const f32_lanes zero = simd::set(0.0f);
+        const f32_lanes one = simd::set(1.0f);
+        const f32_lanes X = simd::toFloat(x);
+        const f32_lanes Y = simd::toFloat(y);
+        const i32_lanes left   = simd::toInt(simd::select(simd::equal(X, zero), simd::set(wrap ? (f32)(width  - 1) : 0.0f), simd::sub(X, one)));
+        const i32_lanes top    = simd::toInt(simd::select(simd::equal(Y, zero), simd::set(wrap ? (f32)(height - 1) : 0.0f), simd::sub(Y, one)));
+        const i32_lanes right  = simd::toInt(simd::select(simd::lessThan(X, simd::set((f32)width)),  X, simd::set(wrap ? 0.0f : (f32)(width  - 1))));
+        const i32_lanes bottom = simd::toInt(simd::select(simd::lessThan(Y, simd::set((f32)height)), Y, simd::set(wrap ? 0.0f : (f32)(height - 1))));
+
+        f32_lanes TL[3], TR[3], BL[3], BR[3];
+        decodeTexels(left,  top,    TL);
+        decodeTexels(right, top,    TR);
+        decodeTexels(left,  bottom, BL);
+        decodeTexels(right, bottom, BR);
+        R = simd::mulAdd(BR[0], br, simd::mulAdd(BL[0], bl, simd::mulAdd(TR[0], tr, simd::mul(TL[0], tl))));
+        G = simd::mulAdd(BR[1], br, simd::mulAdd(BL[1], bl, simd::mulAdd(TR[1], tr, simd::mul(TL[1], tl))));
+        B = simd::mulAdd(BR[2], br, simd::mulAdd(BL[2], bl, simd::mulAdd(TR[2], tr, simd::mul(TL[2], tl))));
+    }
+
+    // Decode the texel at (x, y) of each lane into its red, green and blue components (as decodeTexel does):
+    INLINE void decodeTexels(i32_lanes x, i32_lanes y, f32_lanes *components) const {
+        const i32_lanes block_mask = simd::setInt(TEXTURE_BLOCK_MASK);
+        const i32_lanes block = simd::toInt(simd::mulAdd( // In floats, as SSE2 has no 32-bit integer multiplication
+                simd::toFloat(simd::shiftRight(y, TEXTURE_BLOCK_SHIFT)), simd::set((f32)((width + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT)),
+                simd::toFloat(simd::shiftRight(x, TEXTURE_BLOCK_SHIFT))));
+        const i32_lanes texel_index = simd::add(simd::shiftLeft(simd::and_(y, block_mask), TEXTURE_BLOCK_SHIFT), simd::and_(x, block_mask));
+        if (compression == TextureCompression_BC1) {
+            const i32_lanes offsets = simd::shiftLeft(block, 3); // sizeof(BC1Block) == 8
+            i32_lanes colors, indices;
+            simd::gatherPairs(blocks, offsets, colors, indices);
+            const f32_lanes index = simd::toFloat(simd::and_(simd::shiftRight(indices, simd::shiftLeft(texel_index, 1)), simd::setInt(3)));
+            const f32_lanes four_colors = simd::lessThan(
+                    simd::toFloat(simd::shiftRight(colors, 16)),
+                    simd::toFloat(simd::and_(colors, simd::setInt(0xFFFF))));
+            const f32_lanes steps = simd::select(four_colors, simd::set(3.0f), simd::set(2.0f));
+            const f32_lanes one_over_steps = simd::select(four_colors, simd::set(1.0f / 3.0f), simd::set(0.5f));
+            const f32_lanes black = simd::andNot(simd::equal(index, simd::set(3.0f)), four_colors);
+            f32_lanes weight0, weight1;
+            PaletteWeights(index, steps, weight0, weight1);
+
+            const i32_lanes mask5 = simd::setInt(31);
+            const i32_lanes mask6 = simd::setInt(63);
+            const i32_lanes R0 = simd::and_(simd::shiftRight(colors, 11), mask5), R1 = simd::shiftRight(colors, 27);
+            const i32_lanes G0 = simd::and_(simd::shiftRight(colors, 5),  mask6), G1 = simd::and_(simd::shiftRight(colors, 21), mask6);
+            const i32_lanes B0 = simd::and_(colors, mask5),                       B1 = simd::and_(simd::shiftRight(colors, 16), mask5);
+            components[0] = simd::andNot(Interpolate(Expand5Bits(R0), Expand5Bits(R1), weight0, weight1, one_over_steps), black);
+            components[1] = simd::andNot(Interpolate(Expand6Bits(G0), Expand6Bits(G1), weight0, weight1, one_over_steps), black);
+            components[2] = simd::andNot(Interpolate(Expand5Bits(B0), Expand5Bits(B1), weight0, weight1, one_over_steps), black);
+            return;
+        }
+
+        const i32_lanes offsets = simd::shiftLeft(block, 4); // sizeof(BC5Block) == 16
+        components[0] = decodeBC4Texels(offsets, texel_index);
+        components[1] = decodeBC4Texels(simd::add(offsets, simd::setInt((i32)sizeof(BC4Block))), texel_index);
+
+        // Reconstruct the normal's z component (as TextureBlockDecoder::DecodeNormalZ does):
+        const f32_lanes zero = simd::set(0.0f);
+        const f32_lanes scale = simd::set(2.0f / 255.0f);
+        const f32_lanes minus_one = simd::set(-1.0f);
+        const f32_lanes normal_x = simd::mulAdd(components[0], scale, minus_one);
+        const f32_lanes normal_y = simd::mulAdd(components[1], scale, minus_one);
+        f32_lanes z_squared = simd::mulAdd(simd::sub(zero, normal_y), normal_y, simd::mulAdd(simd::sub(zero, normal_x), normal_x, simd::set(1.0f)));
+        z_squared = simd::and_(simd::lessThan(zero, z_squared), z_squared);
+        components[2] = simd::toFloat(simd::toInt(simd::mulAdd(simd::squareRoot(z_squared), simd::set(127.5f), simd::set(128.0f))));
+    }
+
+    // The 48 bits of indices of a BC4 block are gathered as the 32-bit word holding those of the texel's half of the block:
+    INLINE f32_lanes decodeBC4Texels(i32_lanes offsets, i32_lanes texel_index) const {
+        const i32_lanes half = simd::shiftRight(texel_index, 3);
+        const i32_lanes index_in_half = simd::and_(texel_index, simd::setInt(7));
+        const i32_lanes values = simd::gather(blocks, offsets);
+        const i32_lanes indices = simd::gather(blocks + 2, simd::add(offsets, simd::shiftLeft(half, 1)));
+        const i32_lanes bits = simd::add(simd::add(index_in_half, simd::shiftLeft(index_in_half, 1)), simd::shiftLeft(half, 3)); // Past the 2 bytes skipped for the second half
+        const f32_lanes index = simd::toFloat(simd::and_(simd::shiftRight(indices, bits), simd::setInt(7)));
+
+        const i32_lanes byte = simd::setInt(0xFF);
+        const f32_lanes value0 = simd::toFloat(simd::and_(values, byte));
+        const f32_lanes value1 = simd::toFloat(simd::and_(simd::shiftRight(values, 8), byte));
+        const f32_lanes eight_values = simd::lessThan(value1, value0);
+        const f32_lanes zero_value = simd::andNot(simd::equal(index, simd::set(6.0f)), eight_values);
+        const f32_lanes full_value = simd::andNot(simd::equal(index, simd::set(7.0f)), eight_values);
+        f32_lanes weight0, weight1;
+        PaletteWeights(index, simd::select(eight_values, simd::set(7.0f), simd::set(5.0f)), weight0, weight1);
+        const f32_lanes value = Interpolate(value0, value1, weight0, weight1, simd::select(eight_values, simd::set(1.0f / 7.0f), simd::set(1.0f / 5.0f)));
+        return simd::select(full_value, simd::set(255.0f), simd::andNot(value, zero_value));
+    }
+
+    // The weights of the endpoints for the palette entry at each index (see TextureBlockDecoder::GetWeight1):
+    static INLINE void PaletteWeights(f32_lanes index, f32_lanes steps, f32_lanes &weight0, f32_lanes &weight1) {
+        const f32_lanes one = simd::set(1.0f);
+        weight1 = simd::select(simd::equal(index, one), steps, simd::and_(simd::lessThan(one, index), simd::sub(index, one)));
+        weight0 = simd::sub(steps, weight1);
+    }
+
+    // The weighted sum of the endpoints over the number of steps, rounded down as integer division does: The reciprocals
+    // of the numbers of steps round up to floats, by too little to carry any sum (at most 7 * 255) to the next integer:
+    static INLINE f32_lanes Interpolate(f32_lanes value0, f32_lanes value1, f32_lanes weight0, f32_lanes weight1, f32_lanes one_over_steps) {
+        return simd::toFloat(simd::toInt(simd::mul(simd::mulAdd(weight0, value0, simd::mul(weight1, value1)), one_over_steps)));
+    }
+
+    static INLINE f32_lanes Expand5Bits(i32_lanes value) { return simd::toFloat(simd::add(simd::shiftLeft(value, 3), simd::shiftRight(value, 2))); }
+    static INLINE f32_lanes Expand6Bits(i32_lanes value) { return simd::toFloat(simd::add(simd::shiftLeft(value, 2), simd::shiftRight(value, 4))); }
+#endif
 };
 
+#define TEXTURE_NO_MIP_REQUESTED 0xFF
+
 struct Texture : ImageInfo {
     TextureMip *mips = nullptr;
 
+    // Blend between the 2 mip levels nearest to the fractional level of detail (instead of sampling the nearest one).
+    // This is a runtime setting rather than part of the texture's file, so it needs to be set once it's loaded:
+    bool trilinear{false};
+
+    // Sample up to this many probes along the major axis of a pixel's footprint when it's elongated (e.g. at grazing
+    // angles), each from the mip level of the footprint's area split between them (1 for isotropic sampling).
+    // As with trilinear, this is a runtime setting:
+    u8 max_anisotropy{1};
+
+    // When mip levels are streamed in (see TextureResidency), only the levels from this one on are resident
+    // and finer levels are sampled from it instead. The finest level requested since the last residency update
+    // is recorded by the rasterizer (see requestMipLevels):
+    u8 first_resident_mip{0};
+    u8 finest_requested_mip{TEXTURE_NO_MIP_REQUESTED};
+
+    INLINE_XPU static u32 FloatBits(f32 value) {
+        union { f32 value; u32 bits; } float_bits{value};
+        return float_bits.bits;
+    }
+
+    // Each mip level quarters the texel area, so the level is the ceiling of half of the ceiling of its log2
+    // (read off the float's exponent and mantissa bits, rounding up when there are any mantissa bits):
     XPU static u32 GetMipLevel(f32 texel_area, u32 mip_count) {
-        u32 mip_level = 0;
-        while (texel_area > 1 && ++mip_level < mip_count) texel_area *= 0.25f;
-        if (mip_level >= mip_count)
-            mip_level = mip_count - 1;
+        if (!(texel_area > 1)) return 0;
 
-        return mip_level;
+        const u32 bits = FloatBits(texel_area);
+        const i32 ceil_log2 = (i32)(bits >> 23) - 127 + ((bits & 0x7FFFFF) != 0);
+        const u32 mip_level = (u32)(ceil_log2 + 1) >> 1;
+        return mip_level < mip_count ? mip_level : mip_count - 1;
     }
 
     XPU static u32 GetMipLevel(u32 width, u32 height, u32 mip_count, f32 uv_area) {
@@ -61,11 +451,275 @@ struct Texture : ImageInfo {
         return GetMipLevel(uv_area * (f32)(texture.width * texture.height), texture.mip_count);
     }
 
+    // The fractional level of detail of a texel area: Half of its log2, approximated as the float's exponent plus
+    // a quadratic fit of log2(1 + m) over its mantissa m (exact at powers of 2, within 0.008 in between):
+    INLINE_XPU static f32 GetLevelOfDetail(f32 texel_area) {
+        if (!(texel_area > 0)) return -64.0f;
+
+        const u32 bits = FloatBits(texel_area);
+        const f32 m = (f32)(bits & 0x7FFFFF) * (1.0f / (f32)(1 << 23));
+        return 0.5f * ((f32)((i32)(bits >> 23) - 127) + fast_mul_add(0.3466f * m, 1.0f - m, m));
+    }
+
     INLINE_XPU u32 mipLevel(f32 uv_area) const {
-        return GetMipLevel(uv_area * (f32)(width * height), mip_count);
+        const u32 mip_level = GetMipLevel(uv_area * (f32)(width * height), mip_count);
+        return mip_level < first_resident_mip ? first_resident_mip : mip_level;
+    }
+
+    INLINE_XPU f32 levelOfDetail(f32 uv_area) const {
+        return GetLevelOfDetail(uv_area * (f32)(width * height));
+    }
+
+    // The mip level to sample for any uv area within the given range (e.g. for a whole triangle), or -1 if there is
+    // none: When sampling trilinearly, that is only when the whole range is clamped to the first or the last level.
+    INLINE_XPU i32 mipLevelWithin(f32 min_uv_area, f32 max_uv_area) const {
+        if (!flags.mipmap) return 0;
+        if (isAnisotropic()) return -1;
+
+        if (trilinear) {
+            if (levelOfDetail(max_uv_area) <= (f32)first_resident_mip) return first_resident_mip;
+            if (levelOfDetail(min_uv_area) >= (f32)(mip_count - 1)) return (i32)mip_count - 1;
+            return -1;
+        }
+
+        const u32 mip_level = mipLevel(min_uv_area);
+        return mip_level == mipLevel(max_uv_area) ? (i32)mip_level : -1;
     }
 
     INLINE_XPU Pixel sample(f32 u, f32 v, f32 uv_area) const {
-        return mips[flags.mipmap ? GetMipLevel(uv_area * (f32)(width * height), mip_count) : 0].sample(u, v);
+        if (!flags.mipmap) return mips[0].sample(u, v);
+        if (!trilinear) return mips[mipLevel(uv_area)].sample(u, v);
+
+        const u32 last_mip_level = mip_count - 1;
+        const f32 level_of_detail = levelOfDetail(uv_area);
+        if (level_of_detail <= (f32)first_resident_mip) return mips[first_resident_mip].sample(u, v);
+        if (level_of_detail >= (f32)last_mip_level) return mips[last_mip_level].sample(u, v);
+
+        const u32 mip_level = (u32)level_of_detail;
+        const f32 t = level_of_detail - (f32)mip_level;
+        const Pixel mip_sample = mips[mip_level].sample(u, v);
+        const Pixel next_mip_sample = mips[mip_level + 1].sample(u, v);
+        return {
+                fast_mul_add(next_mip_sample.color.r - mip_sample.color.r, t, mip_sample.color.r),
+                fast_mul_add(next_mip_sample.color.g - mip_sample.color.g, t, mip_sample.color.g),
+                fast_mul_add(next_mip_sample.color.b - mip_sample.color.b, t, mip_sample.color.b),
+                1.0f
+        };
+    }
+
+    // Record the finest mip level that sampling could pick for the given (smallest) uv area:
+    // That of a probe's share of it when sampling anisotropically, or the level below when blending trilinearly.
+    INLINE_XPU void requestMipLevels(f32 min_uv_area) {
+        if (!flags.mipmap) return;
+
+        u32 mip_level = GetMipLevel(min_uv_area * (f32)(width * height) / (f32)max_anisotropy, mip_count);
+        if (trilinear && mip_level) mip_level--;
+        if (mip_level < finest_requested_mip) finest_requested_mip = (u8)mip_level;
+    }
+
+    INLINE_XPU bool isAnisotropic() const {
+        return max_anisotropy > 1 && flags.mipmap;
+    }
+
+    // The number of probes for a pixel footprint spanned by the given uv derivatives (having the given uv area):
+    // The ratio of its major axis to its minor one, being that of its major axis squared to its area (in texels).
+    INLINE_XPU u32 probeCount(f32 uv_area, const vec2 &dUVdx, const vec2 &dUVdy, bool &major_is_x) const {
+        const f32 w = (f32)width;
+        const f32 h = (f32)height;
+        const f32 x_squared = dUVdx.u*dUVdx.u*w*w + dUVdx.v*dUVdx.v*h*h;
+        const f32 y_squared = dUVdy.u*dUVdy.u*w*w + dUVdy.v*dUVdy.v*h*h;
+        major_is_x = x_squared > y_squared;
+        const f32 ratio = (major_is_x ? x_squared : y_squared) / (uv_area * w * h);
+        if (!(ratio > 1)) return 1;
+        if (!(ratio < (f32)max_anisotropy)) return max_anisotropy;
+        return (u32)ceilf(ratio);
+    }
+
+    // Sample anisotropically: Average probes spread evenly along the major axis of the pixel's footprint
+    // (each probe covering its share of the footprint), or sample isotropically when it's not elongated:
+    INLINE_XPU Pixel sample(f32 u, f32 v, f32 uv_area, const vec2 &dUVdx, const vec2 &dUVdy) const {
+        if (!isAnisotropic()) return sample(u, v, uv_area);
+
+        bool major_is_x;
+        const u32 probe_count = probeCount(uv_area, dUVdx, dUVdy, major_is_x);
+        if (probe_count == 1) return sample(u, v, uv_area);
+
+        const vec2 &major_axis = major_is_x ? dUVdx : dUVdy;
+        const f32 probe_uv_area = uv_area / (f32)probe_count;
+        const f32 step = 1.0f / (f32)probe_count;
+        f32 offset = 0.5f * step - 0.5f;
+        Pixel sum{0.0f, 0.0f, 0.0f, 1.0f};
+        for (u32 probe = 0; probe < probe_count; probe++, offset += step) {
+            f32 probe_u = fast_mul_add(major_axis.u, offset, u);
+            f32 probe_v = fast_mul_add(major_axis.v, offset, v);
+            if (probe_u < 0) probe_u = flags.wrap ? probe_u - floorf(probe_u) : 0;
+            if (probe_v < 0) probe_v = flags.wrap ? probe_v - floorf(probe_v) : 0;
+            const Pixel probe_sample = sample(probe_u, probe_v, probe_uv_area);
+            sum.color.r += probe_sample.color.r;
+            sum.color.g += probe_sample.color.g;
+            sum.color.b += probe_sample.color.b;
+        }
+        sum.color.r *= step;
+        sum.color.g *= step;
+        sum.color.b *= step;
+        return sum;
+    }
+
+#if SIMD_WIDTH > 1
+    // Sample SIMD_WIDTH (u, v, uv_area) tuples at once, producing exactly what sample() would for each.
+    // Lanes are usually all within the same mip level, otherwise each of their levels is sampled in turn
+    // (along with the next one, for lanes blending into it when sampling trilinearly):
+    INLINE void sample(f32_lanes u, f32_lanes v, f32_lanes uv_area, f32_lanes &R, f32_lanes &G, f32_lanes &B) const {
+        if (!flags.mipmap) {
+            mips[0].sample(u, v, R, G, B);
+            return;
+        }
+
+        const u32 last_mip_level = mip_count - 1;
+        f32 uv_areas[SIMD_WIDTH], mip_levels[SIMD_WIDTH], blend_factors[SIMD_WIDTH];
+        simd::store(uv_areas, uv_area);
+        bool same_mip_level = true, blended = false;
+        for (u32 i = 0; i < SIMD_WIDTH; i++) {
+            blend_factors[i] = 0;
+            if (trilinear) {
+                const f32 level_of_detail = levelOfDetail(uv_areas[i]);
+                if (level_of_detail <= (f32)first_resident_mip)
+                    mip_levels[i] = (f32)first_resident_mip;
+                else if (level_of_detail >= (f32)last_mip_level)
+                    mip_levels[i] = (f32)last_mip_level;
+                else {
+                    mip_levels[i] = (f32)(u32)level_of_detail;
+                    blend_factors[i] = level_of_detail - mip_levels[i];
+                    blended = true;
+                }
+            } else
+                mip_levels[i] = (f32)mipLevel(uv_areas[i]);
+            if (mip_levels[i] != mip_levels[0]) same_mip_level = false;
+        }
+        if (same_mip_level && !blended) {
+            mips[(u32)mip_levels[0]].sample(u, v, R, G, B);
+            return;
+        }
+
+        const f32_lanes lanes_mip_levels = simd::load(mip_levels);
+        const f32_lanes t = simd::load(blend_factors);
+        f32_lanes mip_R, mip_G, mip_B, next_R, next_G, next_B, in_mip;
+        R = G = B = simd::set(0.0f);
+        u32 pending = SIMD_ALL_LANES;
+        while (pending) {
+            f32 mip_level = mip_levels[lowestBitIndex(pending)];
+            mips[(u32)mip_level].sample(u, v, mip_R, mip_G, mip_B);
+            if (blended && (u32)mip_level < last_mip_level) {
+                // Lanes that are not blended have a blend factor of 0, leaving their samples as they are:
+                mips[(u32)mip_level + 1].sample(u, v, next_R, next_G, next_B);
+                mip_R = simd::mulAdd(simd::sub(next_R, mip_R), t, mip_R);
+                mip_G = simd::mulAdd(simd::sub(next_G, mip_G), t, mip_G);
+                mip_B = simd::mulAdd(simd::sub(next_B, mip_B), t, mip_B);
+            }
+            in_mip = simd::equal(lanes_mip_levels, simd::set(mip_level));
+            R = simd::select(in_mip, mip_R, R);
+            G = simd::select(in_mip, mip_G, G);
+            B = simd::select(in_mip, mip_B, B);
+            pending &= ~simd::bits(in_mip);
+        }
     }
-};
\ No newline at end of file
+#endif
+};
+
+// Textures can be packed into the pages of a texture atlas (see bmp2texture's atlas mode), each into its own
+// rectangle surrounded by padding: Its own texels, wrapped around or clamped, enough of them for the bilinear filtering
+// of any mip level of the page to never reach into a neighbouring rectangle. Rectangles are in texels of the first
+// mip level of their page, aligned to (and spanning multiples of) at least the texel size of the page's last mip level.
+#define TEXTURE_ATLAS_MAX_PAGE_COUNT 8
+
+struct TextureAtlasRect {
+    u32 page, x, y, width, height;
+    bool wrap;
+};
+
+// A texture packed into a page of a texture atlas, sampled straight from the page: Its uv coordinates are wrapped
+// around (or clamped) within the texture and then mapped into its rectangle, with uv areas and derivatives scaled
+// along with them. Note: Anisotropic probes can spread beyond the padding of a rectangle (and into a neighbour).
+struct AtlasTexture {
+    Texture *page{nullptr};
+    vec2 uv_scale{1.0f}, uv_offset{0.0f};
+    f32 uv_area_scale{1.0f};
+    bool wrap{false};
+
+    INLINE_XPU f32 pageU(f32 u) const {
+        u = wrap ? u - floorf(u) : clampedValue(u);
+        return fast_mul_add(u, uv_scale.u, uv_offset.u);
+    }
+
+    INLINE_XPU f32 pageV(f32 v) const {
+        v = wrap ? v - floorf(v) : clampedValue(v);
+        return fast_mul_add(v, uv_scale.v, uv_offset.v);
+    }
+
+    INLINE_XPU Pixel sample(u32 mip_level, f32 u, f32 v) const {
+        return page->mips[mip_level].sample(pageU(u), pageV(v));
+    }
+
+    INLINE_XPU Pixel sample(f32 u, f32 v, f32 uv_area, const vec2 &dUVdx, const vec2 &dUVdy) const {
+        return page->sample(pageU(u), pageV(v), uv_area * uv_area_scale, dUVdx * uv_scale, dUVdy * uv_scale);
+    }
+
+    INLINE_XPU i32 mipLevelWithin(f32 min_uv_area, f32 max_uv_area) const {
+        return page->mipLevelWithin(min_uv_area * uv_area_scale, max_uv_area * uv_area_scale);
+    }
+
+    INLINE_XPU void requestMipLevels(f32 min_uv_area) const {
+        page->requestMipLevels(min_uv_area * uv_area_scale);
+    }
+
+#if SIMD_WIDTH > 1
+    INLINE void pageUVs(f32_lanes &u, f32_lanes &v) const {
+        if (wrap) {
+            // Floors are truncations, less one for negative coordinates that were truncated up:
+            const f32_lanes one = simd::set(1.0f);
+            f32_lanes truncated_u = simd::toFloat(simd::toInt(u));
+            f32_lanes truncated_v = simd::toFloat(simd::toInt(v));
+            u = simd::sub(u, simd::sub(truncated_u, simd::and_(simd::lessThan(u, truncated_u), one)));
+            v = simd::sub(v, simd::sub(truncated_v, simd::and_(simd::lessThan(v, truncated_v), one)));
+        } else {
+            const f32_lanes zero = simd::set(0.0f);
+            const f32_lanes one  = simd::set(1.0f);
+            u = simd::select(simd::lessThan(u, zero), zero, simd::select(simd::lessThan(one, u), one, u));
+            v = simd::select(simd::lessThan(v, zero), zero, simd::select(simd::lessThan(one, v), one, v));
+        }
+        u = simd::mulAdd(u, simd::set(uv_scale.u), simd::set(uv_offset.u));
+        v = simd::mulAdd(v, simd::set(uv_scale.v), simd::set(uv_offset.v));
+    }
+
+    INLINE void sample(u32 mip_level, f32_lanes u, f32_lanes v, f32_lanes &R, f32_lanes &G, f32_lanes &B) const {
+        pageUVs(u, v);
+        page->mips[mip_level].sample(u, v, R, G, B);
+    }
+
+    INLINE void sample(f32_lanes u, f32_lanes v, f32_lanes uv_area, f32_lanes &R, f32_lanes &G, f32_lanes &B) const {
+        pageUVs(u, v);
+        page->sample(u, v, simd::mul(uv_area, simd::set(uv_area_scale)), R, G, B);
+    }
+#endif
+};
+
+struct TextureAtlas {
+    Texture pages[TEXTURE_ATLAS_MAX_PAGE_COUNT];
+    TextureAtlasRect *rects{nullptr};
+    u32 page_count{0};
+    u32 rect_count{0};
+
+    // The texture packed into the given rectangle, resolved to its page (e.g. for a material's texture slot):
+    AtlasTexture texture(u32 rect_index) {
+        const TextureAtlasRect &rect = rects[rect_index];
+        AtlasTexture atlas_texture;
+        atlas_texture.page = pages + rect.page;
+        atlas_texture.uv_scale.u  = (f32)rect.width  / (f32)atlas_texture.page->width;
+        atlas_texture.uv_scale.v  = (f32)rect.height / (f32)atlas_texture.page->height;
+        atlas_texture.uv_offset.u = (f32)rect.x      / (f32)atlas_texture.page->width;
+        atlas_texture.uv_offset.v = (f32)rect.y      / (f32)atlas_texture.page->height;
+        atlas_texture.uv_area_scale = atlas_texture.uv_scale.u * atlas_texture.uv_scale.v;
+        atlas_texture.wrap = rect.wrap;
+        return atlas_texture;
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../core/base.h"
+#include "../math/simd.h"
 
 enum AntiAliasing {
     NoAA,
@@ -8,10 +9,17 @@ enum AntiAliasing {
     SSAA
 };
 
+// Depths are also tracked coarsely (a hierarchical depth buffer): For every 8x8 block of depths there is a
+// depth tile, holding a bound that no depth within the block is further than. Depths only ever get lowered
+// (until cleared), so a bound remains valid as depths are written, and can be tightened lazily:
+// Writers mark the tiles of the depths they lowered as dirty, and readers refresh dirty tiles on demand.
+// Blocks are of 8x8 depths in the layout of SSAA (2x2 quads of sub-pixels), so with any antialiasing
+// a block spans 4x4 pixels. Canvases that wrap given buffers have no depth tiles.
 struct Canvas {
     Dimensions dimensions;
     Pixel *pixels{nullptr};
     f32 *depths{nullptr};
+    DepthTile *depth_tiles{nullptr};
 
     AntiAliasing antialias;
 
@@ -25,6 +33,10 @@ struct Canvas {
             memory::canvas_memory += CANVAS_DEPTHS_SIZE;
             memory::canvas_memory_capacity -= CANVAS_DEPTHS_SIZE;
 
+            depth_tiles = (DepthTile*)memory::canvas_memory;
+            memory::canvas_memory += CANVAS_DEPTH_TILES_SIZE;
+            memory::canvas_memory_capacity -= CANVAS_DEPTH_TILES_SIZE;
+
             dimensions.update(MAX_WIDTH, MAX_HEIGHT);
             clear();
             dimensions.update(width, height);
@@ -58,6 +70,55 @@ struct Canvas {
 
         if (pixels) for (i32 i = 0; i < pixels_count; i++) pixels[i] = pixel;
         if (depths) for (i32 i = 0; i < depths_count; i++) depths[i] = depth;
+        if (depth_tiles) {
+            DepthTile depth_tile{depth, false};
+            u32 depth_tiles_count = depthTileColumns() * (((u32)depths_height + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT);
+            for (u32 i = 0; i < depth_tiles_count; i++) depth_tiles[i] = depth_tile;
+        }
+    }
+
+    INLINE u32 depthTileColumns() const {
+        return (((u32)dimensions.width << (antialias != NoAA)) + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+    }
+
+    // The depth tile of a depth at the given coordinates (in sub-pixels when antialiased):
+    INLINE DepthTile& depthTileAt(u32 x, u32 y) const {
+        return depth_tiles[(y >> DEPTH_TILE_SHIFT) * depthTileColumns() + (x >> DEPTH_TILE_SHIFT)];
+    }
+
+    // The bound of a depth tile (given by the coordinates of any depth within it), refreshed first if it's dirty.
+    // Tiles at the right and bottom edges of the canvas only cover the depths that lie within it:
+    f32 depthTileBound(u32 x, u32 y) const {
+        DepthTile &depth_tile = depthTileAt(x, y);
+        if (!depth_tile.dirty)
+            return depth_tile.max_depth;
+
+        x &= ~(u32)(DEPTH_TILE_SIZE - 1);
+        y &= ~(u32)(DEPTH_TILE_SIZE - 1);
+        const u32 width  = (u32)dimensions.width  << (antialias != NoAA);
+        const u32 height = (u32)dimensions.height << (antialias != NoAA);
+        u32 stride = dimensions.stride;
+        u32 row_length = width  - x < DEPTH_TILE_SIZE ? width  - x : DEPTH_TILE_SIZE;
+        u32 row_count  = height - y < DEPTH_TILE_SIZE ? height - y : DEPTH_TILE_SIZE;
+        f32 *depth = depths + stride * y + x;
+        if (antialias != NoAA) {
+            // Rows of 2x2 quads: Each row of quads covers 2 rows of sub-pixels, stored consecutively
+            // (the antialiased width and height being even, tiles cover whole quads)
+            row_length *= 2;
+            row_count /= 2;
+            stride *= 4;
+            depth = depths + (dimensions.stride * (y >> 1) + (x >> 1)) * 4;
+        }
+
+        f32 max_depth = 0;
+        for (u32 row = 0; row < row_count; row++, depth += stride)
+            for (u32 i = 0; i < row_length; i++)
+                if (depth[i] > max_depth)
+                    max_depth = depth[i];
+
+        depth_tile.max_depth = max_depth;
+        depth_tile.dirty = false;
+        return max_depth;
     }
 
     void drawFrom(Canvas& source_canvas, const RectI* source_bounds = nullptr, const RectI* target_bounds = nullptr, f32 opacity = 1.0f, bool blend = true, bool include_depths = false) {
@@ -151,8 +212,7 @@ struct Canvas {
             return;
 
         opacity = clampedValue(opacity);
-        Pixel pixel{color.clamped(), opacity};
-        pixel.color *= pixel.color;
+        Pixel pixel{decodeDisplayGamma(color.clamped()), opacity};
         if (opacity != 1.0f)
             pixel.color *= pixel.opacity;
 
@@ -204,8 +264,8 @@ struct Canvas {
     }
 
     INLINE u32 getPixelContent(Pixel *pixel) const {
-        return antialias == SSAA ? _isTransparentPixelQuad(pixel) ? 0 : _blendPixelQuad(pixel).asContent() :
-               pixel->opacity == 0.0f ? 0 : pixel->asContent();
+        return antialias == SSAA ? _isTransparentPixelQuad(pixel) ? 0 : _encodePixel(_blendPixelQuad(pixel)) :
+               pixel->opacity == 0.0f ? 0 : _encodePixel(*pixel);
     }
 
     INLINE void drawText(char *str, i32 x, i32 y, const Color &color = White, f32 opacity = 1.0f, const RectI *viewport_bounds = nullptr) const;
@@ -283,6 +343,15 @@ private:
         return (pixel_quad[0] + pixel_quad[1] + pixel_quad[2] + pixel_quad[3]) * 0.25f;
     }
 
+    // Encoding with the exact gamma is done in lanes (see encodeDisplayGamma):
+    static INLINE u32 _encodePixel(const Pixel &pixel) {
+#if SIMD_WIDTH > 1 && !defined(SLIM_APPROXIMATE_GAMMA)
+        return simd::encodePixelContent(pixel.color.components);
+#else
+        return pixel.asContent();
+#endif
+    }
+
     static INLINE void _sortPixelsByDepth(f32 depth, Pixel *pixel, f32 *out_depth, Pixel *out_pixel, Pixel **background, Pixel **foreground) {
         if (depth == 0.0f || depth < *out_depth) {
             *out_depth = depth;
@@ -10,18 +10,17 @@ void drawTextureMip(const TextureMip &texture_mip, const Canvas &canvas, const R
     if (cropped) {
         if (draw_width > (i32)texture_mip.width) draw_width = (i32)texture_mip.width;
         if (draw_height > (i32)texture_mip.height) draw_height = (i32)texture_mip.height;
-        i32 remainder_x = 1 + (i32)texture_mip.width - draw_width;
-        TexelQuad *texel_quad = texture_mip.texel_quads;
+        TexelQuad texel_quad;
         i32 Y = draw_bounds.top;
         for (i32 y = 0; y < draw_height; y++, Y++) {
             i32 X = draw_bounds.left;
-            for (i32 x = 0; x < draw_width; x++, X++, texel_quad++) {
-                texel_color.r = (f32)texel_quad->R.BR * COLOR_COMPONENT_TO_FLOAT;
-                texel_color.g = (f32)texel_quad->G.BR * COLOR_COMPONENT_TO_FLOAT;
-                texel_color.b = (f32)texel_quad->B.BR * COLOR_COMPONENT_TO_FLOAT;
+            for (i32 x = 0; x < draw_width; x++, X++) {
+                texel_quad = texture_mip.texelQuad((u32)x, (u32)y);
+                texel_color.r = (f32)texel_quad.R.BR * COLOR_COMPONENT_TO_FLOAT;
+                texel_color.g = (f32)texel_quad.G.BR * COLOR_COMPONENT_TO_FLOAT;
+                texel_color.b = (f32)texel_quad.B.BR * COLOR_COMPONENT_TO_FLOAT;
                 canvas.setPixel(X, Y, texel_color, opacity);
             }
-            texel_quad += remainder_x;
         }
     } else {
         f32 u_step = 1.0f / (f32)draw_width;
@@ -53,5 +52,6 @@ void drawTexture(const Texture &texture, const Canvas &canvas, const RectI draw_
         f32 texel_area = (f32)(texture.width * texture.height) / (f32)(draw_width * draw_height);
         mip_level = Texture::GetMipLevel(texel_area, texture.mip_count);
     }
+    if (mip_level < texture.first_resident_mip) mip_level = texture.first_resident_mip;
     drawTextureMip(texture.mips[mip_level], canvas, draw_bounds, cropped, opacity);
 }
\ No newline at end of file
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "../core/base.h"
+
+// A thin layer over SSE/AVX for processing SIMD_WIDTH floats at a time.
+// The widest instruction set enabled at compile time is used (e.g: -mavx2 or /arch:AVX2 for 8 lanes).
+// Define SLIM_DISABLE_SIMD to fall back to scalar code paths (SIMD_WIDTH of 1).
+
+#if defined(SLIM_DISABLE_SIMD) || defined(__CUDACC__)
+    #define SIMD_WIDTH 1
+#elif defined(__AVX2__)
+    #include <immintrin.h>
+    #define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #include <string.h>
+    #define SIMD_WIDTH 4
+#else
+    #define SIMD_WIDTH 1
+#endif
+
+// Fused multiply-add is only used when the scalar fast_mul_add is fused as well, so both produce the same results:
+#if defined(FP_FAST_FMAF) && defined(__FMA__) && SIMD_WIDTH > 1
+    #include <immintrin.h>
+    #define SIMD_FUSED_MUL_ADD 1
+#endif
+
+#define SIMD_ALL_LANES ((1u << SIMD_WIDTH) - 1)
+
+#if SIMD_WIDTH == 8
+typedef __m256 f32_lanes;
+typedef __m256i i32_lanes;
+
+namespace simd {
+    INLINE f32_lanes set(f32 value) { return _mm256_set1_ps(value); }
+    INLINE f32_lanes load(const f32 *values) { return _mm256_loadu_ps(values); }
+    INLINE void store(f32 *values, f32_lanes lanes) { _mm256_storeu_ps(values, lanes); }
+    INLINE f32_lanes laneIndices() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    INLINE f32_lanes mask(bool on) { return _mm256_castsi256_ps(_mm256_set1_epi32(on ? -1 : 0)); }
+
+    INLINE f32_lanes add(f32_lanes a, f32_lanes b) { return _mm256_add_ps(a, b); }
+    INLINE f32_lanes sub(f32_lanes a, f32_lanes b) { return _mm256_sub_ps(a, b); }
+    INLINE f32_lanes mul(f32_lanes a, f32_lanes b) { return _mm256_mul_ps(a, b); }
+    INLINE f32_lanes div(f32_lanes a, f32_lanes b) { return _mm256_div_ps(a, b); }
+#ifdef SIMD_FUSED_MUL_ADD
+    INLINE f32_lanes mulAdd(f32_lanes a, f32_lanes b, f32_lanes c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    INLINE f32_lanes mulAdd(f32_lanes a, f32_lanes b, f32_lanes c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+    INLINE f32_lanes squareRoot(f32_lanes a) { return _mm256_sqrt_ps(a); }
+
+    INLINE f32_lanes equal(       f32_lanes a, f32_lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    INLINE f32_lanes lessThan(    f32_lanes a, f32_lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    INLINE f32_lanes greaterEqual(f32_lanes a, f32_lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    INLINE f32_lanes notGreater(  f32_lanes a, f32_lanes b) { return _mm256_cmp_ps(a, b, _CMP_NGT_UQ); }
+
+    INLINE f32_lanes and_(   f32_lanes a, f32_lanes b) { return _mm256_and_ps(a, b); }
+    INLINE f32_lanes or_(    f32_lanes a, f32_lanes b) { return _mm256_or_ps(a, b); }
+    INLINE f32_lanes andNot(f32_lanes a, f32_lanes b) { return _mm256_andnot_ps(b, a); } // a & ~b
+    INLINE u32 bits(f32_lanes mask) { return (u32)_mm256_movemask_ps(mask); }
+    INLINE f32_lanes select(f32_lanes mask, f32_lanes a, f32_lanes b) { return _mm256_blendv_ps(b, a, mask); } // mask ? a : b
+
+    INLINE i32_lanes setInt(i32 value) { return _mm256_set1_epi32(value); }
+    INLINE void storeInt(i32 *values, i32_lanes lanes) { _mm256_storeu_si256((__m256i*)values, lanes); }
+    INLINE i32_lanes toInt(f32_lanes a) { return _mm256_cvttps_epi32(a); } // Truncating
+    INLINE f32_lanes toFloat(i32_lanes a) { return _mm256_cvtepi32_ps(a); }
+    INLINE i32_lanes add(i32_lanes a, i32_lanes b) { return _mm256_add_epi32(a, b); }
+    INLINE i32_lanes mul(i32_lanes a, i32_lanes b) { return _mm256_mullo_epi32(a, b); } // Low 32 bits
+    INLINE i32_lanes and_(i32_lanes a, i32_lanes b) { return _mm256_and_si256(a, b); }
+    INLINE i32_lanes shiftRight(i32_lanes a, i32 bits) { return _mm256_srli_epi32(a, bits); } // Logical
+    INLINE i32_lanes shiftLeft( i32_lanes a, i32 bits) { return _mm256_slli_epi32(a, bits); }
+    INLINE i32_lanes shiftRight(i32_lanes a, i32_lanes bits) { return _mm256_srlv_epi32(a, bits); } // Logical, per lane
+
+    // Load a 32-bit value from each of the given byte offsets:
+    INLINE i32_lanes gather(const u8 *base, i32_lanes offsets) { return _mm256_i32gather_epi32((const int*)base, offsets, 1); }
+
+    // Load 2 consecutive 32-bit values from each of the given byte offsets (the first ones into first, the second ones into second):
+    INLINE void gatherPairs(const u8 *base, i32_lanes offsets, i32_lanes &first, i32_lanes &second) {
+        first  = _mm256_i32gather_epi32((const int*)base, offsets, 1);
+        second = _mm256_i32gather_epi32((const int*)(base + sizeof(i32)), offsets, 1);
+    }
+
+    // The even/odd lanes of a followed by those of b (deinterleaving 2 * SIMD_WIDTH consecutive values):
+    INLINE f32_lanes evenLanes(f32_lanes a, f32_lanes b) {
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    INLINE f32_lanes oddLanes(f32_lanes a, f32_lanes b) {
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    // 1 / (a + b + c), with the sum and division done in double precision (as in the scalar code paths):
+    INLINE f32_lanes reciprocalOfSum(f32_lanes a, f32_lanes b, f32_lanes c) {
+        const __m256d one = _mm256_set1_pd(1.0);
+        __m256d low = _mm256_div_pd(one, _mm256_add_pd(_mm256_add_pd(
+                _mm256_cvtps_pd(_mm256_castps256_ps128(a)),
+                _mm256_cvtps_pd(_mm256_castps256_ps128(b))),
+                _mm256_cvtps_pd(_mm256_castps256_ps128(c))));
+        __m256d high = _mm256_div_pd(one, _mm256_add_pd(_mm256_add_pd(
+                _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)),
+                _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1))),
+                _mm256_cvtps_pd(_mm256_extractf128_ps(c, 1))));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+    }
+}
+#elif SIMD_WIDTH == 4
+typedef __m128 f32_lanes;
+typedef __m128i i32_lanes;
+
+namespace simd {
+    INLINE f32_lanes set(f32 value) { return _mm_set1_ps(value); }
+    INLINE f32_lanes load(const f32 *values) { return _mm_loadu_ps(values); }
+    INLINE void store(f32 *values, f32_lanes lanes) { _mm_storeu_ps(values, lanes); }
+    INLINE f32_lanes laneIndices() { return _mm_setr_ps(0, 1, 2, 3); }
+    INLINE f32_lanes mask(bool on) { return _mm_castsi128_ps(_mm_set1_epi32(on ? -1 : 0)); }
+
+    INLINE f32_lanes add(f32_lanes a, f32_lanes b) { return _mm_add_ps(a, b); }
+    INLINE f32_lanes sub(f32_lanes a, f32_lanes b) { return _mm_sub_ps(a, b); }
+    INLINE f32_lanes mul(f32_lanes a, f32_lanes b) { return _mm_mul_ps(a, b); }
+    INLINE f32_lanes div(f32_lanes a, f32_lanes b) { return _mm_div_ps(a, b); }
+#ifdef SIMD_FUSED_MUL_ADD
+    INLINE f32_lanes mulAdd(f32_lanes a, f32_lanes b, f32_lanes c) { return _mm_fmadd_ps(a, b, c); }
+#else
+    INLINE f32_lanes mulAdd(f32_lanes a, f32_lanes b, f32_lanes c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#endif
+    INLINE f32_lanes squareRoot(f32_lanes a) { return _mm_sqrt_ps(a); }
+
+    INLINE f32_lanes equal(       f32_lanes a, f32_lanes b) { return _mm_cmpeq_ps(a, b); }
+    INLINE f32_lanes lessThan(    f32_lanes a, f32_lanes b) { return _mm_cmplt_ps(a, b); }
+    INLINE f32_lanes greaterEqual(f32_lanes a, f32_lanes b) { return _mm_cmpge_ps(a, b); }
+    INLINE f32_lanes notGreater(  f32_lanes a, f32_lanes b) { return _mm_cmpngt_ps(a, b); }
+
+    INLINE f32_lanes and_(   f32_lanes a, f32_lanes b) { return _mm_and_ps(a, b); }
+    INLINE f32_lanes or_(    f32_lanes a, f32_lanes b) { return _mm_or_ps(a, b); }
+    INLINE f32_lanes andNot(f32_lanes a, f32_lanes b) { return _mm_andnot_ps(b, a); } // a & ~b
+    INLINE u32 bits(f32_lanes mask) { return (u32)_mm_movemask_ps(mask); }
+    INLINE f32_lanes select(f32_lanes mask, f32_lanes a, f32_lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); } // mask ? a : b
+
+    INLINE i32_lanes setInt(i32 value) { return _mm_set1_epi32(value); }
+    INLINE void storeInt(i32 *values, i32_lanes lanes) { _mm_storeu_si128((__m128i*)values, lanes); }
+    INLINE i32_lanes toInt(f32_lanes a) { return _mm_cvttps_epi32(a); } // Truncating
+    INLINE f32_lanes toFloat(i32_lanes a) { return _mm_cvtepi32_ps(a); }
+    INLINE i32_lanes add(i32_lanes a, i32_lanes b) { return _mm_add_epi32(a, b); }
+    INLINE i32_lanes and_(i32_lanes a, i32_lanes b) { return _mm_and_si128(a, b); }
+    INLINE i32_lanes shiftRight(i32_lanes a, i32 bits) { return _mm_srli_epi32(a, bits); } // Logical
+    INLINE i32_lanes shiftLeft( i32_lanes a, i32 bits) { return _mm_slli_epi32(a, bits); }
+
+    // Logical, by the bits of each lane (as SSE2 has no variable shifts, by each power of 2 that they add up to in turn):
+    INLINE i32_lanes shiftRight(i32_lanes a, i32_lanes bits) {
+        __m128i shift_by;
+        shift_by = _mm_srai_epi32(_mm_slli_epi32(bits, 31), 31); a = _mm_or_si128(_mm_and_si128(shift_by, _mm_srli_epi32(a, 1)),  _mm_andnot_si128(shift_by, a));
+        shift_by = _mm_srai_epi32(_mm_slli_epi32(bits, 30), 31); a = _mm_or_si128(_mm_and_si128(shift_by, _mm_srli_epi32(a, 2)),  _mm_andnot_si128(shift_by, a));
+        shift_by = _mm_srai_epi32(_mm_slli_epi32(bits, 29), 31); a = _mm_or_si128(_mm_and_si128(shift_by, _mm_srli_epi32(a, 4)),  _mm_andnot_si128(shift_by, a));
+        shift_by = _mm_srai_epi32(_mm_slli_epi32(bits, 28), 31); a = _mm_or_si128(_mm_and_si128(shift_by, _mm_srli_epi32(a, 8)),  _mm_andnot_si128(shift_by, a));
+        shift_by = _mm_srai_epi32(_mm_slli_epi32(bits, 27), 31); a = _mm_or_si128(_mm_and_si128(shift_by, _mm_srli_epi32(a, 16)), _mm_andnot_si128(shift_by, a));
+        return a;
+    }
+
+    // Low 32 bits (SSE2 only multiplies the even lanes, so the odd ones are multiplied separately):
+    INLINE i32_lanes mul(i32_lanes a, i32_lanes b) {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                  _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    // Load a 32-bit value from each of the given byte offsets (one at a time, as SSE has no gather):
+    INLINE i32_lanes gather(const u8 *base, i32_lanes offsets) {
+        i32 lanes_offsets[4], values[4];
+        _mm_storeu_si128((__m128i*)lanes_offsets, offsets);
+        for (u32 i = 0; i < 4; i++) memcpy(values + i, base + lanes_offsets[i], sizeof(i32));
+        return _mm_setr_epi32(values[0], values[1], values[2], values[3]);
+    }
+
+    // Load 2 consecutive 32-bit values from each of the given byte offsets (the first ones into first, the second ones into second):
+    INLINE void gatherPairs(const u8 *base, i32_lanes offsets, i32_lanes &first, i32_lanes &second) {
+        i32 lanes_offsets[4];
+        _mm_storeu_si128((__m128i*)lanes_offsets, offsets);
+        const __m128 low  = _mm_castsi128_ps(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(base + lanes_offsets[0])), _mm_loadl_epi64((const __m128i*)(base + lanes_offsets[1]))));
+        const __m128 high = _mm_castsi128_ps(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(base + lanes_offsets[2])), _mm_loadl_epi64((const __m128i*)(base + lanes_offsets[3]))));
+        first  = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+        second = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+
+    // The even/odd lanes of a followed by those of b (deinterleaving 2 * SIMD_WIDTH consecutive values):
+    INLINE f32_lanes evenLanes(f32_lanes a, f32_lanes b) { return _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)); }
+    INLINE f32_lanes oddLanes( f32_lanes a, f32_lanes b) { return _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)); }
+
+    // 1 / (a + b + c), with the sum and division done in double precision (as in the scalar code paths):
+    INLINE f32_lanes reciprocalOfSum(f32_lanes a, f32_lanes b, f32_lanes c) {
+        const __m128d one = _mm_set1_pd(1.0);
+        __m128d low = _mm_div_pd(one, _mm_add_pd(_mm_add_pd(
+                _mm_cvtps_pd(a),
+                _mm_cvtps_pd(b)),
+                _mm_cvtps_pd(c)));
+        __m128d high = _mm_div_pd(one, _mm_add_pd(_mm_add_pd(
+                _mm_cvtps_pd(_mm_movehl_ps(a, a)),
+                _mm_cvtps_pd(_mm_movehl_ps(b, b))),
+                _mm_cvtps_pd(_mm_movehl_ps(c, c))));
+        return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+    }
+}
+#endif
+
+#if SIMD_WIDTH > 1
+#ifdef COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit (of a non-zero mask):
+INLINE u32 lowestBitIndex(u32 bits) {
+#ifdef COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (u32)index;
+#else
+    return (u32)__builtin_ctz(bits);
+#endif
+}
+
+namespace simd {
+    // Encode a pixel (its linear color and opacity, as 4 consecutive floats) to window content with a gamma of 2,
+    // exactly as Pixel::asContent does (in double precision) but with all of its components at once:
+    INLINE u32 encodePixelContent(const f32 *pixel) {
+        const __m128 components = _mm_loadu_ps(pixel);
+        const __m128d scale = _mm_set1_pd(FLOAT_TO_COLOR_COMPONENT);
+        __m128i low  = _mm_cvttpd_epi32(_mm_mul_pd(scale, _mm_sqrt_pd(_mm_cvtps_pd(components))));
+        __m128i high = _mm_cvttpd_epi32(_mm_mul_pd(scale, _mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(components, components)))));
+        __m128i values = _mm_unpacklo_epi64(low, high);
+        const __m128i saturated = _mm_castps_si128(_mm_cmpgt_ps(components, _mm_set1_ps(1.0f)));
+        values = _mm_or_si128(_mm_and_si128(saturated, _mm_set1_epi32(MAX_COLOR_VALUE)), _mm_andnot_si128(saturated, values));
+
+        // Reorder to blue, green and red (dropping the opacity) and narrow to bytes:
+        values = _mm_shuffle_epi32(values, _MM_SHUFFLE(3, 0, 1, 2));
+        values = _mm_and_si128(values, _mm_setr_epi32(-1, -1, -1, 0));
+        values = _mm_packs_epi32(values, values);
+        return (u32)_mm_cvtsi128_si32(_mm_packus_epi16(values, values));
+    }
+}
+#endif
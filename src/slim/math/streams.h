@@ -0,0 +1,46 @@
+#pragma once
+
+#include "./mat4.h"
+#include "./simd.h"
+
+// Structure-of-arrays vectors: Each component is in a stream of its own, so that SIMD_WIDTH consecutive vectors
+// can be loaded, transformed and stored at once. Streams are padded to a multiple of SIMD_WIDTH.
+#define SIMD_PADDED_COUNT(count) (((count) + SIMD_WIDTH - 1) & ~(u32)(SIMD_WIDTH - 1))
+
+struct vec3_streams {
+    f32 *x{nullptr};
+    f32 *y{nullptr};
+    f32 *z{nullptr};
+};
+
+struct vec4_streams {
+    f32 *x{nullptr};
+    f32 *y{nullptr};
+    f32 *z{nullptr};
+    f32 *w{nullptr};
+};
+
+#if SIMD_WIDTH > 1
+// A mat4 with each component broadcast to all lanes, for transforming SIMD_WIDTH vectors at a time.
+// Operations are done in the same order as in mat4 * vec4, so results match those of the scalar code paths:
+struct mat4_lanes {
+    f32_lanes Xx, Xy, Xz, Xw;
+    f32_lanes Yx, Yy, Yz, Yw;
+    f32_lanes Zx, Zy, Zz, Zw;
+    f32_lanes Wx, Wy, Wz, Ww;
+
+    explicit mat4_lanes(const mat4 &m) :
+            Xx{simd::set(m.X.x)}, Xy{simd::set(m.X.y)}, Xz{simd::set(m.X.z)}, Xw{simd::set(m.X.w)},
+            Yx{simd::set(m.Y.x)}, Yy{simd::set(m.Y.y)}, Yz{simd::set(m.Y.z)}, Yw{simd::set(m.Y.w)},
+            Zx{simd::set(m.Z.x)}, Zy{simd::set(m.Z.y)}, Zz{simd::set(m.Z.z)}, Zw{simd::set(m.Z.w)},
+            Wx{simd::set(m.W.x)}, Wy{simd::set(m.W.y)}, Wz{simd::set(m.W.z)}, Ww{simd::set(m.W.w)} {}
+
+    INLINE void transform(f32_lanes x, f32_lanes y, f32_lanes z, f32_lanes w,
+                          f32_lanes &out_x, f32_lanes &out_y, f32_lanes &out_z, f32_lanes &out_w) const {
+        out_x = simd::add(simd::add(simd::add(simd::mul(Xx, x), simd::mul(Yx, y)), simd::mul(Zx, z)), simd::mul(Wx, w));
+        out_y = simd::add(simd::add(simd::add(simd::mul(Xy, x), simd::mul(Yy, y)), simd::mul(Zy, z)), simd::mul(Wy, w));
+        out_z = simd::add(simd::add(simd::add(simd::mul(Xz, x), simd::mul(Yz, y)), simd::mul(Zz, z)), simd::mul(Wz, w));
+        out_w = simd::add(simd::add(simd::add(simd::mul(Xw, x), simd::mul(Yw, y)), simd::mul(Zw, z)), simd::mul(Ww, w));
+    }
+};
+#endif
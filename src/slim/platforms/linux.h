@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./linux_base.h"
+#include "../app.h"
+
+// A headless driver: There is no window and no input.
+// The app is resized once, then updated and rendered for a given number of frames,
+// drawing into the window content buffer (which can optionally be saved as a binary '.ppm' image).
+//
+// Usage: <app> [frames:<count>] [width:<pixels>] [height:<pixels>] [output:<file path>]
+
+#define HEADLESS_DEFAULT_FRAME_COUNT 100
+
+SlimApp *CURRENT_APP;
+
+bool writeWindowContent(char *file_path) {
+    void *file = os::openFileForWriting(file_path);
+    if (!file) return false;
+
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", (int)window::width, (int)window::height);
+    bool written = os::writeToFile(header, (unsigned long)header_length, file);
+
+    u8 row[MAX_WIDTH * 3];
+    u32 *content_value = window::content;
+    for (u16 y = 0; written && y < window::height; y++) {
+        u8 *component = row;
+        for (u16 x = 0; x < window::width; x++, content_value++) {
+            *(component++) = (u8)(*content_value >> 16);
+            *(component++) = (u8)(*content_value >> 8);
+            *(component++) = (u8)(*content_value);
+        }
+        written = os::writeToFile(row, (unsigned long)(component - row), file);
+    }
+
+    os::closeFile(file);
+    return written;
+}
+
+bool parseArgument(char *arg, const char *prefix, char **value) {
+    size_t prefix_length = strlen(prefix);
+    if (strncmp(arg, prefix, prefix_length)) return false;
+    *value = arg + prefix_length;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    u32 frame_count = HEADLESS_DEFAULT_FRAME_COUNT;
+    u16 width = window::width;
+    u16 height = window::height;
+    char *output_file_path = nullptr;
+    char *value;
+    for (int i = 1; i < argc; i++) {
+        if (     parseArgument(argv[i], "frames:", &value)) frame_count = (u32)atoi(value);
+        else if (parseArgument(argv[i], "width:",  &value)) width       = (u16)atoi(value);
+        else if (parseArgument(argv[i], "height:", &value)) height      = (u16)atoi(value);
+        else if (parseArgument(argv[i], "output:", &value)) output_file_path = value;
+        else {
+            printf("Unknown argument: %s\n"
+                   "Usage: %s [frames:<count>] [width:<pixels>] [height:<pixels>] [output:<file path>]\n", argv[i], argv[0]);
+            return 1;
+        }
+    }
+    if (width  < 1 || width  > MAX_WIDTH ) width  = window::width;
+    if (height < 1 || height > MAX_HEIGHT) height = window::height;
+
+    void* window_content_and_canvas_memory = os::getMemory(WINDOW_CONTENT_SIZE + (CANVAS_SIZE * CANVAS_COUNT));
+    if (!window_content_and_canvas_memory)
+        return -1;
+
+    window::content = (u32*)window_content_and_canvas_memory;
+    memory::canvas_memory = (u8*)window_content_and_canvas_memory + WINDOW_CONTENT_SIZE;
+
+    timers::ticks_per_second = 1000000000; // Ticks are nanoseconds
+    timers::seconds_per_tick = 1.0 / (f64)(timers::ticks_per_second);
+    timers::milliseconds_per_tick = 1000.0 * timers::seconds_per_tick;
+    timers::microseconds_per_tick = 1000.0 * timers::milliseconds_per_tick;
+    timers::nanoseconds_per_tick  = 1000.0 * timers::microseconds_per_tick;
+
+    CURRENT_APP = createApp();
+    if (!CURRENT_APP->is_running)
+        return -1;
+
+    CURRENT_APP->resize(width, height);
+
+    u64 update_ticks = 0;
+    u64 render_ticks = 0;
+    u32 frame = 0;
+    for (; frame < frame_count && CURRENT_APP->is_running; frame++) {
+        CURRENT_APP->OnWindowRedraw();
+        mouse::resetChanges();
+
+        update_ticks += CURRENT_APP->update_timer.ticks_diff;
+        render_ticks += CURRENT_APP->render_timer.ticks_diff;
+    }
+
+    if (frame) {
+        printf("Rendered %u frames at %ux%u\n", (unsigned int)frame, (unsigned int)width, (unsigned int)height);
+        printf("Average update time: %.3f ms\n", (f64)update_ticks * timers::milliseconds_per_tick / (f64)frame);
+        printf("Average render time: %.3f ms\n", (f64)render_ticks * timers::milliseconds_per_tick / (f64)frame);
+    }
+
+    if (output_file_path && !writeWindowContent(output_file_path))
+        return -1;
+
+    return 0;
+}
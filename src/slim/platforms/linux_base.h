@@ -0,0 +1,155 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#include <new>
+
+#include "../core/base.h"
+
+#ifndef NDEBUG
+#include <stdio.h>
+#include <string.h>
+#endif
+
+// File handles are file descriptors offset by 1, so that a null handle can signify failure:
+#define LINUX_FILE_HANDLE(fd) ((void*)(long)((fd) + 1))
+#define LINUX_FILE_DESCRIPTOR(handle) ((int)((long)(handle) - 1))
+
+void linux_closeFile(void *handle) {
+    close(LINUX_FILE_DESCRIPTOR(handle));
+}
+
+void* linux_openFileForReading(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+#ifndef NDEBUG
+        printf("Terminal failure: unable to open file \"%s\" for read (%s).\n", path, strerror(errno));
+#endif
+        return nullptr;
+    }
+    return LINUX_FILE_HANDLE(fd);
+}
+
+void* linux_openFileForWriting(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+#ifndef NDEBUG
+        printf("Terminal failure: unable to open file \"%s\" for write (%s).\n", path, strerror(errno));
+#endif
+        return nullptr;
+    }
+    return LINUX_FILE_HANDLE(fd);
+}
+
+bool linux_readFromFile(void *out, unsigned long size, void *handle) {
+    int fd = LINUX_FILE_DESCRIPTOR(handle);
+    u8 *bytes = (u8*)out;
+    while (size) {
+        ssize_t bytes_read = read(fd, bytes, size);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        if (bytes_read <= 0) {
+#ifndef NDEBUG
+            printf("Terminal failure: Unable to read from file (%s).\n", bytes_read ? strerror(errno) : "end of file");
+#endif
+            return false;
+        }
+        bytes += bytes_read;
+        size -= (unsigned long)bytes_read;
+    }
+    return true;
+}
+
+bool linux_writeToFile(void *out, unsigned long size, void *handle) {
+    int fd = LINUX_FILE_DESCRIPTOR(handle);
+    const u8 *bytes = (const u8*)out;
+    while (size) {
+        ssize_t bytes_written = write(fd, bytes, size);
+        if (bytes_written == -1 && errno == EINTR) continue;
+        if (bytes_written <= 0) {
+#ifndef NDEBUG
+            printf("Terminal failure: Unable to write to file (%s).\n", strerror(errno));
+#endif
+            return false;
+        }
+        bytes += bytes_written;
+        size -= (unsigned long)bytes_written;
+    }
+    return true;
+}
+
+
+// There is no window, so window related calls only keep track of state:
+void os::setWindowTitle(char* str) { window::title = str; }
+void os::setCursorVisibility(bool on) {}
+void os::setWindowCapture(bool on) {}
+
+u64 timers::getTicks() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64)time.tv_sec * 1000000000ULL + (u64)time.tv_nsec;
+}
+
+void* os::getMemory(u64 size, u64 base) {
+    void *memory = mmap((void*)base, (size_t)size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+void os::freeMemory(void *memory, u64 size) {
+    munmap(memory, (size_t)size);
+}
+
+void os::closeFile(void *handle) { return linux_closeFile(handle); }
+void* os::openFileForReading(const char* path) { return linux_openFileForReading(path); }
+void* os::openFileForWriting(const char* path) { return linux_openFileForWriting(path); }
+bool os::readFromFile(void *out, unsigned long size, void *handle) { return linux_readFromFile(out, size, handle); }
+bool os::writeToFile(void *out, unsigned long size, void *handle) { return linux_writeToFile(out, size, handle); }
+bool os::setFilePosition(u64 position, void *handle) { return lseek(LINUX_FILE_DESCRIPTOR(handle), (off_t)position, SEEK_SET) != -1; }
+
+struct LinuxThreadStart {
+    void (*thread_proc)(void *data);
+    void *data;
+};
+LinuxThreadStart linux_thread_starts[MAX_THREAD_COUNT];
+u32 linux_thread_count = 0;
+
+void* linux_threadProc(void *parameter) {
+    LinuxThreadStart *start = (LinuxThreadStart*)parameter;
+    start->thread_proc(start->data);
+    return nullptr;
+}
+
+u32 os::getProcessorCount() {
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+    return processor_count > 0 ? (u32)processor_count : 1;
+}
+
+bool os::createThread(void (*thread_proc)(void *data), void *data) {
+    if (linux_thread_count == MAX_THREAD_COUNT) return false;
+
+    LinuxThreadStart *start = linux_thread_starts + linux_thread_count++;
+    start->thread_proc = thread_proc;
+    start->data = data;
+
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, linux_threadProc, start)) return false;
+
+    pthread_detach(thread);
+    return true;
+}
+
+void* os::createSemaphore(u32 initial_count) {
+    sem_t *semaphore = new sem_t;
+    if (sem_init(semaphore, 0, initial_count)) {
+        delete semaphore;
+        return nullptr;
+    }
+    return semaphore;
+}
+void os::signalSemaphore(void *semaphore, u32 count) { for (u32 i = 0; i < count; i++) sem_post((sem_t*)semaphore); }
+void os::waitForSemaphore(void *semaphore) { while (sem_wait((sem_t*)semaphore) == -1 && errno == EINTR); }
+i32 os::atomicIncrement(volatile i32 *value) { return __sync_add_and_fetch(value, 1); }
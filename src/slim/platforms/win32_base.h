@@ -130,8 +130,55 @@ void* os::getMemory(u64 size, u64 base) {
     return VirtualAlloc((LPVOID)base, (SIZE_T)size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
 }
 
+void os::freeMemory(void *memory, u64 size) {
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
 void os::closeFile(void *handle) { return win32_closeFile(handle); }
 void* os::openFileForReading(const char* path) { return win32_openFileForReading(path); }
 void* os::openFileForWriting(const char* path) { return win32_openFileForWriting(path); }
 bool os::readFromFile(LPVOID out, DWORD size, HANDLE handle) { return win32_readFromFile(out, size, handle); }
-bool os::writeToFile(LPVOID out, DWORD size, HANDLE handle) { return win32_writeToFile(out, size, handle); }
\ No newline at end of file
+bool os::writeToFile(LPVOID out, DWORD size, HANDLE handle) { return win32_writeToFile(out, size, handle); }
+bool os::setFilePosition(u64 position, HANDLE handle) {
+    LARGE_INTEGER distance;
+    distance.QuadPart = (LONGLONG)position;
+    return SetFilePointerEx(handle, distance, nullptr, FILE_BEGIN) != 0;
+}
+
+struct Win32ThreadStart {
+    void (*thread_proc)(void *data);
+    void *data;
+};
+Win32ThreadStart win32_thread_starts[MAX_THREAD_COUNT];
+u32 win32_thread_count = 0;
+
+DWORD WINAPI win32_threadProc(LPVOID parameter) {
+    Win32ThreadStart *start = (Win32ThreadStart*)parameter;
+    start->thread_proc(start->data);
+    return 0;
+}
+
+u32 os::getProcessorCount() {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (u32)system_info.dwNumberOfProcessors;
+}
+
+bool os::createThread(void (*thread_proc)(void *data), void *data) {
+    if (win32_thread_count == MAX_THREAD_COUNT) return false;
+
+    Win32ThreadStart *start = win32_thread_starts + win32_thread_count++;
+    start->thread_proc = thread_proc;
+    start->data = data;
+
+    HANDLE handle = CreateThread(nullptr, 0, win32_threadProc, start, 0, nullptr);
+    if (!handle) return false;
+
+    CloseHandle(handle);
+    return true;
+}
+
+void* os::createSemaphore(u32 initial_count) { return CreateSemaphoreA(nullptr, (LONG)initial_count, MAX_THREAD_COUNT, nullptr); }
+void os::signalSemaphore(void *semaphore, u32 count) { ReleaseSemaphore((HANDLE)semaphore, (LONG)count, nullptr); }
+void os::waitForSemaphore(void *semaphore) { WaitForSingleObject((HANDLE)semaphore, INFINITE); }
+i32 os::atomicIncrement(volatile i32 *value) { return InterlockedIncrement(value); }
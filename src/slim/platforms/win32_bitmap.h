@@ -8,7 +8,35 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#ifdef _WIN32
 #include "./win32_base.h"
+#else
+#include "./linux_base.h"
+
+// The bitmap file format's headers (as declared by the Windows SDK):
+#pragma pack(push, 2)
+struct BITMAPFILEHEADER {
+    u16 bfType;
+    u32 bfSize;
+    u16 bfReserved1;
+    u16 bfReserved2;
+    u32 bfOffBits;
+};
+struct BITMAPINFOHEADER {
+    u32 biSize;
+    i32 biWidth;
+    i32 biHeight;
+    u16 biPlanes;
+    u16 biBitCount;
+    u32 biCompression;
+    u32 biSizeImage;
+    i32 biXPelsPerMeter;
+    i32 biYPelsPerMeter;
+    u32 biClrUsed;
+    u32 biClrImportant;
+};
+#pragma pack(pop)
+#endif
 
 u8* componentsToByteColor(u8 *component, ByteColor &byte_color, ImageInfo &info) {
     byte_color.B = *(component++);
@@ -22,17 +50,25 @@ u8* componentsToByteColor(u8 *component, ByteColor &byte_color, ImageInfo &info)
     return component;
 }
 
-u8* componentsToPixel(u8 *component, Pixel *pixel, ImageInfo &info, f32 gamma = 2.2f) {
+u8* componentsToPixel(u8 *component, Pixel *pixel, ImageInfo &info, f32 gamma = BITMAP_GAMMA) {
     ByteColor byte_color;
     component = componentsToByteColor(component, byte_color, info);
 
     *pixel = byte_color;
-    if (!info.flags.linear) pixel->color.applyGamma(gamma);
+    if (info.flags.linear)
+        return component;
+
+    if (gamma == BITMAP_GAMMA) {
+        pixel->color.r = gamma_tables.bitmap_decode[byte_color.R];
+        pixel->color.g = gamma_tables.bitmap_decode[byte_color.G];
+        pixel->color.b = gamma_tables.bitmap_decode[byte_color.B];
+    } else
+        pixel->color.applyGamma(gamma);
 
     return component;
 }
 
-void componentsToPixels(u8 *components, ImageInfo &info, Pixel *pixels, f32 gamma = 2.2f) {
+void componentsToPixels(u8 *components, ImageInfo &info, Pixel *pixels, f32 gamma = BITMAP_GAMMA) {
     Pixel* pixel = pixels;
     u8 *component = components;
     u32 count = info.width * info.height;
@@ -40,7 +76,7 @@ void componentsToPixels(u8 *components, ImageInfo &info, Pixel *pixels, f32 gamm
         component = componentsToPixel(component, pixel, info, gamma);
 }
 
-void componentsToByteColors(u8 *components, ImageInfo &info, ByteColor *byte_colors, f32 gamma = 2.2f) {
+void componentsToByteColors(u8 *components, ImageInfo &info, ByteColor *byte_colors, f32 gamma = BITMAP_GAMMA) {
     ByteColor* byte_color = byte_colors;
     u8 *component = components;
     u32 count = info.size;
@@ -55,7 +91,7 @@ void componentsToByteColors(u8 *components, ImageInfo &info, ByteColor *byte_col
         }
 }
 
-void componentsToChannels(u8 *components, ImageInfo &info, f32 *channels, f32 gamma = 2.2f) {
+void componentsToChannels(u8 *components, ImageInfo &info, f32 *channels, f32 gamma = BITMAP_GAMMA) {
     f32* channel = channels;
     u8 *component = components;
     u32 component_count = info.flags.alpha ? 4 : 3;
@@ -141,7 +177,11 @@ u8* loadBitmap(char *filename, ImageInfo &info) {
     u8 *components = new u8[size_in_bytes];
     u8 *scratch_components = new u8[size_in_bytes];
 
+#ifdef _WIN32
     SetFilePointer(file, (LONG)file_header.bfOffBits, nullptr, FILE_BEGIN);
+#else
+    lseek(LINUX_FILE_DESCRIPTOR(file), (off_t)file_header.bfOffBits, SEEK_SET);
+#endif
     os::readFromFile(components, size_in_bytes, file);
     os::closeFile(file);
 
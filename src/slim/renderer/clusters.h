@@ -0,0 +1,194 @@
+#pragma once
+
+#include "../scene/scene_bvh.h"
+
+// A range of triangles of a mesh (first to end, exclusive):
+struct FaceRange {
+    u32 first, end;
+};
+
+// For meshes that have clusters (see allocateClusters): Culls the leaf nodes of a mesh's BVH against the view frustum
+// in model space, skipping subtrees that are outside of any of its planes. Lists the ranges of the triangles of the
+// leaves in view (merging adjacent ones), and the vertex positions and normals that they use, each listed once
+// (marked as listed with the id of the current culling pass), for transforming only those.
+// Meshes that have meshlets get their meshlets culled instead (see cullMeshlets), also by their facing.
+// Levels of detail of meshes list the vertices that they use as they are (see list).
+struct ClusterCulling {
+    FaceRange *face_ranges{nullptr};
+    u32 *node_stack{nullptr};
+    u8 *plane_mask_stack{nullptr};
+    u32 *position_ids{nullptr}, *position_passes{nullptr};
+    u32 *normal_ids{nullptr}, *normal_passes{nullptr};
+    u32 face_range_count{0};
+    u32 position_count{0};
+    u32 normal_count{0};
+    u32 pass{0};
+    u32 position_pass_count{0}, normal_pass_count{0}; // Capacities of the pass marks (all cleared when passes wrap)
+    bool all_in_view{false};
+
+    // A BVH over N triangles has at most 2N - 1 nodes, N of which leaves:
+    static u64 GetMemorySize(u32 max_triangles, u32 max_vertex_positions, u32 max_vertex_normals) {
+        return (u64)max_triangles * (sizeof(FaceRange) + (sizeof(u32) + sizeof(u8)) * 2) +
+               (u64)(max_vertex_positions + max_vertex_normals) * sizeof(u32) * 2;
+    }
+
+    // Note: The allocated memory is assumed to be zeroed (as freshly acquired from the OS):
+    void allocate(u32 max_triangles, u32 max_vertex_positions, u32 max_vertex_normals, memory::MonotonicAllocator *memory_allocator) {
+        face_ranges      = (FaceRange*)memory_allocator->allocate(sizeof(FaceRange) * max_triangles);
+        node_stack       = (u32*      )memory_allocator->allocate(sizeof(u32)       * max_triangles * 2);
+        plane_mask_stack = (u8*       )memory_allocator->allocate(sizeof(u8)        * max_triangles * 2);
+        position_ids     = (u32*      )memory_allocator->allocate(sizeof(u32)       * max_vertex_positions);
+        position_passes  = (u32*      )memory_allocator->allocate(sizeof(u32)       * max_vertex_positions);
+        normal_ids       = (u32*      )memory_allocator->allocate(sizeof(u32)       * max_vertex_normals);
+        normal_passes    = (u32*      )memory_allocator->allocate(sizeof(u32)       * max_vertex_normals);
+        position_pass_count = max_vertex_positions;
+        normal_pass_count   = max_vertex_normals;
+    }
+
+    // Returns whether any of the mesh's leaves is in view. When all of them are entirely in view, only the face range
+    // covering all triangles is listed (with no vertices, all of them being used):
+    bool cull(const Mesh &mesh, const mat4 &model_to_clip) {
+        vec4 planes[6];
+        begin(model_to_clip, planes);
+
+        const bool has_normals = mesh.normals_count && mesh.cluster_normal_ids;
+        const bool separate_normals = has_normals && mesh.cluster_normal_ids != mesh.cluster_position_ids;
+        i32 top = 0;
+        node_stack[0] = 0;
+        plane_mask_stack[0] = 0b111111;
+        while (top >= 0) {
+            const u32 node_id = node_stack[top];
+            const BVHNode &node = mesh.bvh.nodes[node_id];
+            u8 plane_mask = plane_mask_stack[top--];
+            if (plane_mask && !intersectsFrustum(node.aabb, planes, plane_mask))
+                continue;
+
+            if (node_id == 0 && !plane_mask) {
+                // The whole mesh is in view:
+                face_ranges[0] = {0, mesh.triangle_count};
+                face_range_count = 1;
+                all_in_view = true;
+                return true;
+            }
+
+            if (!node.isLeaf()) {
+                node_stack[++top] = node.first_index + 1;
+                plane_mask_stack[top] = plane_mask;
+                node_stack[++top] = node.first_index;
+                plane_mask_stack[top] = plane_mask;
+                continue;
+            }
+
+            if (face_range_count && face_ranges[face_range_count - 1].end == node.first_index)
+                face_ranges[face_range_count - 1].end += node.leaf_count;
+            else
+                face_ranges[face_range_count++] = {node.first_index, node.first_index + node.leaf_count};
+
+            for (u32 i = mesh.cluster_position_offsets[node_id]; i < mesh.cluster_position_offsets[node_id + 1]; i++) {
+                const u32 id = mesh.cluster_position_ids[i];
+                if (position_passes[id] != pass) {
+                    position_passes[id] = pass;
+                    position_ids[position_count++] = id;
+                }
+            }
+            if (separate_normals)
+                for (u32 i = mesh.cluster_normal_offsets[node_id]; i < mesh.cluster_normal_offsets[node_id + 1]; i++) {
+                    const u32 id = mesh.cluster_normal_ids[i];
+                    if (normal_passes[id] != pass) {
+                        normal_passes[id] = pass;
+                        normal_ids[normal_count++] = id;
+                    }
+                }
+        }
+
+        if (has_normals && !separate_normals) {
+            // Welded meshes index their normals by the position indices:
+            for (u32 i = 0; i < position_count; i++) normal_ids[i] = position_ids[i];
+            normal_count = position_count;
+        }
+
+        return face_range_count != 0;
+    }
+
+    // Same as cull, for the meshlets of a mesh: Each is culled by its bounding sphere, and (when culling back faces)
+    // by its normal cone, given the camera's position in model space.
+    // Note: Only meaningful for transforms that keep the winding order (see Rasterizer::processVertices).
+    bool cullMeshlets(const Mesh &mesh, const mat4 &model_to_clip, const vec3 &camera_position, bool cull_back_faces) {
+        vec4 planes[6];
+        f32 plane_lengths[6];
+        begin(model_to_clip, planes);
+        for (u8 i = 0; i < 6; i++) plane_lengths[i] = Vec3(planes[i]).length();
+
+        const bool separate_normals = mesh.meshlet_normal_ids != mesh.meshlet_position_ids;
+        const Meshlet *meshlet = mesh.meshlets;
+        u32 culled_count = 0;
+        for (u32 m = 0; m < mesh.meshlet_count; m++, meshlet++) {
+            bool in_view = true;
+            for (u8 i = 0; i < 6 && in_view; i++)
+                in_view = Vec3(planes[i]).dot(meshlet->center) + planes[i].w >= -meshlet->radius * plane_lengths[i];
+            if (in_view && cull_back_faces && meshlet->cone_cutoff <= 1)
+                in_view = (meshlet->cone_apex - camera_position).normalized().dot(meshlet->cone_axis) < meshlet->cone_cutoff;
+            if (!in_view) {
+                culled_count++;
+                continue;
+            }
+
+            if (face_range_count && face_ranges[face_range_count - 1].end == meshlet->first_triangle)
+                face_ranges[face_range_count - 1].end += meshlet->triangle_count;
+            else
+                face_ranges[face_range_count++] = {meshlet->first_triangle, meshlet->first_triangle + meshlet->triangle_count};
+
+            const u32 *id = mesh.meshlet_position_ids + meshlet->first_position;
+            for (u32 i = 0; i < meshlet->position_count; i++, id++)
+                if (position_passes[*id] != pass) {
+                    position_passes[*id] = pass;
+                    position_ids[position_count++] = *id;
+                }
+
+            if (separate_normals) {
+                id = mesh.meshlet_normal_ids + meshlet->first_normal;
+                for (u32 i = 0; i < meshlet->normal_count; i++, id++)
+                    if (normal_passes[*id] != pass) {
+                        normal_passes[*id] = pass;
+                        normal_ids[normal_count++] = *id;
+                    }
+            }
+        }
+
+        if (!culled_count) {
+            // All of the mesh is in view (so all of its vertices are used):
+            face_ranges[0] = {0, mesh.triangle_count};
+            face_range_count = 1;
+            all_in_view = true;
+        } else if (mesh.normals_count && !separate_normals) {
+            for (u32 i = 0; i < position_count; i++) normal_ids[i] = position_ids[i];
+            normal_count = position_count;
+        }
+
+        return face_range_count != 0;
+    }
+
+    // List the vertices used by a level of detail of a mesh (all of whose triangles get rasterized):
+    void list(const Mesh &mesh, const MeshLOD &lod) {
+        face_range_count = 0;
+        all_in_view = false;
+        position_count = lod.position_count;
+        normal_count = lod.normal_count;
+        for (u32 i = 0; i < position_count; i++) position_ids[i] = mesh.lod_position_ids[lod.first_position + i];
+        for (u32 i = 0; i < normal_count;   i++) normal_ids[i]   = mesh.lod_normal_ids[lod.first_normal + i];
+    }
+
+private:
+    void begin(const mat4 &model_to_clip, vec4 *planes) {
+        face_range_count = position_count = normal_count = 0;
+        all_in_view = false;
+        if (!++pass) {
+            // Passes wrapped around, so the marks of earlier ones could be mistaken for the current one
+            // (including the ones of vertices beyond this mesh's, as left by larger meshes):
+            for (u32 i = 0; i < position_pass_count; i++) position_passes[i] = 0;
+            for (u32 i = 0; i < normal_pass_count;   i++) normal_passes[i] = 0;
+            pass = 1;
+        }
+        getFrustumPlanes(model_to_clip, planes);
+    }
+};
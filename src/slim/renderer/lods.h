@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../scene/scene_bvh.h"
+#include "../viewport/viewport.h"
+
+// A mesh rendered at one of its levels of detail: The same mesh, with the triangles of the level instead of its own
+// (the vertices being shared, though only the ones listed by the level are used):
+INLINE void setLODMesh(Mesh &lod_mesh, const Mesh &mesh, const MeshLOD &lod) {
+    lod_mesh = mesh;
+    lod_mesh.triangle_count = lod.triangle_count;
+    lod_mesh.vertex_position_indices = mesh.lod_vertex_position_indices + lod.first_triangle;
+    lod_mesh.vertex_normal_indices   = mesh.lod_vertex_normal_indices   + lod.first_triangle;
+    lod_mesh.vertex_uvs_indices      = mesh.lod_vertex_uvs_indices      + lod.first_triangle;
+    lod_mesh.leaf_ordered = false;
+    lod_mesh.cluster_position_offsets = lod_mesh.cluster_normal_offsets = nullptr;
+    lod_mesh.meshlets = nullptr;
+    lod_mesh.meshlet_count = 0;
+}
+
+// Selection of the level of detail that each geometry's mesh gets rendered at (optional, for meshes that have them):
+// The coarsest level whose error, as projected onto the screen from the nearest point of the geometry's world-space
+// bounds, is at most max_pixel_error pixels. A geometry only moves to a coarser level once that one's projected
+// error is below the limit by the hysteresis (as a fraction of it), and back to a finer one once the current one's
+// is above it by as much, so that geometries hovering around the limit do not keep switching back and forth.
+struct LODSelection {
+    u8 *levels; // Of each geometry: The level it was last selected at (0 for the mesh itself, then 1 for its first LOD)
+    f32 max_pixel_error{1.0f};
+    f32 hysteresis{0.25f};
+
+    // Of the last pass: The triangles of the selected levels, those of the meshes themselves, and the level changes:
+    u32 triangle_count{0};
+    u32 full_triangle_count{0};
+    u32 switch_count{0};
+
+    static u64 GetMemorySize(u32 geometry_count) {
+        return sizeof(u8) * (u64)geometry_count;
+    }
+
+    explicit LODSelection(const Scene &scene, memory::MonotonicAllocator *memory_allocator = nullptr) {
+        memory::MonotonicAllocator temp_allocator;
+        if (!memory_allocator) {
+            temp_allocator = memory::MonotonicAllocator{GetMemorySize(scene.counts.geometries)};
+            memory_allocator = &temp_allocator;
+        }
+        levels = (u8*)memory_allocator->allocate(sizeof(u8) * scene.counts.geometries);
+        for (u32 i = 0; i < scene.counts.geometries; i++) levels[i] = 0;
+    }
+
+    void begin() {
+        triangle_count = full_triangle_count = switch_count = 0;
+    }
+
+    // The level of detail to render a geometry's mesh at (null for the mesh itself):
+    const MeshLOD* select(u32 geometry_id, const Geometry &geometry, const Mesh &mesh, const Viewport &viewport) {
+        u8 &level = levels[geometry_id];
+        const u8 last_level = level;
+        if (level > mesh.lod_count) level = (u8)mesh.lod_count;
+
+        // The size of a pixel at the nearest point of the geometry (in model space, scaled as the geometry is):
+        const AABB bounds = SceneBVH::GetWorldBounds(geometry, mesh.aabb);
+        const vec3 &camera_position = viewport.camera->position;
+        const vec3 nearest_point = minimum(maximum(camera_position, bounds.min), bounds.max);
+        f32 distance = (nearest_point - camera_position).length();
+        if (distance < viewport.frustum.near_clipping_plane_distance)
+            distance = viewport.frustum.near_clipping_plane_distance;
+        const vec3 &scale = geometry.transform.scale;
+        f32 max_scale = fabsf(scale.x);
+        if (fabsf(scale.y) > max_scale) max_scale = fabsf(scale.y);
+        if (fabsf(scale.z) > max_scale) max_scale = fabsf(scale.z);
+        const f32 pixels_per_unit = max_scale * viewport.frustum.projection.scale.y * viewport.dimensions.h_height / distance;
+
+        const f32 coarser_limit = max_pixel_error * (1.0f - hysteresis) / pixels_per_unit;
+        const f32 finer_limit   = max_pixel_error * (1.0f + hysteresis) / pixels_per_unit;
+        while (level < mesh.lod_count && mesh.lods[level].error <= coarser_limit) level++;
+        while (level && mesh.lods[level - 1].error > finer_limit) level--;
+
+        if (level != last_level) switch_count++;
+        full_triangle_count += mesh.triangle_count;
+        triangle_count += level ? mesh.lods[level - 1].triangle_count : mesh.triangle_count;
+        return level ? mesh.lods + level - 1 : nullptr;
+    }
+};
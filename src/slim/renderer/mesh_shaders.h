@@ -3,10 +3,92 @@
 #include "../renderer/rasterizer.h"
 
 
-u8 shadeMesh(const Mesh &mesh, const Rasterizer &rasterizer) {
-    // Transform the mesh's vertex positions into clip space and world space:
+#if SIMD_WIDTH > 1
+// Batched versions of the transformations in shadeMeshVertices, for SIMD_WIDTH vertices at a time (read from streams).
+// World space vectors are used per face, so are written out as vectors, while clip space positions are written as streams:
+
+INLINE void storeVectors(f32_lanes x, f32_lanes y, f32_lanes z, vec3 *vectors, u32 count) {
+    f32 X[SIMD_WIDTH], Y[SIMD_WIDTH], Z[SIMD_WIDTH];
+    simd::store(X, x);
+    simd::store(Y, y);
+    simd::store(Z, z);
+    for (u32 lane = 0; lane < count; lane++, vectors++) {
+        vectors->x = X[lane];
+        vectors->y = Y[lane];
+        vectors->z = Z[lane];
+    }
+}
+
+void shadeMeshPositionStreams(const Mesh &mesh, const Rasterizer &rasterizer, u32 first_vertex, u32 end_vertex) {
+    const mat4_lanes model_to_world{rasterizer.model_to_world};
+    const mat4_lanes world_to_clip{rasterizer.world_to_clip};
+    const f32_lanes one = simd::set(1.0f);
+    const vec3_streams &positions = mesh.vertex_position_streams;
+    const vec4_streams &clip_space = rasterizer.clip_space_vertex_streams;
+    f32_lanes x, y, z, w, X, Y, Z, W;
+    for (u32 i = first_vertex; i < end_vertex; i += SIMD_WIDTH) {
+        model_to_world.transform(simd::load(positions.x + i), simd::load(positions.y + i), simd::load(positions.z + i), one, x, y, z, w);
+        world_to_clip.transform(x, y, z, w, X, Y, Z, W);
+        simd::store(clip_space.x + i, X);
+        simd::store(clip_space.y + i, Y);
+        simd::store(clip_space.z + i, Z);
+        simd::store(clip_space.w + i, W);
+        storeVectors(x, y, z, rasterizer.world_space_vertex_positions + i, end_vertex - i < SIMD_WIDTH ? end_vertex - i : SIMD_WIDTH);
+    }
+}
+
+void shadeMeshNormalStreams(const Mesh &mesh, const Rasterizer &rasterizer, u32 first_vertex, u32 end_vertex) {
+    const mat4_lanes normal_to_world{rasterizer.model_to_world_inverted_transposed};
+    const f32_lanes zero = simd::set(0.0f);
+    const vec3_streams &normals = mesh.vertex_normal_streams;
+    f32_lanes x, y, z, w;
+    for (u32 i = first_vertex; i < end_vertex; i += SIMD_WIDTH) {
+        normal_to_world.transform(simd::load(normals.x + i), simd::load(normals.y + i), simd::load(normals.z + i), zero, x, y, z, w);
+        storeVectors(x, y, z, rasterizer.world_space_vertex_normals + i, end_vertex - i < SIMD_WIDTH ? end_vertex - i : SIMD_WIDTH);
+    }
+}
+#endif
+
+// Same as shadeMeshVertices, for the vertices listed by cluster culling (when only some of the clusters are in view):
+void shadeListedMeshVertices(const Mesh &mesh, const Rasterizer &rasterizer, u32 first_vertex, u32 end_vertex) {
+    const ClusterCulling &clusters = rasterizer.clusters;
     vec4 world_space;
-    for (u32 i = 0; i < mesh.vertex_count; i++) {
+    u32 i;
+
+    u32 end = end_vertex < clusters.position_count ? end_vertex : clusters.position_count;
+    for (u32 v = first_vertex; v < end; v++) {
+        i = clusters.position_ids[v];
+        world_space = Vec4(mesh.vertex_positions[i], 1.0f);
+        world_space = rasterizer.model_to_world * world_space;
+        rasterizer.clip_space_vertex_positions[i] = rasterizer.world_to_clip * world_space;
+        rasterizer.world_space_vertex_positions[i] = Vec3(world_space);
+    }
+
+    end = end_vertex < clusters.normal_count ? end_vertex : clusters.normal_count;
+    for (u32 v = first_vertex; v < end; v++) {
+        i = clusters.normal_ids[v];
+        world_space = Vec4(mesh.vertex_normals[i]);
+        world_space = rasterizer.model_to_world_inverted_transposed * world_space;
+        rasterizer.world_space_vertex_normals[i] = Vec3(world_space);
+    }
+}
+
+void shadeMeshVertices(const Mesh &mesh, const Rasterizer &rasterizer, u32 first_vertex, u32 end_vertex) {
+    if (rasterizer.vertices_listed) {
+        shadeListedMeshVertices(mesh, rasterizer, first_vertex, end_vertex);
+        return;
+    }
+
+    vec4 world_space;
+
+    // Transform the mesh's vertex positions into clip space and world space:
+    u32 end = end_vertex < mesh.vertex_count ? end_vertex : mesh.vertex_count;
+#if SIMD_WIDTH > 1
+    if (rasterizer.clip_space_in_streams)
+        shadeMeshPositionStreams(mesh, rasterizer, first_vertex, end);
+    else
+#endif
+    for (u32 i = first_vertex; i < end; i++) {
         world_space = Vec4(mesh.vertex_positions[i], 1.0f);
         world_space = rasterizer.model_to_world * world_space;
         rasterizer.clip_space_vertex_positions[i] = rasterizer.world_to_clip * world_space;
@@ -14,12 +96,20 @@ u8 shadeMesh(const Mesh &mesh, const Rasterizer &rasterizer) {
     }
 
     // Transform the mesh's vertex normals into world space:
-    for (u32 i = 0; i < mesh.normals_count; i++) {
+    end = end_vertex < mesh.normals_count ? end_vertex : mesh.normals_count;
+#if SIMD_WIDTH > 1
+    if (mesh.vertex_normal_streams.x)
+        shadeMeshNormalStreams(mesh, rasterizer, first_vertex, end);
+    else
+#endif
+    for (u32 i = first_vertex; i < end; i++) {
         world_space = Vec4(mesh.vertex_normals[i]);
         world_space = rasterizer.model_to_world_inverted_transposed * world_space;
         rasterizer.world_space_vertex_normals[i] = Vec3(world_space);
     }
+}
 
+u8 shadeMesh(const Mesh &mesh, Rasterizer &rasterizer) {
+    rasterizer.processVertices(mesh, shadeMeshVertices);
     return INSIDE;
 }
-
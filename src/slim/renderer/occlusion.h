@@ -0,0 +1,189 @@
+#pragma once
+
+#include "../scene/scene_bvh.h"
+
+// Levels of the depth pyramid: The first has a texel per depth tile of the canvas (see Canvas), and each next one
+// has a texel per 2x2 texels of the previous one (enough levels for the largest canvas to shrink down to one texel):
+#define OCCLUSION_MAX_LEVELS 12
+#define OCCLUSION_MAX_COLUMNS ((MAX_WIDTH  * 2 + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT)
+#define OCCLUSION_MAX_ROWS    ((MAX_HEIGHT * 2 + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT)
+
+// Of a culling pass (or accumulated over all of them):
+struct OcclusionStats {
+    u32 tested{0};   // Geometries tested against the depth pyramid
+    u32 occluded{0}; // Hits: Geometries found to be occluded (so skipped)
+    u32 revealed{0}; // Geometries that were occluded in the previous pass and are not anymore (popping back in)
+
+    INLINE u32 visible() const { return tested - occluded; } // Misses
+
+    OcclusionStats& operator += (const OcclusionStats &rhs) {
+        tested += rhs.tested;
+        occluded += rhs.occluded;
+        revealed += rhs.revealed;
+        return *this;
+    }
+};
+
+// Occlusion culling of geometries against the depths of the previous frame (optional): Once a viewport got rasterized
+// its depths get reduced into a pyramid of maximum depths (see build), starting from the canvas' depth tiles.
+// In the next frame, the world-space bounds of each geometry are projected as they were in the previous one,
+// and the geometry is skipped if its nearest depth is further than the furthest depth of the pyramid's texels that
+// its screen-space bounds overlap (at the level where those are at most 2x2 texels).
+// Occluders that moved away reveal what was behind them a frame late, which shows in the stats as revealed geometries.
+// Meant for a single viewport per frame: The pyramid is of the last viewport that got rasterized.
+// Canvases without depth tiles (see Canvas) do not get a pyramid built, so nothing gets culled for them.
+struct OcclusionCulling {
+    f32 *levels[OCCLUSION_MAX_LEVELS];
+    u32 columns[OCCLUSION_MAX_LEVELS];
+    u32 rows[OCCLUSION_MAX_LEVELS];
+    u32 level_count{0};
+
+    // Of the frame the pyramid was built from:
+    mat4 world_to_clip;
+    vec2 screen_transform;
+    f32 width{0}, height{0}; // In sub-pixels when antialiased
+
+    u32 *occluded_passes; // Of each geometry: The last culling pass that found it to be occluded
+    u32 pass{0};
+    OcclusionStats stats;       // Of the last culling pass
+    OcclusionStats total_stats; // Of all culling passes so far
+
+    static u64 GetMemorySize(u32 geometry_count) {
+        return sizeof(f32) * (u64)OCCLUSION_MAX_COLUMNS * OCCLUSION_MAX_ROWS * 2 + sizeof(u32) * (u64)geometry_count;
+    }
+
+    explicit OcclusionCulling(const Scene &scene, memory::MonotonicAllocator *memory_allocator = nullptr) {
+        memory::MonotonicAllocator temp_allocator;
+        if (!memory_allocator) {
+            temp_allocator = memory::MonotonicAllocator{GetMemorySize(scene.counts.geometries)};
+            memory_allocator = &temp_allocator;
+        }
+        // Each level is at most a quarter of the one before it, so all the ones after the first fit in its size:
+        levels[0] = (f32*)memory_allocator->allocate(sizeof(f32) * OCCLUSION_MAX_COLUMNS * OCCLUSION_MAX_ROWS * 2);
+        occluded_passes = (u32*)memory_allocator->allocate(sizeof(u32) * scene.counts.geometries);
+        for (u32 i = 0; i < scene.counts.geometries; i++) occluded_passes[i] = 0;
+    }
+
+    // Reduce the depths of a rasterized canvas into the pyramid, given the matrix and screen transform (see
+    // Rasterizer::projectToScreen) they were rasterized with:
+    void build(const Canvas &canvas, const mat4 &to_clip, const vec2 &to_screen) {
+        level_count = 0;
+        if (!canvas.depth_tiles)
+            return;
+
+        world_to_clip = to_clip;
+        screen_transform = to_screen;
+        width  = (f32)((u32)canvas.dimensions.width  << (canvas.antialias != NoAA));
+        height = (f32)((u32)canvas.dimensions.height << (canvas.antialias != NoAA));
+
+        columns[0] = ((u32)width  + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        rows[0]    = ((u32)height + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        f32 *texel = levels[0];
+        for (u32 y = 0; y < rows[0]; y++)
+            for (u32 x = 0; x < columns[0]; x++)
+                *texel++ = canvas.depthTileBound(x << DEPTH_TILE_SHIFT, y << DEPTH_TILE_SHIFT);
+
+        level_count = 1;
+        while (level_count < OCCLUSION_MAX_LEVELS && (columns[level_count - 1] > 1 || rows[level_count - 1] > 1)) {
+            const u32 level = level_count++;
+            const u32 below_columns = columns[level - 1];
+            const u32 below_rows = rows[level - 1];
+            const f32 *below = levels[level - 1];
+            columns[level] = (below_columns + 1) >> 1;
+            rows[level]    = (below_rows    + 1) >> 1;
+            levels[level] = levels[level - 1] + below_columns * below_rows;
+            texel = levels[level];
+            for (u32 y = 0; y < rows[level]; y++) {
+                const f32 *row = below + below_columns * (y << 1);
+                const f32 *next_row = (y << 1) + 1 < below_rows ? row + below_columns : row;
+                for (u32 x = 0; x < columns[level]; x++) {
+                    const u32 left = x << 1;
+                    const u32 right = left + 1 < below_columns ? left + 1 : left;
+                    f32 max_depth = row[left];
+                    if (row[right]      > max_depth) max_depth = row[right];
+                    if (next_row[left]  > max_depth) max_depth = next_row[left];
+                    if (next_row[right] > max_depth) max_depth = next_row[right];
+                    *texel++ = max_depth;
+                }
+            }
+        }
+    }
+
+    // Whether the given world-space bounds are hidden behind the depths of the pyramid. Bounds that reach behind the
+    // near clipping plane or that are off screen are not considered occluded (the latter are for frustum culling):
+    bool isOccluded(const AABB &bounds) const {
+        if (!level_count)
+            return false;
+
+        f32 nearest = INFINITY;
+        vec2 min{INFINITY, INFINITY}, max{-INFINITY, -INFINITY};
+        for (u8 corner = 0; corner < 8; corner++) {
+            vec4 position = world_to_clip * Vec4(vec3{
+                    corner & 1 ? bounds.max.x : bounds.min.x,
+                    corner & 2 ? bounds.max.y : bounds.min.y,
+                    corner & 4 ? bounds.max.z : bounds.min.z
+            }, 1.0f);
+            if (position.z < 0 || position.w <= 0)
+                return false;
+
+            const f32 one_over_w = 1.0f / position.w;
+            const vec2 screen{
+                 position.x * one_over_w * screen_transform.x + screen_transform.x,
+                -position.y * one_over_w * screen_transform.y + screen_transform.y
+            };
+            min = minimum(min, screen);
+            max = maximum(max, screen);
+            if (position.w < nearest) nearest = position.w;
+        }
+        if (max.x < 0 || max.y < 0 || min.x >= width || min.y >= height)
+            return false;
+
+        const u32 first_x = min.x > 0 ? (u32)min.x >> DEPTH_TILE_SHIFT : 0;
+        const u32 first_y = min.y > 0 ? (u32)min.y >> DEPTH_TILE_SHIFT : 0;
+        const u32 last_x = (u32)(max.x < width  ? max.x : width  - 1) >> DEPTH_TILE_SHIFT;
+        const u32 last_y = (u32)(max.y < height ? max.y : height - 1) >> DEPTH_TILE_SHIFT;
+
+        // The first level at which the bounds overlap no more than 2x2 texels:
+        u32 level = 0;
+        while (level + 1 < level_count && ((last_x >> level) - (first_x >> level) > 1 ||
+                                           (last_y >> level) - (first_y >> level) > 1))
+            level++;
+
+        const f32 *texels = levels[level];
+        for (u32 y = first_y >> level; y <= last_y >> level; y++)
+            for (u32 x = first_x >> level; x <= last_x >> level; x++)
+                if (texels[columns[level] * y + x] >= nearest)
+                    return false;
+
+        return true;
+    }
+
+    // Find the geometries (the ones that get rasterized: boxes and meshes) that are occluded, skipping the ones
+    // already found to be outside the view frustum when there's a scene BVH (using its bounds for the rest):
+    void cull(const Scene &scene, const SceneBVH *scene_bvh = nullptr) {
+        pass++;
+        stats = {};
+        AABB bounds;
+        for (u32 geometry_id = 0; geometry_id < scene.counts.geometries; geometry_id++) {
+            if (scene_bvh) {
+                if (!scene_bvh->isVisible(geometry_id))
+                    continue;
+
+                bounds = scene_bvh->geometry_aabbs[geometry_id];
+            } else if (!SceneBVH::GetWorldBounds(scene, geometry_id, bounds))
+                continue;
+
+            stats.tested++;
+            if (isOccluded(bounds)) {
+                occluded_passes[geometry_id] = pass;
+                stats.occluded++;
+            } else if (pass > 1 && occluded_passes[geometry_id] == pass - 1)
+                stats.revealed++;
+        }
+        total_stats += stats;
+    }
+
+    INLINE bool isOccluded(u32 geometry_id) const {
+        return occluded_passes[geometry_id] == pass;
+    }
+};
@@ -4,23 +4,50 @@
 #include "../math/utils.h"
 #include "../scene/scene.h"
 
-INLINE vec3 sampleNormal(Texture &texture, f32 u, f32 v, f32 uv_area) {
-    Pixel pixel = texture.sample(u, v, uv_area);
+// Sample one of the material's textures at the shaded uv coordinates (unless the rasterizer sampled it already),
+// from the triangle's mip level when it has one:
+INLINE Pixel sampleTexture(const Shaded &shaded, const Scene &scene, u8 slot) {
+    if (shaded.presampled_textures & (1 << slot))
+        return shaded.texture_samples[slot];
+
+    if (shaded.material->atlas_textures & (1 << slot)) {
+        const AtlasTexture &atlas_texture = shaded.material->atlas_texture_slots[slot];
+        if (shaded.triangle_mip_level_textures & (1 << slot))
+            return atlas_texture.sample(shaded.triangle_mip_levels[slot], shaded.u, shaded.v);
+
+        return atlas_texture.sample(shaded.u, shaded.v, shaded.uv_area, shaded.dUVdx, shaded.dUVdy);
+    }
+
+    const Texture &texture = scene.textures[shaded.material->texture_ids[slot]];
+    if (shaded.triangle_mip_level_textures & (1 << slot))
+        return texture.mips[shaded.triangle_mip_levels[slot]].sample(shaded.u, shaded.v);
+
+    return texture.sample(shaded.u, shaded.v, shaded.uv_area, shaded.dUVdx, shaded.dUVdy);
+}
+
+INLINE vec3 decodeNormal(const Pixel &pixel) {
     vec3 normal = pixel.color;
     f32 y = normal.z;
     normal.z = normal.y;
     normal.y = y;
     return normal.scaleAdd(2.0f, vec3{-1.0f}).normalized();
 }
-INLINE quat getNormalRotation(vec3 normal, f32 magnitude) {
-    // axis      = up ^ normal = [0, 1, 0] ^ [x, y, z] = [1*z - 0*y, 0*x - 0*z, 0*y - 1*x] = [z, 0, -x]
-    // cos_angle = up . normal = [0, 1, 0] . [x, y, z] = 0*x + 1*y + 0*z = y
-    vec3 axis{normal.z, 0, -normal.x};
-    f32 angle = acosf(normal.y);
-    return quat::AxisAngle(axis.normalized(),  angle * magnitude);
-//    vec3 up{0, 1, 0};
-//    quat q{up.cross(normal), sqrtf(1.0f + up.dot(normal))};
-//    return quat{{normal.z * magnitude, 0.0f, -normal.x * magnitude}, (1.0f + normal.y) * magnitude}.normalized();
+INLINE vec3 sampleNormal(Texture &texture, f32 u, f32 v, f32 uv_area) {
+    return decodeNormal(texture.sample(u, v, uv_area));
+}
+INLINE vec3 sampleNormal(const Shaded &shaded, const Scene &scene) {
+    return decodeNormal(sampleTexture(shaded, scene, 1));
+}
+// Bring a sampled normal (decoded as above, with y along the surface's normal) into world space, through the tangent
+// frame of the shaded pixel: Its tangent and bitangent (per triangle) and its interpolated normal.
+// The magnitude lerps from the unperturbed normal (at 0) to the sampled one (at 1), extrapolating beyond that:
+INLINE vec3 applyNormalMap(const Shaded &shaded, const vec3 &normal, f32 magnitude) {
+    return shaded.tangent.scaleAdd(
+            normal.x * magnitude,
+            shaded.normal.scaleAdd(
+                    fast_mul_add(normal.y - 1.0f, magnitude, 1.0f),
+                    shaded.bitangent * (normal.z * magnitude))
+    ).normalized();
 }
 
 INLINE bool isChequerboard(f32 u, f32 v, f32 half_step_count) {
@@ -32,8 +59,7 @@ INLINE bool isChequerboard(f32 u, f32 v, f32 half_step_count) {
 }
 
 void shadePixelTextured(Shaded &shaded, const Scene &scene) {
-    Pixel pixel = scene.textures[shaded.material->texture_ids[0]].sample(shaded.u, shaded.v, shaded.uv_area);
-    shaded.color = pixel.color;
+    shaded.color = sampleTexture(shaded, scene, 0).color;
 }
 
 void shadePixelDepth(Shaded &shaded, const Scene &scene) {
@@ -52,10 +78,7 @@ void shadePixelPosition(Shaded &shaded, const Scene &scene) {
 
 void shadePixelNormal(Shaded &shaded, const Scene &scene) {
     if (shaded.material->normal_magnitude && shaded.material->texture_count > 1)
-        shaded.normal = getNormalRotation(
-                sampleNormal(scene.textures[shaded.material->texture_ids[1]], shaded.u, shaded.v, shaded.uv_area),
-                shaded.material->normal_magnitude
-        ) * shaded.normal;
+        shaded.normal = applyNormalMap(shaded, sampleNormal(shaded, scene), shaded.material->normal_magnitude);
 
     shaded.color = shaded.normal.scaleAdd(0.5f, vec3{0.5f}).toColor();
 }
@@ -65,10 +88,7 @@ void shadePixelCheckerboard(Shaded &shaded, const Scene &scene) {
 }
 void shadePixelLighting(Shaded &shaded, const Scene &scene) {
     if (shaded.material->normal_magnitude && shaded.material->texture_count > 1)
-        shaded.normal = getNormalRotation(
-                sampleNormal(scene.textures[shaded.material->texture_ids[1]], shaded.u, shaded.v, shaded.uv_area),
-                shaded.material->normal_magnitude
-        ) * shaded.normal;
+        shaded.normal = applyNormalMap(shaded, sampleNormal(shaded, scene), shaded.material->normal_magnitude);
 
     shaded.color = scene.ambient_light.color;
     vec3 lighting;
@@ -88,12 +108,9 @@ void shadePixelClassic(Shaded &shaded, const Scene &scene) {
 
     shaded.diffuse = shaded.material->diffuse;
     if (shaded.material->texture_count) {
-        shaded.diffuse = shaded.diffuse * scene.textures[shaded.material->texture_ids[0]].sample(shaded.u, shaded.v, shaded.uv_area).color;
+        shaded.diffuse = shaded.diffuse * sampleTexture(shaded, scene, 0).color;
         if (shaded.material->normal_magnitude && shaded.material->texture_count > 1)
-            shaded.normal = getNormalRotation(
-                    sampleNormal(scene.textures[shaded.material->texture_ids[1]], shaded.u, shaded.v, shaded.uv_area),
-                    shaded.material->normal_magnitude
-            ) * shaded.normal;
+            shaded.normal = applyNormalMap(shaded, sampleNormal(shaded, scene), shaded.material->normal_magnitude);
     }
 
     shaded.color = scene.ambient_light.color;
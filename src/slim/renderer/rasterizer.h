@@ -1,9 +1,18 @@
 #pragma once
 
 #include "../math/utils.h"
+#include "../math/simd.h"
+#include "../math/streams.h"
+#include "../core/jobs.h"
 #include "../draw/line.h"
 #include "../scene/scene.h"
+#include "../scene/scene_bvh.h"
 #include "../viewport/viewport.h"
+#include "./tiles.h"
+#include "./visibility.h"
+#include "./clusters.h"
+#include "./occlusion.h"
+#include "./lods.h"
 
 // Culling flags:
 // ======================
@@ -21,7 +30,27 @@
 #define CULL    0b00000000
 #define INSIDE  0b00000010
 
+// Marks a position of a face as having been produced by clipping (so not in the post-transform cache):
+#define CLIPPED_VERTEX 0xFFFFFFFF
 
+// Vertices are processed in chunks of this many (small enough for a chunk's data to stay in cache):
+#define RASTER_VERTEX_CHUNK_SIZE 2048
+
+
+
+struct Rasterizer;
+
+// Processes a range of a mesh's vertices, writing into the rasterizer's vertex buffers (see Rasterizer::processVertices).
+// The range is shared by vertex positions and normals, so it needs to be clamped to the count of each.
+// When only some of the mesh's clusters are in view, the range is of the listed vertices instead (see vertices_listed):
+typedef void (*VertexShader)(const Mesh &mesh, const Rasterizer &rasterizer, u32 first_vertex, u32 end_vertex);
+
+// Where a chunk of vertices is in relation to the view frustum:
+struct VertexChunk {
+    u8 shared_directions;
+    bool has_inside;
+    bool needs_clipping;
+};
 
 struct Rasterizer {
     static CubeMesh cube;
@@ -30,44 +59,134 @@ struct Rasterizer {
     u8 *vertex_flags;
     vec3 *world_space_vertex_positions, *world_space_vertex_normals;
     vec4 *clip_space_vertex_positions;
+
+    // Clip-space positions of meshes that have vertex streams are written into streams instead (see processVertices):
+    vec4_streams clip_space_vertex_streams;
+    bool clip_space_in_streams{false};
+
+    // Post-transform vertex cache: Screen-space positions (x, y: pixel coordinates, z: depth, w: 1/w) of the
+    // vertices of the current mesh, projected once per vertex (when classified) to then be shared by all faces.
+    // Only valid for vertices that are not behind the near clipping plane.
+    vec4 *screen_space_vertex_positions;
+    vec2 screen_transform;
     mat4 model_to_world_inverted_transposed, model_to_world, world_to_clip;
 
-    static u64 GetMemorySize(u32 max_vertex_positions, u32 max_vertex_normals) {
-        return (u64)max_vertex_positions * (sizeof(vec3) + sizeof(vec4) + 1) + sizeof(vec3) * (u64)max_vertex_normals;
+    // Tile-binned multi-threaded back end (used when there is more than one worker):
+    JobPool jobs;
+    TileBins tile_bins;
+    const Viewport *active_viewport{nullptr}; // Of the current pass (for jobs)
+
+    // Vertex processing of the current mesh (in parallel chunks, when done through processVertices):
+    VertexChunk *vertex_chunks;
+    u32 vertex_chunk_count{0};
+    const Mesh *processed_mesh{nullptr};
+    VertexShader vertex_shader{nullptr};
+
+    // Cluster culling of the current mesh (for meshes that have clusters, when done through processVertices):
+    // Only the triangles of the leaves in view get rasterized, and when that's only some of them, only the vertices
+    // that they use get processed (as listed by the clusters).
+    ClusterCulling clusters;
+    bool vertices_listed{false};
+
+    // Deferred shading (optional): Triangles are first only depth tested, recording the one visible at each pixel,
+    // then every visible pixel is shaded exactly once (overdraw no longer multiplies the cost of shading).
+    // Meant for opaque materials: A shaded pixel replaces whatever was underneath it, instead of blending over it.
+    VisibilityBuffer visibility;
+    bool deferred_shading{false};
+    bool visibility_pass{false};
+
+    // Hierarchical frustum culling of geometries (optional): Geometries outside the view frustum are skipped as whole
+    // subtrees of the scene's BVH, before any of their vertices are processed. Moving a geometry needs a refit of it.
+    SceneBVH *scene_bvh{nullptr};
+
+    // Occlusion culling of geometries (optional): Geometries hidden behind the depths of the previous frame are
+    // skipped, then the depths of this frame get reduced into the pyramid for the next one (see OcclusionCulling).
+    OcclusionCulling *occlusion{nullptr};
+
+    // Levels of detail (optional, for meshes that have them): Geometries get their meshes rendered at the level
+    // selected for them (see LODSelection), with only the vertices used by it processed (as listed by the clusters).
+    LODSelection *lod_selection{nullptr};
+    const MeshLOD *mesh_lod{nullptr}; // Of the current geometry's mesh (null when rendered as is)
+    Mesh lod_mesh;
+
+    static u32 GetMaxVertexChunkCount(u32 max_vertex_positions, u32 max_vertex_normals) {
+        u32 max_vertex_count = max_vertex_positions > max_vertex_normals ? max_vertex_positions : max_vertex_normals;
+        return (max_vertex_count + RASTER_VERTEX_CHUNK_SIZE - 1) / RASTER_VERTEX_CHUNK_SIZE + 1;
+    }
+    static u64 GetMemorySize(u32 max_vertex_positions, u32 max_vertex_normals, u32 max_triangles = 0) {
+        return (u64)max_vertex_positions * (sizeof(vec3) + sizeof(vec4)) + sizeof(vec3) * (u64)max_vertex_normals +
+               (u64)SIMD_PADDED_COUNT(max_vertex_positions) * (sizeof(f32) * 4 + sizeof(vec4) + 1) +
+               sizeof(VertexChunk) * (u64)GetMaxVertexChunkCount(max_vertex_positions, max_vertex_normals) +
+               ClusterCulling::GetMemorySize(max_triangles, max_vertex_positions, max_vertex_normals);
     }
     static u64 GetMemorySize(const Scene &scene) {
-        return GetMemorySize(scene.max_vertex_positions, scene.max_vertex_normals);
+        return GetMemorySize(scene.max_vertex_positions, scene.max_vertex_normals, scene.max_triangle_count);
     }
     static u64 GetMemorySize(u32 mesh_count, String *mesh_files) {
         u32 max_vertex_positions = 0;
         u32 max_vertex_normals = 0;
+        u32 max_triangles = 0;
         Mesh mesh;
         String *mesh_file = mesh_files;
         for (u32 i = 0; i < mesh_count; i++, mesh_file++) {
             void *file = os::openFileForReading(mesh_file->char_ptr);
             if (!file)
                 continue;
-            readHeader(mesh, file);
+            bool read = readHeader(mesh, file);
             os::closeFile(file);
+            if (!read)
+                continue;
 
             if (mesh.vertex_count  > max_vertex_positions) max_vertex_positions = mesh.vertex_count;
             if (mesh.normals_count > max_vertex_normals) max_vertex_normals     = mesh.normals_count;
+            if (mesh.triangle_count > max_triangles) max_triangles = mesh.triangle_count;
         }
-        return GetMemorySize(max_vertex_positions, max_vertex_normals);
+        return GetMemorySize(max_vertex_positions, max_vertex_normals, max_triangles);
     }
 
-    explicit Rasterizer(Scene &scene, memory::MonotonicAllocator *memory_allocator = nullptr) : scene{scene} {
+    explicit Rasterizer(Scene &scene, memory::MonotonicAllocator *memory_allocator = nullptr, u32 thread_count = 1) : scene{scene} {
         memory::MonotonicAllocator temp_allocator;
         if (!memory_allocator) {
             temp_allocator = memory::MonotonicAllocator{GetMemorySize(scene), Terabytes(3)};
             memory_allocator = &temp_allocator;
         }
-        vertex_flags = (u8*)memory_allocator->allocate(scene.max_vertex_positions);
+        u32 padded_vertex_count = SIMD_PADDED_COUNT(scene.max_vertex_positions);
+        vertex_flags = (u8*)memory_allocator->allocate(padded_vertex_count);
+        clip_space_vertex_streams.x = (f32*)memory_allocator->allocate(sizeof(f32) * padded_vertex_count);
+        clip_space_vertex_streams.y = (f32*)memory_allocator->allocate(sizeof(f32) * padded_vertex_count);
+        clip_space_vertex_streams.z = (f32*)memory_allocator->allocate(sizeof(f32) * padded_vertex_count);
+        clip_space_vertex_streams.w = (f32*)memory_allocator->allocate(sizeof(f32) * padded_vertex_count);
+        screen_space_vertex_positions = (vec4*)memory_allocator->allocate(sizeof(vec4) * padded_vertex_count);
         clip_space_vertex_positions  = (vec4*)memory_allocator->allocate(sizeof(vec4) * scene.max_vertex_positions);
         world_space_vertex_positions = (vec3*)memory_allocator->allocate(sizeof(vec3) * scene.max_vertex_positions);
         world_space_vertex_normals   = (vec3*)memory_allocator->allocate(sizeof(vec3) * scene.max_vertex_normals);
+        vertex_chunks = (VertexChunk*)memory_allocator->allocate(sizeof(VertexChunk) *
+                GetMaxVertexChunkCount(scene.max_vertex_positions, scene.max_vertex_normals));
+        clusters.allocate(scene.max_triangle_count, scene.max_vertex_positions, scene.max_vertex_normals, memory_allocator);
+        setThreadCount(thread_count);
     };
 
+    // With more than one thread, triangles are binned into screen tiles which are then shaded in parallel.
+    // Each tile is owned by a single worker, and shades its triangles in submission order,
+    // so the result is identical to that of a single thread.
+    void setThreadCount(u32 thread_count) {
+        jobs.setWorkerCount(thread_count);
+        if (jobs.worker_count > 1 && !tile_bins.triangles) {
+            memory::MonotonicAllocator tiles_allocator{TileBins::GetMemorySize()};
+            tile_bins.allocate(&tiles_allocator);
+        }
+    }
+
+    u32 threadCount() const { return jobs.worker_count; }
+
+    void setDeferredShading(bool on) {
+        deferred_shading = on;
+        if (on && !visibility.triangles) {
+            memory::MonotonicAllocator visibility_allocator{VisibilityBuffer::GetMemorySize()};
+            visibility.allocate(&visibility_allocator);
+        }
+    }
+
     void rasterize(const Viewport &viewport, bool draw_wireframe = false) {
         const Camera &camera = *viewport.camera;
         const Dimensions &dim = viewport.dimensions;
@@ -78,6 +197,7 @@ struct Rasterizer {
         const f32 n = frustum.near_clipping_plane_distance;
         static vec3 world_positions[6], normals[6];
         static vec4 positions[6];
+        static u32 position_sources[6]; // Vertex (in the post-transform cache) of each position, unless clipped
         static vec2 uvs[6], uv_in, uv_out;
         Shaded shaded;
 
@@ -89,29 +209,31 @@ struct Rasterizer {
                 0, 0, projection.shear, 0
         };
         world_to_clip = world_to_view * view_to_clip;
-
-        bool last_UV_taken;
-        f32 dot, t, one_minus_t, one_over_ABC, ABC, ABy, ABx, ACy, ACx, Cdx, Bdx, Cdy, Bdy, du, dv,
-            A, B, B_start, C, C_start, pixel_depth;
-        u32 face_index, vertex_index, face_count, vertex_count, clipped_index, pixel_offset,
-            v1_index, out1_index, in1_index, first_x, last_x,
-            v2_index, out2_index, in2_index, first_y, last_y,
+        if (scene_bvh) scene_bvh->cull(world_to_clip);
+        if (occlusion) occlusion->cull(scene, scene_bvh);
+        if (lod_selection) lod_selection->begin();
+
+        f32 dot, t, one_minus_t, max_w;
+        f64 one_over_ABC;
+        i64 ABC, ABy, ABx, ACy, ACx, X1, Y1, X2, Y2, X3, Y3;
+        u32 face_index, vertex_index, face_count, vertex_count, clipped_index,
+            v1_index, out1_index, in1_index,
+            v2_index, out2_index, in2_index,
             v3_index;
         u8 v1_flags, new_v2num, out1_num, in1_num,
            v2_flags, new_v1num, out2_num, in2_num,
            v3_flags;
 
-        vec2 pixel_min, pixel_max, uv1, uv2, uv3, lastUV, screen_transform;
-        vec3 normal, attr_in, attr_out, new_v1, new_v2, pos1, pos2, pos3, norm1, norm2, norm3, ABCw, ABCp;
-        vec4 v1, v2, v3, *clipped, in1, in2, out1, out2, *position;
+        vec2 pixel_min, pixel_max;
+        vec3 normal, attr_in, attr_out, new_v1, new_v2, pos1, pos2, pos3;
+        vec4 v1, v2, v3, *clipped, in1, in2, out1, out2;
+        RasterTriangle triangle;
 
         vec2 last_pixel_coord{dim.f_width - 1, dim.f_height - 1};
         f32 width = dim.f_width, height = dim.f_height;
-        i32 stride = dim.width;
         if ( viewport.canvas.antialias) {
             screen_transform.x = dim.f_width;
             screen_transform.y = dim.f_height;
-            stride <<= 1;
             width *= 2;
             height *= 2;
             last_pixel_coord = {width - 1, height - 1};
@@ -120,16 +242,27 @@ struct Rasterizer {
             screen_transform.y = dim.h_height;
         }
 
+        // Wireframes are drawn interleaved with the triangles, so they are rasterized in a single thread
+        // (and shaded forward):
+        const bool tiled = jobs.worker_count > 1 && !draw_wireframe;
+        const bool deferred = deferred_shading && !draw_wireframe;
+        active_viewport = &viewport;
+        visibility_pass = deferred;
+        if (tiled) tile_bins.begin((u32)width, (u32)height);
+        if (deferred) visibility.begin((u32)width, (u32)height);
+
         PixelShader pixel_shader;
         shaded.viewing_origin = viewport.camera->position;
 
-        bool mesh_has_normals, mesh_has_uvs, clipping_produced_an_extra_face;
+        bool mesh_has_normals, mesh_has_uvs, mesh_is_welded, clipping_produced_an_extra_face;
         TriangleVertexIndices position_indices, normal_indices, uvs_indices;
-        Pixel *pixel;
-        f32 *depth;
         Mesh *mesh;
         Geometry *geometry = scene.geometries;
         for (u32 geometry_id = 0; geometry_id < scene.counts.geometries; geometry_id++, geometry++) {
+            if ((scene_bvh && !scene_bvh->isVisible(geometry_id)) ||
+                (occlusion && occlusion->isOccluded(geometry_id)))
+                continue;
+
             if (geometry->type == GeometryType_Box)
                 mesh = &cube;
             else if (geometry->type == GeometryType_Mesh)
@@ -137,6 +270,12 @@ struct Rasterizer {
             else
                 continue;
 
+            mesh_lod = lod_selection && mesh->lod_count ? lod_selection->select(geometry_id, *geometry, *mesh, viewport) : nullptr;
+            if (mesh_lod) {
+                setLODMesh(lod_mesh, *mesh, *mesh_lod);
+                mesh = &lod_mesh;
+            }
+
             shaded.geometry = geometry;
             shaded.material = scene.materials + geometry->material_id;
             vertex_count = mesh->vertex_count;
@@ -148,63 +287,27 @@ struct Rasterizer {
             model_to_world_inverted_transposed = model_to_world.inverted().transposed();
 
             // Execute mesh shader and skip this geometry if it got culled:
+            vertex_chunk_count = 0;
+            clip_space_in_streams = false;
+            vertices_listed = false;
+            clusters.face_range_count = 0;
             if (!shaded.material->mesh_shader(*mesh, *this))
                 continue;
 
             // Cull the vertices and skip this geometry if it's entirely outside the view frustum:
+            // Mesh shaders processing vertices through processVertices have them classified already (per chunk).
+            if (!vertex_chunk_count) {
+                classifyVertices(0, vertex_count, vertex_chunks[0]);
+                vertex_chunk_count = 1;
+            }
 
-
-            // Check vertex positions against the frustum:
-            // ----------------------------------------------------
-            // For each vertex, check where it is in relation to the view frustum,
-            // and collect the results into a flags array (single number bit-pattern per-vertex).
-            // While doing so, keep track of which side(s) of the frustum are shared by all vertices.
-            // When done, first analyze the results before continuing to phase 2.
-            // Early bail-out if any of these conditions are met:
-            // A. The entire mesh is outside the frustum - early return with the CULL flag.
-            // B. The entire mesh is inside the frustum - early return with the INSIDE flag.
-            // C. No geometric clipping is needed - early return with the INSIDE flag.
             bool needs_clipping = false;
             bool has_inside = false;
-
             u8 shared_directions = IS_OUT;
-            u8        directions = IS_OUT;
-
-            u8 *flags = vertex_flags;
-            position = clip_space_vertex_positions;
-            for (vertex_index = 0; vertex_index < vertex_count; vertex_index++, position++, flags++) {
-                *flags = CULL;
-
-                if (position->z < 0) {
-                    // Af at lease one vertex is outside the view frustum behind the near clipping plane,
-                    // the geometry needs to be checked for clipping
-                    needs_clipping = true;
-                    *flags = IS_NEAR;
-                    continue;
-                } else directions = position->z > position->w ? IS_FAR : 0;
-
-                if (     position->x >  position->w) directions |= IS_RIGHT;
-                else if (position->x < -position->w) directions |= IS_LEFT;
-
-                if (     position->y >  position->w) directions |= IS_ABOVE;
-                else if (position->y < -position->w) directions |= IS_BELOW;
-
-                if (directions) {
-                    // This vertex is outside of the view frustum.
-                    *flags = directions;
-                    // Note: This flag 'may' get removed from this vertex before the perspective-devide
-                    // (so it won't be skipped, essentially bringing it back) if it's still needed for culling/clipping.
-
-                    // Intersect the shared directions so-far, against this current out-direction:
-                    shared_directions &= directions;
-                    // Note: This will end-up beign zero if either:
-                    // A. All vertices are inside the frustum - no need for face clipping.
-                    // B. All vertices are outside the frustum in at least one direction shared by all.
-                    //   (All vertices are above and/or all vertices on the left and/or all vertices behind, etc.)
-                } else {
-                    has_inside = true;
-                    *flags = IS_NDC;
-                }
+            for (u32 i = 0; i < vertex_chunk_count; i++) {
+                needs_clipping |= vertex_chunks[i].needs_clipping;
+                has_inside     |= vertex_chunks[i].has_inside;
+                shared_directions &= vertex_chunks[i].shared_directions;
             }
 
             if (!has_inside && shared_directions)
@@ -219,10 +322,19 @@ struct Rasterizer {
 
             mesh_has_uvs     = mesh->uvs_count     != 0;
             mesh_has_normals = mesh->normals_count != 0;
+            mesh_is_welded   = mesh->welded;
             face_count = mesh->triangle_count;
 
-            // Check its faces as well and check for clipping cases:
-            for (face_index = 0; face_index < face_count; face_index++) {
+            // Check its faces (of the clusters in view, when culled per cluster) as well and check for clipping cases:
+            FaceRange all_faces{0, face_count};
+            const FaceRange *face_range = clusters.face_range_count ? clusters.face_ranges : &all_faces;
+            const FaceRange *last_face_range = clusters.face_range_count ? face_range + clusters.face_range_count - 1 : face_range;
+            for (face_index = face_range->first; ; face_index++) {
+                if (face_index == face_range->end) {
+                    if (face_range == last_face_range) break;
+                    face_index = (++face_range)->first;
+                }
+
                 // Fetch the index and out-direction flags of each of the face's vertices:
                 position_indices = mesh->vertex_position_indices[face_index];
 
@@ -234,21 +346,28 @@ struct Rasterizer {
                 v2_flags = vertex_flags[v2_index] & IS_OUT;
                 v3_flags = vertex_flags[v3_index] & IS_OUT;
 
-                positions[0] = clip_space_vertex_positions[v1_index];
-                positions[1] = clip_space_vertex_positions[v2_index];
-                positions[2] = clip_space_vertex_positions[v3_index];
+                position_sources[0] = v1_index;
+                position_sources[1] = v2_index;
+                position_sources[2] = v3_index;
+                positions[0] = clipSpacePosition(v1_index);
+                positions[1] = clipSpacePosition(v2_index);
+                positions[2] = clipSpacePosition(v3_index);
 
                 world_positions[0] = world_space_vertex_positions[v1_index];
                 world_positions[1] = world_space_vertex_positions[v2_index];
                 world_positions[2] = world_space_vertex_positions[v3_index];
 
+                // Welded meshes index all their vertex attributes by the position indices:
+                if (mesh_is_welded)
+                    normal_indices = uvs_indices = position_indices;
+
                 if (mesh_has_normals) {
-                    normal_indices = mesh->vertex_normal_indices[face_index];
+                    if (!mesh_is_welded) normal_indices = mesh->vertex_normal_indices[face_index];
                     for (u8 i = 0; i < 3; i++) normals[i] = world_space_vertex_normals[normal_indices.ids[i]];
                 }
 
                 if (mesh_has_uvs) {
-                    uvs_indices = mesh->vertex_uvs_indices[face_index];
+                    if (!mesh_is_welded) uvs_indices = mesh->vertex_uvs_indices[face_index];
                     for (u8 i = 0; i < 3; i++) uvs[i] = mesh->vertex_uvs[uvs_indices.ids[i]];
                 }
 
@@ -339,8 +458,8 @@ struct Rasterizer {
                                     out1_num = 3;
                                 }
                             }
-                            in1  = clip_space_vertex_positions[in1_index];
-                            out1 = clip_space_vertex_positions[out1_index];
+                            in1  = clipSpacePosition(in1_index);
+                            out1 = clipSpacePosition(out1_index);
 
                             // Compute and store the (relative)amount by which the FIRST outside
                             // vertex would need to be moved 'inwards' towards the FIRST inside vertex:
@@ -363,6 +482,7 @@ struct Rasterizer {
                             // Compute the index of the "unshared" position-value(s) of the 'clipped' vertex of this face:
                             clipped_index = out1_num - 1;
                             clipped = positions + clipped_index;
+                            position_sources[clipped_index] = CLIPPED_VERTEX;
 
                             // Compute the new clip-space coordinates of the clipped-vertex:
                             new_v1.z = fast_mul_add(out1.z, one_minus_t, t*in1.z);
@@ -399,13 +519,14 @@ struct Rasterizer {
 
                                 // Compute and store the (relative)amount by which the SECOND outside
                                 // vertex needs to be moved inwards towards the FIRST inside vertex:
-                                out2 = clip_space_vertex_positions[out2_index];
+                                out2 = clipSpacePosition(out2_index);
                                 t = out2.z / (out2.z - in1.z);
                                 one_minus_t = 1 - t;
 
                                 // Compute the index of the "unshared" position-value(s) of the 'clipped' vertex of this face:
                                 clipped_index = out2_num - 1;
                                 clipped = positions + clipped_index;
+                                position_sources[clipped_index] = CLIPPED_VERTEX;
 
                                 // Compute the new clip-space coordinates of the clipped-vertex:
                                 clipped->x = fast_mul_add(out2.x, one_minus_t, t*in1.x);
@@ -439,7 +560,7 @@ struct Rasterizer {
 
                                 // Compute and store the (relative)amount by which the FIRST outside vertex
                                 // needs to be moved inwards towards the SECOND inside vertex:
-                                in2 = clip_space_vertex_positions[in2_index];
+                                in2 = clipSpacePosition(in2_index);
                                 t = out1.z / (out1.z - in2.z);
                                 one_minus_t = 1 - t;
 
@@ -468,6 +589,9 @@ struct Rasterizer {
                                 positions[3] = in2;
                                 positions[3 + new_v1num] = *clipped;
                                 clipped = positions + clipped_index;
+                                position_sources[3] = in2_index;
+                                position_sources[3 + new_v1num] = CLIPPED_VERTEX;
+                                position_sources[clipped_index] = CLIPPED_VERTEX;
 
                                 // Compute the new clip-space coordinates of the clipped-vertex:
                                 clipped->x = new_v2.x;
@@ -509,38 +633,14 @@ struct Rasterizer {
                 // Since geometric clipping is done only against the near clipping plane, there is nothing to clip.
                 // The other sides of the frustum would get raster-clipped later by clamping pixels outside the screen.
 
+                // Fetch the screen-space positions of the face's original vertices from the post-transform cache,
+                // and project the ones that clipping has produced:
                 vertex_count = clipping_produced_an_extra_face ? 6 : 3;
-                position = positions;
-                for (vertex_index = 0; vertex_index < vertex_count; vertex_index++, position++) {
-                    // The perspective divide should finalize normalizing the depth values
-                    // into the 0 -> 1 space, by dividing clip-space 'z' by clip-space 'w'
-                    // (coordinates that came out of the multiplication by the projection matrix)
-                    // screen_z = clip_z / clip_w = Z[i] / W[i]
-                    // However: The rasterizer is going to then need to convert this value
-                    // into a spectrum of values that are all divided by 'clip_w'
-                    // in order to linearly interpolate it there (from vertex values to a pixel value).
-
-                    // Store reciprocals for use in rasterization:
-                    position->w = 1.0f / position->w;
-                    position->x *= position->w;
-                    position->y *= position->w;
-                    position->z *= position->w;
-                    // Scale the normalized screen to the pixel size:
-                    // (from normalized size of -1->1 horizontally and vertically having a width and height of 2)
-                    position->x *= screen_transform.x;
-                    position->y *= -screen_transform.y;
-
-                    // Move the screen up and to the right appropriately,
-                    // such that it goes 0->width horizontally and 0->height vertically:
-                    position->x += screen_transform.x;
-                    position->y += screen_transform.y;
-
-                    // Scale the normalized screen to the pixel size:
-                    // (from normalized size of -1->1 horizontally and vertically having a width and height of 2)
-                    // Then, move the screen up and to the right appropriately,
-                    // such that it goes 0->width horizontally and 0->height vertically:
-//                position->x = fast_mul_add(position->x, screen_transform.x, screen_transform.x);
-//                position->x = fast_mul_add(position->y, -screen_transform.y, screen_transform.y);
+                for (vertex_index = 0; vertex_index < vertex_count; vertex_index++) {
+                    if (position_sources[vertex_index] == CLIPPED_VERTEX)
+                        projectToScreen(positions[vertex_index]);
+                    else
+                        positions[vertex_index] = screen_space_vertex_positions[position_sources[vertex_index]];
                 }
 
                 vertex_count = clipping_produced_an_extra_face ? 2 : 1;
@@ -572,160 +672,120 @@ struct Rasterizer {
                             pixel_max.y < 0)
                             continue;
 
+                        // Cull triangles reaching outside the guard band:
+                        if (pixel_min.x < -RASTER_GUARD_BAND || pixel_max.x > RASTER_GUARD_BAND ||
+                            pixel_min.y < -RASTER_GUARD_BAND || pixel_max.y > RASTER_GUARD_BAND)
+                            continue;
+
                         // Clip the bounds of the triangle to the viewport:
                         if (pixel_min.x < 0) pixel_min.x = 0;
                         if (pixel_min.y < 0) pixel_min.y = 0;
                         if (pixel_max.x > last_pixel_coord.x) pixel_max.x = last_pixel_coord.x;
                         if (pixel_max.y > last_pixel_coord.y) pixel_max.y = last_pixel_coord.y;
 
-                        // Compute area components:
-                        ABy = v2.y - v1.y;
-                        ABx = v2.x - v1.x;
+                        // Snap the vertex positions to sub-pixel fixed-point coordinates:
+                        X1 = (i64)floorf(v1.x * RASTER_SUB_PIXEL_STEPS + 0.5f);
+                        Y1 = (i64)floorf(v1.y * RASTER_SUB_PIXEL_STEPS + 0.5f);
+                        X2 = (i64)floorf(v2.x * RASTER_SUB_PIXEL_STEPS + 0.5f);
+                        Y2 = (i64)floorf(v2.y * RASTER_SUB_PIXEL_STEPS + 0.5f);
+                        X3 = (i64)floorf(v3.x * RASTER_SUB_PIXEL_STEPS + 0.5f);
+                        Y3 = (i64)floorf(v3.y * RASTER_SUB_PIXEL_STEPS + 0.5f);
+
+                        // Compute area components (exactly):
+                        ABy = Y2 - Y1;
+                        ABx = X2 - X1;
 
-                        ACy = v3.y - v1.y;
-                        ACx = v3.x - v1.x;
+                        ACy = Y3 - Y1;
+                        ACx = X3 - X1;
 
                         ABC = ACx*ABy - ACy*ABx;
 
-                        // Cull faces facing backwards:
+                        // Cull faces facing backwards (or that are degenerate once snapped):
                         if (ABC <= 0)
-                            return;
+                            continue;
 
                         // Floor bounds coordinates down to their integral component:
-                        first_x = (u32)pixel_min.x;
-                        first_y = (u32)pixel_min.y;
-                        last_x  = (u32)pixel_max.x;
-                        last_y  = (u32)pixel_max.y;
+                        triangle.first_x = (u32)pixel_min.x;
+                        triangle.first_y = (u32)pixel_min.y;
+                        triangle.last_x  = (u32)pixel_max.x;
+                        triangle.last_y  = (u32)pixel_max.y;
 
-                        pixel_min.x = (f32)first_x;
-                        pixel_min.y = (f32)first_y;
-                        pixel_max.x = (f32)last_x;
-                        pixel_max.y = (f32)last_y;
-
-                        // Compute edge exclusions:
+                        // Set up the edge functions (for coverage):
                         // Drawing: Top-down
                         // Origin: Top-left
-                        // Shadow rules: Top/Left
+                        // Fill rule: Top/Left
                         // Winding: CW (Flipped vertically due to top-down drawing!)
-                    const bool exclude_edge_1 = ABy > 0;
-                    const bool exclude_edge_2 = v2.y > v3.y;
-                    const bool exclude_edge_3 = ACy < 0;
-
-                        // Compute weight constants:
-                        one_over_ABC = 1.0f / ABC;
-
-                        Cdx =  ABy * one_over_ABC;
-                        Bdx = -ACy * one_over_ABC;
-
-                        Cdy = -ABx * one_over_ABC;
-                        Bdy =  ACx * one_over_ABC;
-
-                        // Compute initial areal coordinates for the first pixel center:
-                        pixel_min += vec2{0.5f, 0.5f};
-                        C_start = Cdx*pixel_min.x + Cdy*pixel_min.y + (v1.y*v2.x - v1.x*v2.y) * one_over_ABC;
-                        B_start = Bdx*pixel_min.x + Bdy*pixel_min.y + (v3.y*v1.x - v3.x*v1.y) * one_over_ABC;
-
-                        pos1 = world_positions[v1_index];
-                        pos2 = world_positions[v2_index];
-                        pos3 = world_positions[v3_index];
-
-                        norm1 = normals[v1_index];
-                        norm2 = normals[v2_index];
-                        norm3 = normals[v3_index];
-
-                        uv1 = uvs[v1_index];
-                        uv2 = uvs[v2_index];
-                        uv3 = uvs[v3_index];
-
-                        // Scan the bounds:
-                        for (u32 y = first_y; y <= last_y; y++, C_start += Cdy, B_start += Bdy) {
-                            B = B_start;
-                            C = C_start;
-
-                            last_UV_taken = false;
-
-                            for (u32 x = first_x; x <= last_x; x++, B += Bdx, C += Cdx) {
-                                if (Bdx < 0 && B < 0 ||
-                                    Cdx < 0 && C < 0)
-                                    break;
-
-                                A = 1 - B - C;
-
-                                // Skip the pixel if it's outside:
-                                if (fminf(A, fminf(B, C)) < 0)
-                                    continue;
-
-                                // If the pixel is on a shadow-edge, skip it:
-                                if ((A == 0 && exclude_edge_1) ||
-                                    (B == 0 && exclude_edge_2) ||
-                                    (C == 0 && exclude_edge_3))
-                                    continue;
-
-                                // Cull and test pixel based on its depth:
-                                pixel_offset = viewport.canvas.antialias ? (
-                                        (viewport.dimensions.stride * (y >> 1)) + (x >> 1) + (y & 1) * 2 + (x & 1)
-                                        ) : (
-                                        (viewport.dimensions.stride * y) + x
-                                                );
-                                depth = viewport.canvas.depths + pixel_offset;
-                                pixel = viewport.canvas.pixels + pixel_offset;
-
-                                ABCw = {A*v1.w, B*v2.w, C*v3.w};
-                                shaded.depth = (f64)ABCw.x + (f64)ABCw.y + (f64)ABCw.z;
-                                if (shaded.depth < 0) continue;
-
-                                shaded.depth = 1.0 / shaded.depth;
-                                pixel_depth = (f32)shaded.depth;
-                                if (pixel_depth > *depth)
-                                    continue;
-
-                                ABCp = ABCw * pixel_depth;
-
-                                shaded.position = pos1.scaleAdd(ABCp.x, pos2.scaleAdd(ABCp.y, pos3 * ABCp.z));
-                                if (mesh_has_normals) shaded.normal = norm1.scaleAdd(ABCp.x, norm2.scaleAdd(ABCp.y, norm3 * ABCp.z)).normalized();
-                                if (mesh_has_uvs) {
-                                    shaded.u = fast_mul_add(uv1.u, ABCp.x, (fast_mul_add(uv2.u, ABCp.y, uv3.u * ABCp.z)));
-                                    shaded.v = fast_mul_add(uv1.v, ABCp.x, (fast_mul_add(uv2.v, ABCp.y, uv3.v * ABCp.z)));
-
-                                    if (last_UV_taken) {
-                                        du = shaded.u - lastUV.u;
-                                        dv = shaded.v - lastUV.v;
-                                    } else {
-                                        ABCp.y = B + Bdx;
-                                        ABCp.z = C + Cdx;
-                                        ABCp.x = 1 - ABCp.y - ABCp.z;
-                                        if (ABCp.x < 0) {
-                                            ABCp.y = B - Bdx;
-                                            ABCp.z = C - Cdx;
-                                            ABCp.x = 1 - ABCp.y - ABCp.z;
-                                        }
-                                        ABCp.x *= v1.w;
-                                        ABCp.y *= v2.w;
-                                        ABCp.z *= v3.w;
-                                        ABCp /= (ABCp.x + ABCp.y + ABCp.z);
-                                        du = fast_mul_add(uv1.u, ABCp.x, (fast_mul_add(uv2.u, ABCp.y, uv3.u * ABCp.z))) - shaded.u;
-                                        dv = fast_mul_add(uv1.v, ABCp.x, (fast_mul_add(uv2.v, ABCp.y, uv3.v * ABCp.z))) - shaded.v;
-                                        last_UV_taken = true;
-                                    }
-
-                                    if (du < 0) du = -du;
-                                    if (dv < 0) dv = -dv;
+                        triangle.edge_3.init(ABy, -ABx, X1, Y1); // C: v1 -> v2
+                        triangle.edge_2.init(-ACy, ACx, X1, Y1); // B: v3 -> v1
+                        triangle.edge_1.init(ACy - ABy, ABx - ACx, X2, Y2); // A: v2 -> v3
+
+                        // Compute the areal coordinates' gradients and values at the screen's origin (for interpolation):
+                        one_over_ABC = 1.0 / (f64)ABC;
+
+                        triangle.Cdx = (f32)((f64)triangle.edge_3.step_x * one_over_ABC);
+                        triangle.Bdx = (f32)((f64)triangle.edge_2.step_x * one_over_ABC);
+
+                        triangle.Cdy = (f32)((f64)triangle.edge_3.step_y * one_over_ABC);
+                        triangle.Bdy = (f32)((f64)triangle.edge_2.step_y * one_over_ABC);
+
+                        triangle.C0 = (f32)((f64)(ABx*Y1 - ABy*X1) * one_over_ABC);
+                        triangle.B0 = (f32)((f64)(ACy*X1 - ACx*Y1) * one_over_ABC);
+
+                        triangle.v1 = v1;
+                        triangle.v2 = v2;
+                        triangle.v3 = v3;
+
+                        // Depths are reciprocals of the interpolated w, so the largest w gives the nearest depth:
+                        max_w = v1.w > v2.w ? v1.w : v2.w;
+                        if (v3.w > max_w) max_w = v3.w;
+                        triangle.min_depth = RASTER_MIN_DEPTH_SCALE / max_w;
+
+                        triangle.pos1 = world_positions[v1_index];
+                        triangle.pos2 = world_positions[v2_index];
+                        triangle.pos3 = world_positions[v3_index];
+
+                        if (mesh_has_normals) {
+                            triangle.norm1 = normals[v1_index];
+                            triangle.norm2 = normals[v2_index];
+                            triangle.norm3 = normals[v3_index];
+                        } else
+                            triangle.norm1 = triangle.norm2 = triangle.norm3 = (
+                                    triangle.pos3 - triangle.pos1).cross(triangle.pos2 - triangle.pos1).normalized();
+
+                        triangle.uv1 = uvs[v1_index];
+                        triangle.uv2 = uvs[v2_index];
+                        triangle.uv3 = uvs[v3_index];
+                        triangle.has_uvs = mesh_has_uvs;
+                        if (mesh_has_uvs) {
+                            setUVGradients(triangle);
+                            setTangentFrame(triangle);
+                        }
 
-                                    shaded.uv_area = du*dv;
+                        triangle.material = shaded.material;
+                        triangle.geometry = shaded.geometry;
+                        if (mesh_has_uvs)
+                            requestMipLevels(triangle);
 
-                                    lastUV.u = shaded.u;
-                                    lastUV.v = shaded.v;
-                                }
-                                shaded.coords.x = x;
-                                shaded.coords.y = y;
-                                shaded.color = 0.0f;
-                                shaded.opacity = 1;
-                                pixel_shader(shaded, scene);
-                                viewport.canvas.setPixel((i32)x, (i32)y, shaded.color, shaded.opacity, pixel_depth);
+                        if (deferred) {
+                            if (visibility.isFull()) {
+                                if (tiled) flushTiles();
+                                resolveVisibility();
                             }
+                            triangle.id = visibility.add(triangle);
                         }
+
+                        if (tiled) {
+                            if (tile_bins.isFull(triangle)) flushTiles();
+                            tile_bins.add(triangle);
+                        } else
+                            rasterizeTriangle(triangle, viewport.canvas,
+                                              triangle.first_x, triangle.last_x,
+                                              triangle.first_y, triangle.last_y, shaded);
                     }
                     if (draw_wireframe || !pixel_shader) {
+                        // Lines are drawn in submission order, so anything binned so far needs to be shaded first:
+                        if (tiled) flushTiles();
+                        if (deferred) resolveVisibility();
                         Color color{vertex_index ? Red : White};
                         new_v1 = Vec3(positions[v1_index]);
                         new_v2 = Vec3(positions[v2_index]);
@@ -770,6 +830,787 @@ struct Rasterizer {
                 }
             }
         }
+
+        if (tiled) flushTiles();
+        if (deferred) resolveVisibility();
+        if (occlusion) occlusion->build(viewport.canvas, world_to_clip, screen_transform);
+    }
+
+    // Run a vertex shader over all of a mesh's vertices (positions and normals), in chunks distributed across the workers.
+    // Each chunk's clip-space positions are then classified against the view frustum within the same job
+    // (while they're still in cache), so that rasterize() does not need to go over them again.
+    // For meshes that have vertex streams (with SIMD enabled), vertex shaders are to write clip-space positions
+    // into clip_space_vertex_streams instead of clip_space_vertex_positions (see clip_space_in_streams).
+    // Meshes that have clusters (or meshlets) get culled per cluster first (see ClusterCulling), processing only
+    // the listed vertices when only some of their clusters are in view (see vertices_listed).
+    // Meshes rendered at a level of detail have the vertices used by it listed instead:
+    void processVertices(const Mesh &mesh, VertexShader shader) {
+        processed_mesh = &mesh;
+        vertex_shader = shader;
+        vertices_listed = false;
+        if (mesh_lod && clusters.position_ids) {
+            clusters.list(mesh, *mesh_lod);
+            vertices_listed = true;
+        } else if ((mesh.meshlet_count || mesh.cluster_position_offsets) && clusters.face_ranges) {
+            const mat4 model_to_clip{model_to_world * world_to_clip};
+            bool in_view;
+            if (mesh.meshlet_count) {
+                // Meshlets are culled by their facing in model space, where the camera's position is transformed into
+                // (which only works when the transform keeps the winding order, so with a positive determinant):
+                const vec3 X{Vec3(model_to_world.X)}, Y{Vec3(model_to_world.Y)}, Z{Vec3(model_to_world.Z)};
+                const bool cull_back_faces = active_viewport->frustum.cull_back_faces && X.dot(Y.cross(Z)) > 0;
+                const vec3 camera_position{Vec3(model_to_world_inverted_transposed.transposed() * Vec4(active_viewport->camera->position, 1.0f))};
+                in_view = clusters.cullMeshlets(mesh, model_to_clip, camera_position, cull_back_faces);
+            } else
+                in_view = clusters.cull(mesh, model_to_clip);
+            if (!in_view) {
+                vertex_chunks[0] = {IS_OUT, false, false};
+                vertex_chunk_count = 1;
+                return;
+            }
+            vertices_listed = !clusters.all_in_view;
+        }
+
+        u32 count;
+        if (vertices_listed) {
+            count = clusters.position_count > clusters.normal_count ? clusters.position_count : clusters.normal_count;
+            clip_space_in_streams = false;
+        } else {
+            count = mesh.vertex_count > mesh.normals_count ? mesh.vertex_count : mesh.normals_count;
+            clip_space_in_streams = SIMD_WIDTH > 1 && mesh.vertex_position_streams.x;
+        }
+        vertex_chunk_count = (count + RASTER_VERTEX_CHUNK_SIZE - 1) / RASTER_VERTEX_CHUNK_SIZE;
+        if (!vertex_chunk_count) {
+            vertex_chunks[0] = {IS_OUT, false, false};
+            vertex_chunk_count = 1;
+        } else
+            jobs.run(processVertexChunk, this, vertex_chunk_count);
+    }
+
+    static void processVertexChunk(void *data, u32 job_index, u32 worker_index) {
+        Rasterizer &rasterizer = *(Rasterizer*)data;
+        const Mesh &mesh = *rasterizer.processed_mesh;
+        u32 first_vertex = job_index * RASTER_VERTEX_CHUNK_SIZE;
+        u32 end_vertex = first_vertex + RASTER_VERTEX_CHUNK_SIZE;
+        rasterizer.vertex_shader(mesh, rasterizer, first_vertex, end_vertex);
+
+        u32 vertex_count = rasterizer.vertices_listed ? rasterizer.clusters.position_count : mesh.vertex_count;
+        if (end_vertex > vertex_count) end_vertex = vertex_count;
+        if (first_vertex > end_vertex) first_vertex = end_vertex;
+        rasterizer.classifyVertices(first_vertex, end_vertex, rasterizer.vertex_chunks[job_index]);
+    }
+
+    // Check vertex positions against the frustum:
+    // ----------------------------------------------------
+    // For each vertex, check where it is in relation to the view frustum,
+    // and collect the results into a flags array (single number bit-pattern per-vertex).
+    // While doing so, keep track of which side(s) of the frustum are shared by all vertices.
+    // The results are then summarized into the given chunk, so that rasterize() can bail-out early if:
+    // A. The entire mesh is outside the frustum - the geometry is culled.
+    // B. The entire mesh is inside the frustum - no need for face clipping.
+    // When vertices are listed (see vertices_listed), the range is of the listed ones.
+    void classifyVertices(u32 first_vertex, u32 end_vertex, VertexChunk &chunk) const {
+        chunk.needs_clipping = false;
+        chunk.has_inside = false;
+        chunk.shared_directions = IS_OUT;
+#if SIMD_WIDTH > 1
+        if (clip_space_in_streams) {
+            classifyVertexStreams(first_vertex, end_vertex, chunk);
+            return;
+        }
+#endif
+
+        if (vertices_listed) {
+            const u32 *vertex_id = clusters.position_ids + first_vertex;
+            for (u32 i = first_vertex; i < end_vertex; i++, vertex_id++)
+                classifyVertex(*vertex_id, chunk);
+        } else
+            for (u32 vertex_index = first_vertex; vertex_index < end_vertex; vertex_index++)
+                classifyVertex(vertex_index, chunk);
+    }
+
+    INLINE void classifyVertex(u32 vertex_index, VertexChunk &chunk) const {
+        u8 directions;
+        u8 *flags = vertex_flags + vertex_index;
+        const vec4 *position = clip_space_vertex_positions + vertex_index;
+        *flags = CULL;
+
+        if (position->z < 0) {
+            // Af at lease one vertex is outside the view frustum behind the near clipping plane,
+            // the geometry needs to be checked for clipping
+            chunk.needs_clipping = true;
+            *flags = IS_NEAR;
+            return;
+        } else directions = position->z > position->w ? IS_FAR : 0;
+
+        screen_space_vertex_positions[vertex_index] = *position;
+        projectToScreen(screen_space_vertex_positions[vertex_index]);
+
+        if (     position->x >  position->w) directions |= IS_RIGHT;
+        else if (position->x < -position->w) directions |= IS_LEFT;
+
+        if (     position->y >  position->w) directions |= IS_ABOVE;
+        else if (position->y < -position->w) directions |= IS_BELOW;
+
+        if (directions) {
+            // This vertex is outside of the view frustum.
+            *flags = directions;
+            // Note: This flag 'may' get removed from this vertex before the perspective-devide
+            // (so it won't be skipped, essentially bringing it back) if it's still needed for culling/clipping.
+
+            // Intersect the shared directions so-far, against this current out-direction:
+            chunk.shared_directions &= directions;
+            // Note: This will end-up beign zero if either:
+            // A. All vertices are inside the frustum - no need for face clipping.
+            // B. All vertices are outside the frustum in at least one direction shared by all.
+            //   (All vertices are above and/or all vertices on the left and/or all vertices behind, etc.)
+        } else {
+            chunk.has_inside = true;
+            *flags = IS_NDC;
+        }
+    }
+
+#if SIMD_WIDTH > 1
+    // Same as classifyVertices, for SIMD_WIDTH clip-space positions at a time (read directly from the streams).
+    // Note: The first vertex is assumed to be aligned to SIMD_WIDTH (streams are padded beyond the end vertex).
+    void classifyVertexStreams(u32 first_vertex, u32 end_vertex, VertexChunk &chunk) const {
+        const vec4_streams &streams = clip_space_vertex_streams;
+        const f32_lanes zero = simd::set(0.0f);
+        const f32_lanes one = simd::set(1.0f);
+        const f32_lanes screen_x = simd::set(screen_transform.x);
+        const f32_lanes screen_y = simd::set(screen_transform.y);
+        const f32_lanes minus_screen_y = simd::set(-screen_transform.y);
+        f32_lanes x, y, z, w, minus_w, one_over_w;
+        f32 screen_xs[SIMD_WIDTH], screen_ys[SIMD_WIDTH], screen_zs[SIMD_WIDTH], screen_ws[SIMD_WIDTH];
+        u32 lane_count, valid, near, far, right, left, above, below, bit;
+        u8 directions;
+        u8 *flags = vertex_flags + first_vertex;
+        vec4 *screen_position = screen_space_vertex_positions + first_vertex;
+        for (u32 i = first_vertex; i < end_vertex; i += SIMD_WIDTH, flags += SIMD_WIDTH) {
+            x = simd::load(streams.x + i);
+            y = simd::load(streams.y + i);
+            z = simd::load(streams.z + i);
+            w = simd::load(streams.w + i);
+            minus_w = simd::sub(zero, w);
+
+            lane_count = end_vertex - i < SIMD_WIDTH ? end_vertex - i : SIMD_WIDTH;
+            valid = lane_count == SIMD_WIDTH ? SIMD_ALL_LANES : (1u << lane_count) - 1;
+
+            // Project into the post-transform cache (as in projectToScreen, the results of vertices behind the
+            // near clipping plane are never used):
+            one_over_w = simd::div(one, w);
+            simd::store(screen_xs, simd::add(simd::mul(simd::mul(x, one_over_w), screen_x), screen_x));
+            simd::store(screen_ys, simd::add(simd::mul(simd::mul(y, one_over_w), minus_screen_y), screen_y));
+            simd::store(screen_zs, simd::mul(z, one_over_w));
+            simd::store(screen_ws, one_over_w);
+            for (u32 lane = 0; lane < lane_count; lane++, screen_position++) {
+                screen_position->x = screen_xs[lane];
+                screen_position->y = screen_ys[lane];
+                screen_position->z = screen_zs[lane];
+                screen_position->w = screen_ws[lane];
+            }
+
+            near  = simd::bits(simd::lessThan(z, zero));
+            far   = simd::bits(simd::lessThan(w, z));
+            right = simd::bits(simd::lessThan(w, x));
+            left  = simd::bits(simd::lessThan(x, minus_w)) & ~right;
+            above = simd::bits(simd::lessThan(w, y));
+            below = simd::bits(simd::lessThan(y, minus_w)) & ~above;
+
+            if (!((near | far | right | left | above | below) & valid)) {
+                // All inside (the common case):
+                for (u32 lane = 0; lane < lane_count; lane++) flags[lane] = IS_NDC;
+                chunk.has_inside = true;
+                continue;
+            }
+
+            for (u32 lane = 0; lane < lane_count; lane++) {
+                bit = 1u << lane;
+                if (near & bit) {
+                    chunk.needs_clipping = true;
+                    flags[lane] = IS_NEAR;
+                    continue;
+                }
+
+                directions = (
+                        ((far   & bit) ? IS_FAR   : 0) |
+                        ((right & bit) ? IS_RIGHT : 0) |
+                        ((left  & bit) ? IS_LEFT  : 0) |
+                        ((above & bit) ? IS_ABOVE : 0) |
+                        ((below & bit) ? IS_BELOW : 0)
+                );
+                if (directions) {
+                    flags[lane] = directions;
+                    chunk.shared_directions &= directions;
+                } else {
+                    chunk.has_inside = true;
+                    flags[lane] = IS_NDC;
+                }
+            }
+        }
+    }
+#endif
+
+    // The perspective divide and viewport transform of a clip-space position (in front of the near clipping plane):
+    INLINE void projectToScreen(vec4 &position) const {
+        // The perspective divide should finalize normalizing the depth values
+        // into the 0 -> 1 space, by dividing clip-space 'z' by clip-space 'w'
+        // (coordinates that came out of the multiplication by the projection matrix)
+        // screen_z = clip_z / clip_w = Z[i] / W[i]
+        // However: The rasterizer is going to then need to convert this value
+        // into a spectrum of values that are all divided by 'clip_w'
+        // in order to linearly interpolate it there (from vertex values to a pixel value).
+
+        // Store reciprocals for use in rasterization:
+        position.w = 1.0f / position.w;
+        position.x *= position.w;
+        position.y *= position.w;
+        position.z *= position.w;
+        // Scale the normalized screen to the pixel size:
+        // (from normalized size of -1->1 horizontally and vertically having a width and height of 2)
+        position.x *= screen_transform.x;
+        position.y *= -screen_transform.y;
+
+        // Move the screen up and to the right appropriately,
+        // such that it goes 0->width horizontally and 0->height vertically:
+        position.x += screen_transform.x;
+        position.y += screen_transform.y;
+    }
+
+    INLINE vec4 clipSpacePosition(u32 index) const {
+        if (clip_space_in_streams)
+            return {
+                clip_space_vertex_streams.x[index],
+                clip_space_vertex_streams.y[index],
+                clip_space_vertex_streams.z[index],
+                clip_space_vertex_streams.w[index]
+            };
+
+        return clip_space_vertex_positions[index];
+    }
+
+    // Shade all the triangles binned so far, one tile per job, then empty the bins:
+    void flushTiles() {
+        jobs.run(rasterizeTile, this, tile_bins.active_tile_count);
+        tile_bins.reset();
+    }
+
+    static void rasterizeTile(void *data, u32 job_index, u32 worker_index) {
+        Rasterizer &rasterizer = *(Rasterizer*)data;
+        const TileBins &bins = rasterizer.tile_bins;
+        const Viewport &viewport = *rasterizer.active_viewport;
+
+        const u32 tile_id = bins.active_tile_ids[job_index];
+        const u32 tile_first_x = (tile_id % bins.columns) << RASTER_TILE_SHIFT;
+        const u32 tile_first_y = (tile_id / bins.columns) << RASTER_TILE_SHIFT;
+        const u32 tile_last_x = tile_first_x + RASTER_TILE_SIZE - 1;
+        const u32 tile_last_y = tile_first_y + RASTER_TILE_SIZE - 1;
+
+        Shaded shaded;
+        shaded.viewing_origin = viewport.camera->position;
+
+        for (TileBinChunk *chunk = bins.bins[tile_id].first; chunk; chunk = chunk->next) {
+            for (u32 i = 0; i < chunk->count; i++) {
+                const RasterTriangle &triangle = bins.triangles[chunk->triangle_ids[i]];
+                rasterizer.rasterizeTriangle(triangle, viewport.canvas,
+                                             triangle.first_x > tile_first_x ? triangle.first_x : tile_first_x,
+                                             triangle.last_x  < tile_last_x  ? triangle.last_x  : tile_last_x,
+                                             triangle.first_y > tile_first_y ? triangle.first_y : tile_first_y,
+                                             triangle.last_y  < tile_last_y  ? triangle.last_y  : tile_last_y,
+                                             shaded);
+            }
+        }
+    }
+
+    // Scan the given bounds of a set-up triangle, shading and writing out every pixel that it covers.
+    // Every pixel is computed from the triangle's constants alone (nothing is carried over between pixels),
+    // so the result for a pixel does not depend on the bounds that it was scanned within.
+    // Coverage is determined exactly (using the integer edge functions) as a span of pixels per row.
+    void rasterizeTriangle(const RasterTriangle &triangle, const Canvas &canvas,
+                           u32 first_x, u32 last_x, u32 first_y, u32 last_y, Shaded &shaded) const {
+        const u32 stride = canvas.dimensions.stride;
+        const bool antialias = canvas.antialias != NoAA;
+
+        f32 B_row, C_row, pixel_y;
+        u32 pixel_offset, span_first_x, span_last_x;
+        i64 span_first, span_last;
+
+        // Edge function values at the first pixel of the current row (stepped incrementally):
+        i64 edge_1_row = triangle.edge_1.valueAt(first_x, first_y);
+        i64 edge_2_row = triangle.edge_2.valueAt(first_x, first_y);
+        i64 edge_3_row = triangle.edge_3.valueAt(first_x, first_y);
+
+        // Skip the whole triangle if it's behind every depth within the bounds:
+        const bool hierarchical_depth = canvas.depth_tiles != nullptr;
+        if (hierarchical_depth && isOccluded(triangle.min_depth, canvas, first_x, last_x, first_y, last_y))
+            return;
+
+        const u32 depth_tile_columns = hierarchical_depth ? canvas.depthTileColumns() : 0;
+        DepthTile *depth_tiles_row, *depth_tile;
+
+        shaded.material = triangle.material;
+        shaded.geometry = triangle.geometry;
+        if (!triangle.has_uvs)
+            shaded.u = shaded.v = shaded.uv_area = 0;
+        setTriangleMipLevels(triangle, shaded);
+
+#if SIMD_WIDTH > 1
+        // Test depth for SIMD_WIDTH pixels at a time, then shade just the ones that passed:
+        const f32_lanes zero = simd::set(0.0f);
+        const f32_lanes one = simd::set(1.0f);
+        const f32_lanes lane_indices = simd::laneIndices();
+        const f32_lanes Bdx_lanes = simd::set(triangle.Bdx);
+        const f32_lanes Cdx_lanes = simd::set(triangle.Cdx);
+        const f32_lanes w1 = simd::set(triangle.v1.w);
+        const f32_lanes w2 = simd::set(triangle.v2.w);
+        const f32_lanes w3 = simd::set(triangle.v3.w);
+
+        f32_lanes A, B, C, B_row_lanes, C_row_lanes, pixel_x, depths, current_depths;
+        f32 lanes_A[SIMD_WIDTH], lanes_B[SIMD_WIDTH], lanes_C[SIMD_WIDTH], lanes_depths[SIMD_WIDTH], lanes_current_depths[SIMD_WIDTH];
+        u32 visible, pending, lane;
+
+        // Textures that the pixel shader samples (at the interpolated uvs) are sampled ahead of it,
+        // for all the visible pixels of a group at once (unused lanes keep sampling valid uvs of earlier pixels):
+        const u8 texture_count = triangle.material->texture_count;
+        const u8 presampled_textures = triangle.has_uvs ? (triangle.material->presampled_textures & (
+                texture_count < MATERIAL_PRESAMPLED_TEXTURE_SLOTS ? (1 << texture_count) - 1 : (1 << MATERIAL_PRESAMPLED_TEXTURE_SLOTS) - 1
+                )) : 0;
+        Shaded lanes_shaded[SIMD_WIDTH];
+        f32 lanes_us[SIMD_WIDTH] = {}, lanes_vs[SIMD_WIDTH] = {}, lanes_uv_areas[SIMD_WIDTH] = {}, lanes_pixel_depths[SIMD_WIDTH];
+        if (presampled_textures)
+            for (lane = 0; lane < SIMD_WIDTH; lane++) {
+                lanes_shaded[lane].viewing_origin = shaded.viewing_origin;
+                lanes_shaded[lane].material = shaded.material;
+                lanes_shaded[lane].geometry = shaded.geometry;
+                lanes_shaded[lane].presampled_textures = presampled_textures;
+                setTriangleMipLevels(triangle, lanes_shaded[lane]);
+            }
+#else
+        f32 A, B, C, pixel_x, pixel_depth;
+#endif
+
+        pixel_y = (f32)first_y + 0.5f;
+        for (u32 y = first_y; y <= last_y; y++, pixel_y += 1.0f,
+                edge_1_row += triangle.edge_1.step_y,
+                edge_2_row += triangle.edge_2.step_y,
+                edge_3_row += triangle.edge_3.step_y) {
+
+            // Clip the row to the span of pixels that are inside all 3 edges:
+            span_first = 0;
+            span_last = last_x - first_x;
+            triangle.edge_1.clipSpan(edge_1_row, span_first, span_last);
+            triangle.edge_2.clipSpan(edge_2_row, span_first, span_last);
+            triangle.edge_3.clipSpan(edge_3_row, span_first, span_last);
+            if (span_first > span_last)
+                continue;
+
+            span_first_x = first_x + (u32)span_first;
+            span_last_x  = first_x + (u32)span_last;
+
+            B_row = fast_mul_add(triangle.Bdy, pixel_y, triangle.B0);
+            C_row = fast_mul_add(triangle.Cdy, pixel_y, triangle.C0);
+
+            depth_tiles_row = hierarchical_depth ? (canvas.depth_tiles + (y >> DEPTH_TILE_SHIFT) * depth_tile_columns) : nullptr;
+
+#if SIMD_WIDTH > 1
+            B_row_lanes = simd::set(B_row);
+            C_row_lanes = simd::set(C_row);
+
+            // Groups of pixels are aligned to SIMD_WIDTH, so that each one falls within a single depth tile:
+            for (u32 x = span_first_x & ~(u32)(SIMD_WIDTH - 1); x <= span_last_x; x += SIMD_WIDTH) {
+                if (depth_tiles_row) {
+                    depth_tile = depth_tiles_row + (x >> DEPTH_TILE_SHIFT);
+                    if (depth_tile->max_depth < triangle.min_depth)
+                        continue;
+                }
+
+                visible = span_last_x - x < SIMD_WIDTH - 1 ? (1u << (span_last_x - x + 1)) - 1 : SIMD_ALL_LANES;
+                if (x < span_first_x)
+                    visible &= ~((1u << (span_first_x - x)) - 1);
+
+                pixel_x = simd::add(simd::set((f32)x + 0.5f), lane_indices);
+                B = simd::mulAdd(Bdx_lanes, pixel_x, B_row_lanes);
+                C = simd::mulAdd(Cdx_lanes, pixel_x, C_row_lanes);
+                A = simd::sub(simd::sub(one, B), C);
+
+                // Cull and test pixels based on their depth (laid out as in Canvas::setPixel):
+                depths = simd::reciprocalOfSum(simd::mul(A, w1), simd::mul(B, w2), simd::mul(C, w3));
+                if (antialias) {
+                    for (lane = 0; lane < SIMD_WIDTH; lane++) {
+                        if (visible & (1u << lane)) {
+                            pixel_offset = (stride * (y >> 1) + ((x + lane) >> 1)) * 4 + (2 * (y & 1)) + ((x + lane) & 1);
+                            lanes_current_depths[lane] = canvas.depths[pixel_offset];
+                        } else
+                            lanes_current_depths[lane] = 0;
+                    }
+                    current_depths = simd::load(lanes_current_depths);
+                } else if (x + SIMD_WIDTH > canvas.dimensions.width) {
+                    // The last group of a row reaches past its end (into the next row, possibly being drawn to by
+                    // another thread), so its depths are only loaded for the lanes that are within it:
+                    for (lane = 0; lane < SIMD_WIDTH; lane++)
+                        lanes_current_depths[lane] = visible & (1u << lane) ? canvas.depths[stride * y + x + lane] : 0;
+                    current_depths = simd::load(lanes_current_depths);
+                } else
+                    current_depths = simd::load(canvas.depths + stride * y + x);
+
+                visible &= simd::bits(simd::and_(
+                        simd::greaterEqual(depths, zero),
+                        simd::notGreater(depths, current_depths)));
+                if (visible) {
+                    if (visibility_pass) {
+                        simd::store(lanes_depths, depths);
+                        while (visible) {
+                            lane = lowestBitIndex(visible);
+                            visible &= visible - 1;
+                            writeVisibility(triangle, canvas, x + lane, y, lanes_depths[lane]);
+                        }
+                    } else if (presampled_textures) {
+                        simd::store(lanes_A, A);
+                        simd::store(lanes_B, B);
+                        simd::store(lanes_C, C);
+                        pending = visible;
+                        while (pending) {
+                            lane = lowestBitIndex(pending);
+                            pending &= pending - 1;
+                            lanes_pixel_depths[lane] = interpolatePixel(triangle, x + lane, y, lanes_A[lane], lanes_B[lane], lanes_C[lane], lanes_shaded[lane]);
+                            lanes_us[lane] = lanes_shaded[lane].u;
+                            lanes_vs[lane] = lanes_shaded[lane].v;
+                            lanes_uv_areas[lane] = lanes_shaded[lane].uv_area;
+                        }
+                        presampleTextures(*triangle.material, presampled_textures, lanes_us, lanes_vs, lanes_uv_areas, lanes_shaded, shaded);
+                        while (visible) {
+                            lane = lowestBitIndex(visible);
+                            visible &= visible - 1;
+                            shadeInterpolatedPixel(canvas, lanes_shaded[lane], lanes_pixel_depths[lane]);
+                        }
+                    } else {
+                        simd::store(lanes_A, A);
+                        simd::store(lanes_B, B);
+                        simd::store(lanes_C, C);
+                        while (visible) {
+                            lane = lowestBitIndex(visible);
+                            visible &= visible - 1;
+                            shadePixel(triangle, canvas, x + lane, y, lanes_A[lane], lanes_B[lane], lanes_C[lane], shaded);
+                        }
+                    }
+                    if (depth_tiles_row)
+                        depth_tile->dirty = true;
+                }
+            }
+#else
+            for (u32 x = span_first_x; x <= span_last_x; x++) {
+                if (depth_tiles_row) {
+                    depth_tile = depth_tiles_row + (x >> DEPTH_TILE_SHIFT);
+                    if (depth_tile->max_depth < triangle.min_depth) {
+                        x |= DEPTH_TILE_SIZE - 1; // Skip to the last pixel of the depth tile
+                        continue;
+                    }
+                }
+
+                pixel_x = (f32)x + 0.5f;
+                B = fast_mul_add(triangle.Bdx, pixel_x, B_row);
+                C = fast_mul_add(triangle.Cdx, pixel_x, C_row);
+                A = 1 - B - C;
+
+                // Cull and test pixel based on its depth (laid out as in Canvas::setPixel):
+                pixel_offset = antialias ? (
+                        (stride * (y >> 1) + (x >> 1)) * 4 + (2 * (y & 1)) + (x & 1)
+                        ) : (
+                        stride * y + x
+                        );
+
+                pixel_depth = (f32)(1.0 / ((f64)(A*triangle.v1.w) + (f64)(B*triangle.v2.w) + (f64)(C*triangle.v3.w)));
+                if (pixel_depth < 0 || pixel_depth > canvas.depths[pixel_offset])
+                    continue;
+
+                if (visibility_pass)
+                    writeVisibility(triangle, canvas, x, y, pixel_depth);
+                else
+                    shadePixel(triangle, canvas, x, y, A, B, C, shaded);
+                if (depth_tiles_row)
+                    depth_tile->dirty = true;
+            }
+#endif
+        }
+    }
+
+    // Whether every depth within the given bounds is nearer than the given depth, according to the depth tiles:
+    static bool isOccluded(f32 depth, const Canvas &canvas, u32 first_x, u32 last_x, u32 first_y, u32 last_y) {
+        // All the tiles are visited (even once one is found to not be occluding), refreshing any dirty ones,
+        // so that the depth tiles are up to date while scanning the triangle:
+        bool occluded = true;
+        for (u32 y = first_y & ~(u32)(DEPTH_TILE_SIZE - 1); y <= last_y; y += DEPTH_TILE_SIZE)
+            for (u32 x = first_x & ~(u32)(DEPTH_TILE_SIZE - 1); x <= last_x; x += DEPTH_TILE_SIZE)
+                if (canvas.depthTileBound(x, y) >= depth)
+                    occluded = false;
+
+        return occluded;
+    }
+
+    // Shade all the pixels recorded in the visibility buffer, one tile per job, then empty it:
+    void resolveVisibility() {
+        jobs.run(resolveTile, this, visibility.columns * visibility.rows);
+        visibility.triangle_count = 0;
+    }
+
+    static void resolveTile(void *data, u32 job_index, u32 worker_index) {
+        Rasterizer &rasterizer = *(Rasterizer*)data;
+        VisibilityBuffer &visibility = rasterizer.visibility;
+        const Viewport &viewport = *rasterizer.active_viewport;
+        const Canvas &canvas = viewport.canvas;
+
+        const u32 first_x = (job_index % visibility.columns) << RASTER_TILE_SHIFT;
+        const u32 first_y = (job_index / visibility.columns) << RASTER_TILE_SHIFT;
+        const u32 end_x = first_x + RASTER_TILE_SIZE < visibility.width  ? first_x + RASTER_TILE_SIZE : visibility.width;
+        const u32 end_y = first_y + RASTER_TILE_SIZE < visibility.height ? first_y + RASTER_TILE_SIZE : visibility.height;
+
+        Shaded shaded;
+        shaded.viewing_origin = viewport.camera->position;
+
+        f32 A, B, C, pixel_y;
+        u32 offset, triangle_id, shaded_triangle_id = 0;
+        for (u32 y = first_y; y < end_y; y++) {
+            pixel_y = (f32)y + 0.5f;
+            for (u32 x = first_x; x < end_x; x++) {
+                offset = depthOffset(canvas, x, y);
+                triangle_id = visibility.pixels[offset];
+                if (!triangle_id)
+                    continue;
+
+                visibility.pixels[offset] = 0;
+                const RasterTriangle &triangle = visibility.triangles[triangle_id - 1];
+
+                // Reconstruct the areal coordinates exactly as when scanning:
+                B = fast_mul_add(triangle.Bdx, (f32)x + 0.5f, fast_mul_add(triangle.Bdy, pixel_y, triangle.B0));
+                C = fast_mul_add(triangle.Cdx, (f32)x + 0.5f, fast_mul_add(triangle.Cdy, pixel_y, triangle.C0));
+                A = 1 - B - C;
+
+                if (triangle_id != shaded_triangle_id) {
+                    shaded_triangle_id = triangle_id;
+                    shaded.material = triangle.material;
+                    shaded.geometry = triangle.geometry;
+                    if (!triangle.has_uvs)
+                        shaded.u = shaded.v = shaded.uv_area = 0;
+                    rasterizer.setTriangleMipLevels(triangle, shaded);
+                }
+
+                // The pixel is the nearest one, so it gets written over whatever is there (as it would when shading forward):
+                canvas.depths[offset] = INFINITY;
+                rasterizer.shadePixel(triangle, canvas, x, y, A, B, C, shaded);
+            }
+        }
+    }
+
+    // Offset of a pixel's depth (laid out as in Canvas::setPixel):
+    static INLINE u32 depthOffset(const Canvas &canvas, u32 x, u32 y) {
+        return canvas.antialias != NoAA ? (
+                (canvas.dimensions.stride * (y >> 1) + (x >> 1)) * 4 + (2 * (y & 1)) + (x & 1)
+                ) : (
+                canvas.dimensions.stride * y + x
+                );
+    }
+
+    // Record a triangle as the one visible at a pixel that passed the depth test.
+    // On a tie in depth the earlier triangle is kept, as Canvas::setPixel does when shading forward:
+    INLINE void writeVisibility(const RasterTriangle &triangle, const Canvas &canvas, u32 x, u32 y, f32 depth) const {
+        u32 offset = depthOffset(canvas, x, y);
+        if (depth == canvas.depths[offset])
+            return;
+
+        canvas.depths[offset] = depth;
+        visibility.pixels[offset] = triangle.id + 1;
+    }
+
+    // Set the screen-space gradients of Q, U and V (the interpolated 1/w, u/w and v/w, all linear in screen space),
+    // from which interpolatePixel() derives the uv derivatives of a pixel as (Ux - u*Qx) / Q and so on.
+    // The uv area of a pixel (the determinant of its uv derivatives) then works out to K / Q^3, with K being the
+    // determinant of the values and gradients of Q, U and V (which is constant across the triangle).
+    // As Q is bounded by its values at the vertices, so are the uv areas (padded for the rounding of Q):
+    static void setUVGradients(RasterTriangle &triangle) {
+        const vec4 &v1 = triangle.v1;
+        const vec4 &v2 = triangle.v2;
+        const vec4 &v3 = triangle.v3;
+        const vec2 &uv1 = triangle.uv1;
+        const vec2 &uv2 = triangle.uv2;
+        const vec2 &uv3 = triangle.uv3;
+        const f32 Adx = -triangle.Bdx - triangle.Cdx;
+        const f32 Ady = -triangle.Bdy - triangle.Cdy;
+        triangle.Qdx = Adx*v1.w + triangle.Bdx*v2.w + triangle.Cdx*v3.w;
+        triangle.Qdy = Ady*v1.w + triangle.Bdy*v2.w + triangle.Cdy*v3.w;
+        triangle.Udx = Adx*v1.w*uv1.u + triangle.Bdx*v2.w*uv2.u + triangle.Cdx*v3.w*uv3.u;
+        triangle.Udy = Ady*v1.w*uv1.u + triangle.Bdy*v2.w*uv2.u + triangle.Cdy*v3.w*uv3.u;
+        triangle.Vdx = Adx*v1.w*uv1.v + triangle.Bdx*v2.w*uv2.v + triangle.Cdx*v3.w*uv3.v;
+        triangle.Vdy = Ady*v1.w*uv1.v + triangle.Bdy*v2.w*uv2.v + triangle.Cdy*v3.w*uv3.v;
+
+        // Evaluated at the first vertex:
+        const f64 Q = v1.w;
+        const f64 U = Q * uv1.u;
+        const f64 V = Q * uv1.v;
+        const f64 Qdx = triangle.Qdx, Qdy = triangle.Qdy;
+        const f64 Udx = triangle.Udx, Udy = triangle.Udy;
+        const f64 Vdx = triangle.Vdx, Vdy = triangle.Vdy;
+        const f64 K = Q*(Udx*Vdy - Vdx*Udy) - U*(Qdx*Vdy - Vdx*Qdy) + V*(Qdx*Udy - Udx*Qdy);
+        triangle.uv_area_scale = (f32)(K < 0 ? -K : K);
+
+        f32 min_Q = v1.w < v2.w ? v1.w : v2.w;
+        f32 max_Q = v1.w > v2.w ? v1.w : v2.w;
+        if (v3.w < min_Q) min_Q = v3.w;
+        if (v3.w > max_Q) max_Q = v3.w;
+        if (!(min_Q > 0)) {
+            triangle.min_uv_area = 0;
+            triangle.max_uv_area = INFINITY;
+            return;
+        }
+
+        triangle.min_uv_area = triangle.uv_area_scale / (max_Q * max_Q * max_Q) * 0.98f;
+        triangle.max_uv_area = triangle.uv_area_scale / (min_Q * min_Q * min_Q) * 1.02f;
+    }
+
+    // Set the (world-space) directions along which u and v increase across a triangle, solving for the combinations
+    // of its edges that span a unit step of u and of v. Triangles whose uvs are degenerate get an arbitrary frame:
+    static void setTangentFrame(RasterTriangle &triangle) {
+        const vec3 edge1 = triangle.pos2 - triangle.pos1;
+        const vec3 edge2 = triangle.pos3 - triangle.pos1;
+        const f32 du1 = triangle.uv2.u - triangle.uv1.u;
+        const f32 dv1 = triangle.uv2.v - triangle.uv1.v;
+        const f32 du2 = triangle.uv3.u - triangle.uv1.u;
+        const f32 dv2 = triangle.uv3.v - triangle.uv1.v;
+        const f32 determinant = du1*dv2 - du2*dv1;
+        if (determinant == 0) {
+            triangle.tangent = edge1.normalized();
+            triangle.bitangent = edge2.normalized();
+            return;
+        }
+
+        triangle.tangent   = (edge1*dv2 - edge2*dv1).normalized();
+        triangle.bitangent = (edge2*du1 - edge1*du2).normalized();
+        if (determinant < 0) {
+            triangle.tangent   = -triangle.tangent;
+            triangle.bitangent = -triangle.bitangent;
+        }
+    }
+
+    // Record the finest mip levels that the textures of a triangle's material could be sampled at across it,
+    // for streaming them in (see TextureResidency):
+    INLINE void requestMipLevels(const RasterTriangle &triangle) const {
+        const Material &material = *triangle.material;
+        for (u8 slot = 0; slot < material.texture_count; slot++)
+            if (material.atlas_textures & (1 << slot))
+                material.atlas_texture_slots[slot].requestMipLevels(triangle.min_uv_area);
+            else
+                scene.textures[material.texture_ids[slot]].requestMipLevels(triangle.min_uv_area);
+    }
+
+    // Resolve the mip levels that the first texture slots of a triangle's material are sampled from (if any),
+    // for all the pixels of the triangle at once (see Shaded::triangle_mip_levels):
+    INLINE void setTriangleMipLevels(const RasterTriangle &triangle, Shaded &shaded) const {
+        shaded.triangle_mip_level_textures = 0;
+        if (!triangle.has_uvs)
+            return;
+
+        const Material &material = *triangle.material;
+        for (u8 slot = 0; slot < MATERIAL_PRESAMPLED_TEXTURE_SLOTS && slot < material.texture_count; slot++) {
+            i32 mip_level = material.atlas_textures & (1 << slot) ?
+                    material.atlas_texture_slots[slot].mipLevelWithin(triangle.min_uv_area, triangle.max_uv_area) :
+                    scene.textures[material.texture_ids[slot]].mipLevelWithin(triangle.min_uv_area, triangle.max_uv_area);
+            if (mip_level >= 0) {
+                shaded.triangle_mip_levels[slot] = (u8)mip_level;
+                shaded.triangle_mip_level_textures |= 1 << slot;
+            }
+        }
+    }
+
+    // Interpolate the vertex attributes at a covered pixel (given its areal coordinates), then shade and write it out:
+    INLINE void shadePixel(const RasterTriangle &triangle, const Canvas &canvas, u32 x, u32 y, f32 A, f32 B, f32 C, Shaded &shaded) const {
+        f32 pixel_depth = interpolatePixel(triangle, x, y, A, B, C, shaded);
+        shadeInterpolatedPixel(canvas, shaded, pixel_depth);
+    }
+
+    INLINE void shadeInterpolatedPixel(const Canvas &canvas, Shaded &shaded, f32 pixel_depth) const {
+        shaded.color = 0.0f;
+        shaded.opacity = 1;
+        shaded.material->pixel_shader(shaded, scene);
+        canvas.setPixel(shaded.coords.x, shaded.coords.y, shaded.color, shaded.opacity, pixel_depth);
+    }
+
+    // Interpolate the vertex attributes at a covered pixel (given its areal coordinates), returning its depth:
+    INLINE f32 interpolatePixel(const RasterTriangle &triangle, u32 x, u32 y, f32 A, f32 B, f32 C, Shaded &shaded) const {
+        const vec4 &v1 = triangle.v1;
+        const vec4 &v2 = triangle.v2;
+        const vec4 &v3 = triangle.v3;
+        const vec2 &uv1 = triangle.uv1;
+        const vec2 &uv2 = triangle.uv2;
+        const vec2 &uv3 = triangle.uv3;
+
+        vec3 ABCw{A*v1.w, B*v2.w, C*v3.w};
+        shaded.depth = 1.0 / ((f64)ABCw.x + (f64)ABCw.y + (f64)ABCw.z);
+        f32 pixel_depth = (f32)shaded.depth;
+        vec3 ABCp = ABCw * pixel_depth;
+
+        shaded.position = triangle.pos1.scaleAdd(ABCp.x, triangle.pos2.scaleAdd(ABCp.y, triangle.pos3 * ABCp.z));
+        shaded.normal = triangle.norm1.scaleAdd(ABCp.x, triangle.norm2.scaleAdd(ABCp.y, triangle.norm3 * ABCp.z)).normalized();
+        if (triangle.has_uvs) {
+            shaded.u = fast_mul_add(uv1.u, ABCp.x, (fast_mul_add(uv2.u, ABCp.y, uv3.u * ABCp.z)));
+            shaded.v = fast_mul_add(uv1.v, ABCp.x, (fast_mul_add(uv2.v, ABCp.y, uv3.v * ABCp.z)));
+
+            // The uv derivatives along the screen's axes and the uv area that they span (see setUVGradients):
+            shaded.dUVdx.u = (triangle.Udx - shaded.u * triangle.Qdx) * pixel_depth;
+            shaded.dUVdx.v = (triangle.Vdx - shaded.v * triangle.Qdx) * pixel_depth;
+            shaded.dUVdy.u = (triangle.Udy - shaded.u * triangle.Qdy) * pixel_depth;
+            shaded.dUVdy.v = (triangle.Vdy - shaded.v * triangle.Qdy) * pixel_depth;
+            shaded.uv_area = triangle.uv_area_scale * pixel_depth * pixel_depth * pixel_depth;
+            shaded.tangent = triangle.tangent;
+            shaded.bitangent = triangle.bitangent;
+        }
+        shaded.coords.x = (i32)x;
+        shaded.coords.y = (i32)y;
+
+        return pixel_depth;
+    }
+
+#if SIMD_WIDTH > 1
+    // Sample the given texture slots of a material for SIMD_WIDTH interpolated pixels at once,
+    // handing the samples over to their pixel shaders (see sampleTexture):
+    INLINE void presampleTextures(const Material &material, u8 slots, const f32 *us, const f32 *vs, const f32 *uv_areas,
+                                  Shaded *lanes_shaded, const Shaded &triangle_shaded) const {
+        f32 lanes_R[SIMD_WIDTH], lanes_G[SIMD_WIDTH], lanes_B[SIMD_WIDTH];
+        f32_lanes R, G, B;
+        for (u8 slot = 0; slot < MATERIAL_PRESAMPLED_TEXTURE_SLOTS; slot++) {
+            if (!(slots & (1 << slot)))
+                continue;
+
+            const bool triangle_mip_level = triangle_shaded.triangle_mip_level_textures & (1 << slot);
+            if (material.atlas_textures & (1 << slot)) {
+                const AtlasTexture &atlas_texture = material.atlas_texture_slots[slot];
+                if (triangle_mip_level)
+                    atlas_texture.sample(triangle_shaded.triangle_mip_levels[slot], simd::load(us), simd::load(vs), R, G, B);
+                else if (atlas_texture.page->isAnisotropic()) {
+                    for (u32 lane = 0; lane < SIMD_WIDTH; lane++)
+                        lanes_shaded[lane].texture_samples[slot] = atlas_texture.sample(us[lane], vs[lane], uv_areas[lane],
+                                                                                        lanes_shaded[lane].dUVdx, lanes_shaded[lane].dUVdy);
+                    continue;
+                } else
+                    atlas_texture.sample(simd::load(us), simd::load(vs), simd::load(uv_areas), R, G, B);
+            } else {
+                const Texture &texture = scene.textures[material.texture_ids[slot]];
+                if (triangle_mip_level)
+                    texture.mips[triangle_shaded.triangle_mip_levels[slot]].sample(simd::load(us), simd::load(vs), R, G, B);
+                else if (texture.isAnisotropic()) {
+                    // Lanes take differing numbers of probes, so are sampled one at a time:
+                    for (u32 lane = 0; lane < SIMD_WIDTH; lane++)
+                        lanes_shaded[lane].texture_samples[slot] = texture.sample(us[lane], vs[lane], uv_areas[lane],
+                                                                                  lanes_shaded[lane].dUVdx, lanes_shaded[lane].dUVdy);
+                    continue;
+                } else
+                    texture.sample(simd::load(us), simd::load(vs), simd::load(uv_areas), R, G, B);
+            }
+            simd::store(lanes_R, R);
+            simd::store(lanes_G, G);
+            simd::store(lanes_B, B);
+            for (u32 lane = 0; lane < SIMD_WIDTH; lane++)
+                lanes_shaded[lane].texture_samples[slot] = Pixel{lanes_R[lane], lanes_G[lane], lanes_B[lane], 1.0f};
+        }
     }
+#endif
 };
 CubeMesh Rasterizer::cube;
\ No newline at end of file
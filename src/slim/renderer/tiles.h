@@ -0,0 +1,193 @@
+#pragma once
+
+#include "../math/vec4.h"
+#include "../scene/material.h"
+
+#define RASTER_TILE_SHIFT 6
+#define RASTER_TILE_SIZE (1 << RASTER_TILE_SHIFT)
+#define RASTER_TILE_COLUMNS (((MAX_WIDTH  * 2) >> RASTER_TILE_SHIFT) + 1)
+#define RASTER_TILE_ROWS    (((MAX_HEIGHT * 2) >> RASTER_TILE_SHIFT) + 1)
+#define RASTER_TILE_COUNT (RASTER_TILE_COLUMNS * RASTER_TILE_ROWS)
+
+#define RASTER_TILE_BIN_CHUNK_SIZE 62
+#define RASTER_TILE_BIN_CHUNK_COUNT 16384
+#define RASTER_TILE_BIN_TRIANGLE_COUNT 65536
+
+// Vertex positions are snapped to a fixed-point grid with this many bits of sub-pixel precision:
+#define RASTER_SUB_PIXEL_BITS 4
+#define RASTER_SUB_PIXEL_STEPS (1 << RASTER_SUB_PIXEL_BITS)
+
+// Triangles reaching further away from the screen than this (in pixels) are culled,
+// as their edge functions could overflow 64 bits (the snapped coordinates need to fit within 29 bits):
+#define RASTER_GUARD_BAND ((f32)(1 << (29 - RASTER_SUB_PIXEL_BITS)))
+
+// The nearest depth of a triangle is scaled by this, to account for rounding in the depths computed per pixel:
+#define RASTER_MIN_DEPTH_SCALE 0.999f
+
+// An integer edge function that is non-negative for pixels inside the edge, evaluated at pixel centers.
+// The top-left fill rule is baked into it, so that pixels exactly on an edge shared by 2 triangles
+// are covered by exactly one of them.
+struct RasterEdge {
+    i64 origin; // At the center of pixel (0, 0)
+    i64 step_x; // Per pixel to the right
+    i64 step_y; // Per pixel down
+
+    // Initialize from the gradient of the edge function (in sub-pixel units),
+    // and a (snapped) point on the edge:
+    void init(i64 dx, i64 dy, i64 x, i64 y) {
+        step_x = dx * RASTER_SUB_PIXEL_STEPS;
+        step_y = dy * RASTER_SUB_PIXEL_STEPS;
+        origin = dx * (RASTER_SUB_PIXEL_STEPS / 2 - x) + dy * (RASTER_SUB_PIXEL_STEPS / 2 - y);
+
+        // Only left edges (inside is to their right) and top edges (horizontal, inside is below) own their pixels:
+        if (!(dx > 0 || (dx == 0 && dy > 0)))
+            origin -= 1;
+    }
+
+    INLINE i64 valueAt(u32 x, u32 y) const {
+        return origin + step_x * (i64)x + step_y * (i64)y;
+    }
+
+    // Narrow down a span of pixels to the ones inside this edge.
+    // The span is given as a range of offsets [first, last] from a pixel where the edge function has the given value.
+    // An empty span ends up with last < first.
+    INLINE void clipSpan(i64 value, i64 &first, i64 &last) const {
+        if (step_x > 0) {
+            if (value < 0) {
+                i64 offset = (step_x - 1 - value) / step_x;
+                if (offset > first) first = offset;
+            }
+        } else if (step_x < 0) {
+            if (value < 0)
+                last = -1;
+            else {
+                i64 offset = value / -step_x;
+                if (offset < last) last = offset;
+            }
+        } else if (value < 0)
+            last = -1;
+    }
+};
+
+// A post-clip screen-space triangle that has been set up for scanning:
+struct RasterTriangle {
+    vec4 v1, v2, v3; // x, y: screen coordinates, z: depth, w: 1/w
+    vec3 pos1, pos2, pos3, norm1, norm2, norm3;
+    vec2 uv1, uv2, uv3;
+
+    // Integer edge functions (determining coverage) of the edges opposite to each vertex:
+    RasterEdge edge_1, edge_2, edge_3;
+
+    // Gradients of the areal coordinates (for interpolation) and their values at the screen origin:
+    f32 Bdx, Bdy, B0;
+    f32 Cdx, Cdy, C0;
+
+    // A (conservative) bound that no depth on the triangle is nearer than:
+    f32 min_depth;
+
+    // Screen-space gradients of the interpolated 1/w, u/w and v/w (for uv derivatives), and the constant that
+    // the uv area of a pixel is a multiple of (see Rasterizer::setUVGradients):
+    f32 Qdx, Qdy, Udx, Udy, Vdx, Vdy, uv_area_scale;
+
+    // (Conservative) bounds of the uv areas of the pixels of the triangle (for picking mip levels per triangle):
+    f32 min_uv_area, max_uv_area;
+
+    // Unit directions along which u and v increase across the triangle (for normal mapping, see setTangentFrame):
+    vec3 tangent, bitangent;
+
+    u32 first_x, last_x, first_y, last_y;
+    u32 id; // Within the visibility buffer (when shading is deferred)
+    bool has_uvs;
+
+    Material *material;
+    Geometry *geometry;
+};
+
+struct TileBinChunk {
+    TileBinChunk *next;
+    u32 count;
+    u32 triangle_ids[RASTER_TILE_BIN_CHUNK_SIZE];
+};
+
+struct TileBin {
+    TileBinChunk *first, *last;
+};
+
+// Sorts triangles into screen tiles while preserving their submission order within each tile.
+// Each tile can then be shaded independently, producing exactly what shading them in order would.
+struct TileBins {
+    RasterTriangle *triangles{nullptr};
+    TileBinChunk *chunks{nullptr};
+    TileBin *bins{nullptr};
+    u32 *active_tile_ids{nullptr};
+
+    u32 triangle_count{0};
+    u32 chunk_count{0};
+    u32 active_tile_count{0};
+    u32 columns{0}, rows{0};
+
+    static u64 GetMemorySize() {
+        return (
+                sizeof(RasterTriangle) * RASTER_TILE_BIN_TRIANGLE_COUNT +
+                sizeof(TileBinChunk) * RASTER_TILE_BIN_CHUNK_COUNT +
+                (sizeof(TileBin) + sizeof(u32)) * RASTER_TILE_COUNT
+        );
+    }
+
+    void allocate(memory::MonotonicAllocator *memory_allocator) {
+        triangles       = (RasterTriangle*)memory_allocator->allocate(sizeof(RasterTriangle) * RASTER_TILE_BIN_TRIANGLE_COUNT);
+        chunks          = (TileBinChunk*  )memory_allocator->allocate(sizeof(TileBinChunk)   * RASTER_TILE_BIN_CHUNK_COUNT);
+        bins            = (TileBin*       )memory_allocator->allocate(sizeof(TileBin)        * RASTER_TILE_COUNT);
+        active_tile_ids = (u32*           )memory_allocator->allocate(sizeof(u32)            * RASTER_TILE_COUNT);
+        for (u32 i = 0; i < RASTER_TILE_COUNT; i++) bins[i].first = bins[i].last = nullptr;
+    }
+
+    void begin(u32 width, u32 height) {
+        columns = (width  + RASTER_TILE_SIZE - 1) >> RASTER_TILE_SHIFT;
+        rows    = (height + RASTER_TILE_SIZE - 1) >> RASTER_TILE_SHIFT;
+        reset();
+    }
+
+    void reset() {
+        for (u32 i = 0; i < active_tile_count; i++) bins[active_tile_ids[i]].first = bins[active_tile_ids[i]].last = nullptr;
+        active_tile_count = triangle_count = chunk_count = 0;
+    }
+
+    INLINE bool isFull(const RasterTriangle &triangle) const {
+        u32 tile_count = (
+                ((triangle.last_x >> RASTER_TILE_SHIFT) - (triangle.first_x >> RASTER_TILE_SHIFT) + 1) *
+                ((triangle.last_y >> RASTER_TILE_SHIFT) - (triangle.first_y >> RASTER_TILE_SHIFT) + 1)
+        );
+        return triangle_count == RASTER_TILE_BIN_TRIANGLE_COUNT || (chunk_count + tile_count) > RASTER_TILE_BIN_CHUNK_COUNT;
+    }
+
+    // Note: Assumes there is room for the triangle (see isFull()).
+    void add(const RasterTriangle &triangle) {
+        u32 triangle_id = triangle_count++;
+        triangles[triangle_id] = triangle;
+
+        u32 first_column = triangle.first_x >> RASTER_TILE_SHIFT;
+        u32 last_column  = triangle.last_x  >> RASTER_TILE_SHIFT;
+        u32 first_row    = triangle.first_y >> RASTER_TILE_SHIFT;
+        u32 last_row     = triangle.last_y  >> RASTER_TILE_SHIFT;
+        for (u32 row = first_row; row <= last_row; row++) {
+            for (u32 column = first_column; column <= last_column; column++) {
+                u32 tile_id = row * columns + column;
+                TileBin &bin = bins[tile_id];
+                if (!bin.last || bin.last->count == RASTER_TILE_BIN_CHUNK_SIZE) {
+                    TileBinChunk *chunk = chunks + chunk_count++;
+                    chunk->next = nullptr;
+                    chunk->count = 0;
+                    if (bin.last)
+                        bin.last->next = chunk;
+                    else {
+                        bin.first = chunk;
+                        active_tile_ids[active_tile_count++] = tile_id;
+                    }
+                    bin.last = chunk;
+                }
+                bin.last->triangle_ids[bin.last->count++] = triangle_id;
+            }
+        }
+    }
+};
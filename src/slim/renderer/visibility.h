@@ -0,0 +1,44 @@
+#pragma once
+
+#include "./tiles.h"
+
+#define VISIBILITY_BUFFER_TRIANGLE_COUNT 65536
+#define VISIBILITY_BUFFER_PIXEL_COUNT (MAX_WINDOW_SIZE * 4)
+
+// For deferred shading: Holds the set-up triangles of a pass, and the one that is visible at each pixel.
+// Pixel entries are laid out as depths are in the canvas, holding a triangle's id + 1 (0 meaning no triangle).
+// Entries are reset as they are resolved, so the buffer is empty in between passes.
+struct VisibilityBuffer {
+    RasterTriangle *triangles{nullptr};
+    u32 *pixels{nullptr};
+
+    u32 triangle_count{0};
+    u32 columns{0}, rows{0}; // Of raster tiles (resolved one per job)
+    u32 width{0}, height{0};
+
+    static u64 GetMemorySize() {
+        return sizeof(RasterTriangle) * VISIBILITY_BUFFER_TRIANGLE_COUNT + sizeof(u32) * VISIBILITY_BUFFER_PIXEL_COUNT;
+    }
+
+    // Note: The allocated memory is assumed to be zeroed (as freshly acquired from the OS):
+    void allocate(memory::MonotonicAllocator *memory_allocator) {
+        triangles = (RasterTriangle*)memory_allocator->allocate(sizeof(RasterTriangle) * VISIBILITY_BUFFER_TRIANGLE_COUNT);
+        pixels    = (u32*           )memory_allocator->allocate(sizeof(u32)            * VISIBILITY_BUFFER_PIXEL_COUNT);
+    }
+
+    void begin(u32 raster_width, u32 raster_height) {
+        width = raster_width;
+        height = raster_height;
+        columns = (width  + RASTER_TILE_SIZE - 1) >> RASTER_TILE_SHIFT;
+        rows    = (height + RASTER_TILE_SIZE - 1) >> RASTER_TILE_SHIFT;
+        triangle_count = 0;
+    }
+
+    INLINE bool isFull() const { return triangle_count == VISIBILITY_BUFFER_TRIANGLE_COUNT; }
+
+    // Note: Assumes there is room for the triangle (see isFull()).
+    INLINE u32 add(const RasterTriangle &triangle) {
+        triangles[triangle_count] = triangle;
+        return triangle_count++;
+    }
+};
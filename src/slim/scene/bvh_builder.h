@@ -137,13 +137,11 @@ struct BVHBuilder {
         return memory_size;
     }
 
-    BVHBuilder(Mesh *meshes, u32 mesh_count, memory::MonotonicAllocator *memory_allocator) {
-        u32 max_leaf_node_count = 0;
-        if (mesh_count)
-            for (u32 m = 0; m < mesh_count; m++)
-                if (meshes[m].triangle_count > max_leaf_node_count)
-                    max_leaf_node_count = meshes[m].triangle_count;
+    BVHBuilder(Mesh *meshes, u32 mesh_count, memory::MonotonicAllocator *memory_allocator) :
+            BVHBuilder{GetMaxTriangleCount(meshes, mesh_count), memory_allocator} {}
 
+    // For building BVHs over any kind of leaves (given as nodes, see build):
+    BVHBuilder(u32 max_leaf_node_count, memory::MonotonicAllocator *memory_allocator) {
         iterations = (BVHBuildIteration*)memory_allocator->allocate(sizeof(BVHBuildIteration) * max_leaf_node_count);
         nodes      = (BVHNode*          )memory_allocator->allocate(sizeof(BVHNode)           * max_leaf_node_count);
         node_ids   = (u32*              )memory_allocator->allocate(sizeof(u32)                 * max_leaf_node_count);
@@ -159,6 +157,15 @@ struct BVHBuilder {
         }
     }
 
+    static u32 GetMaxTriangleCount(Mesh *meshes, u32 mesh_count) {
+        u32 max_triangle_count = 0;
+        for (u32 m = 0; m < mesh_count; m++)
+            if (meshes[m].triangle_count > max_triangle_count)
+                max_triangle_count = meshes[m].triangle_count;
+
+        return max_triangle_count;
+    }
+
     u32 splitNode(BVHNode &node, u32 start, u32 end, BVH &bvh) {
         u32 N = end - start;
         u32 *ids = node_ids + start;
@@ -195,6 +202,9 @@ struct BVHBuilder {
         return start + chosen_partition_axis.left_node_count;
     }
 
+    // Build a BVH over the first N of the builder's nodes (each given its bounds and the id of its leaf as its
+    // first_index, with node_ids listing them in order), listing the ids of the leaves of each leaf node in leaf_ids
+    // (from the leaf node's first_index on):
     void build(BVH &bvh, u32 N, u16 max_leaf_size) {
         bvh.height = 1;
         bvh.node_count = 1;
@@ -265,6 +275,26 @@ struct BVHBuilder {
         root.aabb = left_node.aabb + right_node.aabb;
     }
 
+    // Reorder the per-triangle indices of the last build into the order of its leaves, in place
+    // (following each cycle of the permutation, marking the moved ones in node_ids):
+    void orderByLeaves(TriangleVertexIndices *indices, u32 N) {
+        for (u32 i = 0; i < N; i++) node_ids[i] = 0;
+        for (u32 start = 0; start < N; start++) {
+            if (node_ids[start])
+                continue;
+
+            TriangleVertexIndices first = indices[start];
+            u32 i = start;
+            node_ids[i] = 1;
+            while (leaf_ids[i] != start) {
+                indices[i] = indices[leaf_ids[i]];
+                i = leaf_ids[i];
+                node_ids[i] = 1;
+            }
+            indices[i] = first;
+        }
+    }
+
     void buildMesh(Mesh &mesh) {
         for (u32 i = 0; i < mesh.triangle_count; i++) {
             TriangleVertexIndices &indices = mesh.vertex_position_indices[i];
@@ -304,9 +334,17 @@ struct BVHBuilder {
 
         build(mesh.bvh, mesh.triangle_count, MAX_TRIANGLES_PER_MESH_RTREE_NODE);
 
+        // Store the vertex indices in the order of the leaves as well (see Mesh::leaf_ordered):
+        orderByLeaves(mesh.vertex_position_indices, mesh.triangle_count);
+        if (!mesh.welded) {
+            if (mesh.normals_count) orderByLeaves(mesh.vertex_normal_indices, mesh.triangle_count);
+            if (mesh.uvs_count)     orderByLeaves(mesh.vertex_uvs_indices,    mesh.triangle_count);
+        }
+        mesh.leaf_ordered = true;
+
         for (u32 i = 0; i < mesh.triangle_count; i++) {
             Triangle &triangle = mesh.triangles[i];
-            TriangleVertexIndices &indices = mesh.vertex_position_indices[leaf_ids[i]];
+            TriangleVertexIndices &indices = mesh.vertex_position_indices[i];
             const vec3 &v1 = mesh.vertex_positions[indices.ids[0]];
             const vec3 &v2 = mesh.vertex_positions[indices.ids[1]];
             const vec3 &v3 = mesh.vertex_positions[indices.ids[2]];
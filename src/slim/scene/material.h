@@ -15,6 +15,9 @@
 #define PHONG 2
 #define BLINN 4
 
+#define MATERIAL_PRESAMPLED_TEXTURE_SLOTS 2
+#define MATERIAL_ATLAS_TEXTURE_SLOTS 4
+
 enum BRDFType {
     phong,
     ggx
@@ -25,7 +28,7 @@ struct Shaded;
 struct Scene;
 struct Mesh;
 typedef void (*PixelShader)(Shaded &shaded, const Scene &scene);
-typedef u8 (  *MeshShader )(const Mesh &mesh, const Rasterizer &rasterizer);
+typedef u8 (  *MeshShader )(const Mesh &mesh, Rasterizer &rasterizer);
 
 struct Material {
     PixelShader pixel_shader;
@@ -37,6 +40,20 @@ struct Material {
     vec3 diffuse, specular;
     u8 texture_ids[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
+    // A bit per texture slot (of the first MATERIAL_PRESAMPLED_TEXTURE_SLOTS) that the pixel shader samples at the
+    // shaded uv coordinates. The rasterizer then samples those ahead of shading, for SIMD_WIDTH pixels at a time:
+    u8 presampled_textures{0};
+
+    // A bit per texture slot (of the first MATERIAL_ATLAS_TEXTURE_SLOTS) that is sampled from a page of a texture atlas
+    // (pre-resolved along with the uv scale and offset of its rectangle), instead of by its texture id:
+    u8 atlas_textures{0};
+    AtlasTexture atlas_texture_slots[MATERIAL_ATLAS_TEXTURE_SLOTS];
+
+    void setAtlasTexture(u8 slot, const AtlasTexture &atlas_texture) {
+        atlas_texture_slots[slot] = atlas_texture;
+        atlas_textures |= 1 << slot;
+    }
+
     Material(PixelShader pixel_shader,
              MeshShader mesh_shader,
              u8 texture_count = 0,
@@ -79,9 +96,20 @@ struct Shaded {
     vec3 position, normal, viewing_direction, viewing_origin, reflected_direction, light_direction, diffuse;
     vec2i coords;
     f32 opacity, u, v, uv_area;
+    vec2 dUVdx, dUVdy; // Derivatives of the uvs along the screen's x and y axes
+    vec3 tangent, bitangent; // Along which u and v increase (the rest of the tangent frame around the normal)
     f64 depth;
     Material *material;
     Geometry *geometry;
+
+    // Samples of the material's textures taken ahead of shading (a bit per texture slot, see Material):
+    Pixel texture_samples[MATERIAL_PRESAMPLED_TEXTURE_SLOTS];
+    u8 presampled_textures{0};
+
+    // Mip levels that the first texture slots are sampled from across the whole triangle, for the slots that have
+    // one (a bit per texture slot), sparing their per-pixel level selection (see Texture::mipLevelWithin):
+    u8 triangle_mip_levels[MATERIAL_PRESAMPLED_TEXTURE_SLOTS];
+    u8 triangle_mip_level_textures{0};
 };
 
 
@@ -2,6 +2,7 @@
 
 #include "../math/vec2.h"
 #include "../math/mat3.h"
+#include "../math/streams.h"
 
 #include "./bvh.h"
 
@@ -21,6 +22,34 @@ struct Triangle {
     vec3 position, normal, U, V;
 };
 
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// A run of a mesh's triangles (from first_triangle on) using at most MESHLET_MAX_VERTICES vertex positions
+// (and normals), listed from first_position (and first_normal) on in the mesh's meshlet position (and normal) ids.
+// Meshlets get culled as a whole by their bounding sphere, and by their normal cone: The triangles all face away
+// from any point from which the direction to the cone's apex is within the cone (at most cone_cutoff away from its
+// axis, as a cosine). The cutoff is above 1 for meshlets whose triangles face too many ways to ever all face away.
+struct Meshlet {
+    vec3 center;
+    f32 radius;
+    vec3 cone_apex;
+    vec3 cone_axis;
+    f32 cone_cutoff;
+    u32 first_triangle, triangle_count;
+    u32 first_position, position_count;
+    u32 first_normal, normal_count;
+};
+
+// A simplified version of a mesh (a level of detail): Its triangles (from first_triangle on, in the mesh's LOD vertex
+// indices) use only some of the mesh's vertices, listed from first_position (and first_normal) on in the mesh's LOD
+// position (and normal) ids. The error bounds how far (in model space) its surface strays from the mesh's.
+struct MeshLOD {
+    f32 error;
+    u32 first_triangle, triangle_count;
+    u32 first_position, position_count;
+    u32 first_normal, normal_count;
+};
 
 struct Mesh {
     AABB aabb;
@@ -37,12 +66,52 @@ struct Mesh {
 
     EdgeVertexIndices *edge_vertex_indices{nullptr};
 
+    // Optional structure-of-arrays copies of the vertex positions and normals (for batched SIMD transformation):
+    vec3_streams vertex_position_streams;
+    vec3_streams vertex_normal_streams;
+
     u32 triangle_count{0};
     u32 vertex_count{0};
     u32 edge_count{0};
     u32 normals_count{0};
     u32 uvs_count{0};
 
+    // Welded meshes index all vertex attributes with a single index per triangle corner (each unique
+    // position/normal/uv combination being a vertex of its own). Normal and uv counts are then either 0 or
+    // the vertex count, and the normal and uv indices alias the position indices:
+    bool welded{false};
+
+    // Leaf-ordered meshes store their triangles' vertex indices in the order of the leaves of their BVH (as obj2mesh
+    // does), so that the triangles of each leaf node are the ones from its first_index on.
+    // Those can also have clusters (see allocateClusters): The vertex positions and normals used by the triangles
+    // of each leaf node, listed from the node's offset on (for transforming only those of the leaves in view):
+    bool leaf_ordered{false};
+    u32 *cluster_position_offsets{nullptr}, *cluster_position_ids{nullptr};
+    u32 *cluster_normal_offsets{nullptr}, *cluster_normal_ids{nullptr};
+
+    // Optional meshlets (see Meshlet and MeshletBuilder), culled instead of the leaves of the BVH when present.
+    // For welded meshes, normals are indexed by the position ids:
+    Meshlet *meshlets{nullptr};
+    u32 *meshlet_position_ids{nullptr};
+    u32 *meshlet_normal_ids{nullptr};
+    u32 meshlet_count{0};
+    u32 meshlet_position_id_count{0};
+    u32 meshlet_normal_id_count{0};
+
+    // Optional levels of detail (see MeshLOD), from the most detailed to the least, picked per geometry when rendering
+    // (see LODSelection). Welded meshes index all vertex attributes of their LOD triangles with the position indices,
+    // and their normals by the position ids:
+    MeshLOD *lods{nullptr};
+    TriangleVertexIndices *lod_vertex_position_indices{nullptr};
+    TriangleVertexIndices *lod_vertex_normal_indices{nullptr};
+    TriangleVertexIndices *lod_vertex_uvs_indices{nullptr};
+    u32 *lod_position_ids{nullptr};
+    u32 *lod_normal_ids{nullptr};
+    u32 lod_count{0};
+    u32 lod_triangle_count{0};
+    u32 lod_position_id_count{0};
+    u32 lod_normal_id_count{0};
+
     Mesh() = default;
 
     Mesh(u32 triangle_count,
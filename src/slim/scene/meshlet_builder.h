@@ -0,0 +1,186 @@
+#pragma once
+
+#include "./mesh.h"
+
+// Partitions a mesh's triangles into meshlets (see Meshlet), gathering them greedily in their order and starting
+// a new meshlet whenever a triangle would not fit, or would spread the facings of the meshlet's triangles too far
+// from their average for its normal cone to be of use for culling. Triangles of leaf-ordered meshes are spatially
+// coherent in their order, so the meshlets end up compact.
+
+// The smallest cosine between the facing of any triangle of a meshlet and their average (its cone's axis), for it to
+// get a cone (see setBounds):
+#define MESHLET_MIN_CONE_DOT 0.1f
+
+// Meshlets are first counted (see count) so that their memory can be allocated, then built (see build).
+struct MeshletBuilder {
+    u32 positions[MESHLET_MAX_VERTICES];
+    u32 normals[MESHLET_MAX_VERTICES];
+    vec3 triangle_normals[MESHLET_MAX_TRIANGLES]; // Normalized (or zero for degenerate triangles)
+    u32 position_count, normal_count, first_triangle, triangle_count;
+    vec3 facing; // The sum of the triangle normals
+
+    void count(Mesh &mesh) {
+        mesh.meshlets = nullptr;
+        partition(mesh);
+    }
+
+    // Note: Assumes the mesh's meshlet memory was allocated for the counts (see count and allocateMeshlets):
+    void build(Mesh &mesh) {
+        partition(mesh);
+    }
+
+private:
+    static u32 countNew(const u32 *ids, u32 count, const TriangleVertexIndices &triangle) {
+        u32 new_count = 0;
+        for (u8 corner = 0; corner < 3; corner++) {
+            bool found = false;
+            for (u32 i = 0; i < count && !found; i++) found = ids[i] == triangle.ids[corner];
+            for (u8 i = 0; i < corner && !found; i++) found = triangle.ids[i] == triangle.ids[corner];
+            if (!found) new_count++;
+        }
+        return new_count;
+    }
+
+    static void add(u32 *ids, u32 &count, const TriangleVertexIndices &triangle) {
+        for (u32 id : triangle.ids) {
+            bool found = false;
+            for (u32 i = 0; i < count && !found; i++) found = ids[i] == id;
+            if (!found) ids[count++] = id;
+        }
+    }
+
+    void partition(Mesh &mesh) {
+        const bool separate_normals = mesh.normals_count && !mesh.welded;
+        mesh.meshlet_count = mesh.meshlet_position_id_count = mesh.meshlet_normal_id_count = 0;
+        position_count = normal_count = first_triangle = triangle_count = 0;
+        facing = 0.0f;
+        for (u32 t = 0; t < mesh.triangle_count; t++) {
+            const TriangleVertexIndices &position_indices = mesh.vertex_position_indices[t];
+            vec3 normal = triangleNormal(mesh, t);
+            if (normal.nonZero()) normal = normal.normalized();
+            bool fits = triangle_count < MESHLET_MAX_TRIANGLES &&
+                        position_count + countNew(positions, position_count, position_indices) <= MESHLET_MAX_VERTICES &&
+                        keepsCone(normal);
+            if (fits && separate_normals)
+                fits = normal_count + countNew(normals, normal_count, mesh.vertex_normal_indices[t]) <= MESHLET_MAX_VERTICES;
+            if (!fits) {
+                finish(mesh);
+                first_triangle = t;
+            }
+
+            add(positions, position_count, position_indices);
+            if (separate_normals) add(normals, normal_count, mesh.vertex_normal_indices[t]);
+            facing += normal;
+            triangle_normals[triangle_count++] = normal;
+        }
+        if (triangle_count) finish(mesh);
+    }
+
+    // Whether the triangles gathered so far would still get a cone along with a triangle of the given normal:
+    bool keepsCone(const vec3 &normal) const {
+        if (!normal.nonZero() || !triangle_count)
+            return true;
+
+        vec3 axis = facing + normal;
+        if (!axis.nonZero())
+            return false;
+
+        axis = axis.normalized();
+        if (normal.dot(axis) <= MESHLET_MIN_CONE_DOT)
+            return false;
+
+        for (u32 i = 0; i < triangle_count; i++)
+            if (triangle_normals[i].nonZero() && triangle_normals[i].dot(axis) <= MESHLET_MIN_CONE_DOT)
+                return false;
+
+        return true;
+    }
+
+    void finish(Mesh &mesh) {
+        const bool separate_normals = mesh.normals_count && !mesh.welded;
+        if (mesh.meshlets) {
+            Meshlet &meshlet = mesh.meshlets[mesh.meshlet_count];
+            meshlet.first_triangle = first_triangle;
+            meshlet.triangle_count = triangle_count;
+            meshlet.first_position = mesh.meshlet_position_id_count;
+            meshlet.position_count = position_count;
+            for (u32 i = 0; i < position_count; i++) mesh.meshlet_position_ids[meshlet.first_position + i] = positions[i];
+            if (separate_normals) {
+                meshlet.first_normal = mesh.meshlet_normal_id_count;
+                meshlet.normal_count = normal_count;
+                for (u32 i = 0; i < normal_count; i++) mesh.meshlet_normal_ids[meshlet.first_normal + i] = normals[i];
+            } else {
+                meshlet.first_normal = meshlet.first_position;
+                meshlet.normal_count = mesh.normals_count ? position_count : 0;
+            }
+            setBounds(mesh, meshlet);
+        }
+
+        mesh.meshlet_count++;
+        mesh.meshlet_position_id_count += position_count;
+        if (separate_normals) mesh.meshlet_normal_id_count += normal_count;
+        position_count = normal_count = triangle_count = 0;
+        facing = 0.0f;
+    }
+
+    void setBounds(const Mesh &mesh, Meshlet &meshlet) const {
+        AABB aabb{INFINITY, -INFINITY};
+        for (u32 i = 0; i < position_count; i++) {
+            const vec3 &position = mesh.vertex_positions[positions[i]];
+            aabb.min = minimum(aabb.min, position);
+            aabb.max = maximum(aabb.max, position);
+        }
+        meshlet.center = (aabb.min + aabb.max) * 0.5f;
+        meshlet.radius = 0;
+        for (u32 i = 0; i < position_count; i++) {
+            f32 distance = (mesh.vertex_positions[positions[i]] - meshlet.center).length();
+            if (distance > meshlet.radius) meshlet.radius = distance;
+        }
+
+        // The cone's axis is the average direction the triangles face (as Triangle::normal does, see BVHBuilder),
+        // and its apex is pulled back along it far enough for the planes of all of them to be in front of it:
+        meshlet.cone_apex = meshlet.center;
+        meshlet.cone_axis = 0.0f;
+        meshlet.cone_cutoff = 2;
+        vec3 axis;
+        for (u32 t = first_triangle; t < first_triangle + triangle_count; t++) {
+            vec3 normal = triangleNormal(mesh, t);
+            if (normal.nonZero()) axis += normal.normalized();
+        }
+        if (!axis.nonZero())
+            return;
+
+        axis = axis.normalized();
+        f32 min_dot = 1;
+        f32 max_t = 0;
+        for (u32 t = first_triangle; t < first_triangle + triangle_count; t++) {
+            vec3 normal = triangleNormal(mesh, t);
+            if (!normal.nonZero())
+                continue;
+
+            normal = normal.normalized();
+            f32 d = normal.dot(axis);
+            if (d < min_dot) min_dot = d;
+            if (d > 0) {
+                f32 t_to_plane = (meshlet.center - mesh.vertex_positions[mesh.vertex_position_indices[t].v1]).dot(normal) / d;
+                if (t_to_plane > max_t) max_t = t_to_plane;
+            }
+        }
+
+        // Triangles facing too many ways (spreading beyond about 84 degrees from the axis) are never culled together:
+        if (min_dot <= MESHLET_MIN_CONE_DOT)
+            return;
+
+        meshlet.cone_axis = axis;
+        meshlet.cone_apex = meshlet.center - axis * max_t;
+        meshlet.cone_cutoff = sqrtf(1 - min_dot * min_dot);
+    }
+
+    static vec3 triangleNormal(const Mesh &mesh, u32 t) {
+        const TriangleVertexIndices &indices = mesh.vertex_position_indices[t];
+        const vec3 &v1 = mesh.vertex_positions[indices.v1];
+        const vec3 &v2 = mesh.vertex_positions[indices.v2];
+        const vec3 &v3 = mesh.vertex_positions[indices.v3];
+        return (v3 - v1).cross(v2 - v1);
+    }
+};
@@ -79,7 +79,7 @@ struct Scene {
         memory::MonotonicAllocator temp_allocator;
         u32 capacity = 0;
 
-        if (counts.textures) capacity += getTotalMemoryForTextures(texture_files, counts.textures);
+        if (counts.textures && texture_files) capacity += getTotalMemoryForTextures(texture_files, counts.textures);
         if (meshes && mesh_files && counts.meshes) {
             for (u32 i = 0; i < counts.meshes; i++)
                 meshes[i] = Mesh{};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "./scene.h"
+#include "./bvh_builder.h"
+
+// The planes bounding the view frustum in the space that the given matrix transforms into clip space
+// (see Rasterizer::classifyVertices), each given as the coefficients of a combination of the matrix's rows that is
+// non-negative inside of it: Left, right, below, above, near and far.
+INLINE void getFrustumPlanes(const mat4 &to_clip, vec4 *planes) {
+    const vec4 &X = to_clip.X, &Y = to_clip.Y, &Z = to_clip.Z, &W = to_clip.W;
+    const vec4 row_x{X.x, Y.x, Z.x, W.x};
+    const vec4 row_y{X.y, Y.y, Z.y, W.y};
+    const vec4 row_z{X.z, Y.z, Z.z, W.z};
+    const vec4 row_w{X.w, Y.w, Z.w, W.w};
+    planes[0] = row_w + row_x;
+    planes[1] = row_w - row_x;
+    planes[2] = row_w + row_y;
+    planes[3] = row_w - row_y;
+    planes[4] = row_z;
+    planes[5] = row_w - row_z;
+}
+
+// Whether the bounds are not entirely outside any of the given planes, clearing the planes they're entirely inside of:
+INLINE bool intersectsFrustum(const AABB &aabb, const vec4 *planes, u8 &plane_mask) {
+    for (u8 i = 0; i < 6; i++) {
+        if (!(plane_mask & (1 << i)))
+            continue;
+
+        const vec4 &plane = planes[i];
+        const f32 farthest = plane.w + plane.x * (plane.x > 0 ? aabb.max.x : aabb.min.x) +
+                                       plane.y * (plane.y > 0 ? aabb.max.y : aabb.min.y) +
+                                       plane.z * (plane.z > 0 ? aabb.max.z : aabb.min.z);
+        if (farthest < 0)
+            return false;
+
+        const f32 nearest = plane.w + plane.x * (plane.x > 0 ? aabb.min.x : aabb.max.x) +
+                                      plane.y * (plane.y > 0 ? aabb.min.y : aabb.max.y) +
+                                      plane.z * (plane.z > 0 ? aabb.min.z : aabb.max.z);
+        if (nearest >= 0)
+            plane_mask &= ~(1 << i);
+    }
+
+    return true;
+}
+
+// A BVH over the world-space bounds of a scene's geometries (the ones that get rasterized: boxes and meshes),
+// for culling whole subtrees of them against the view frustum before any of their vertices are processed.
+// Moving a geometry (changing its Transform) requires refitting the BVH for it (see refit), which only updates
+// the bounds along its path up to the root. Nodes keep their geometries when refitted, so after large changes
+// (or once bounds got loose) the BVH can be rebuilt instead (see build).
+
+#define SCENE_BVH_MAX_LEAF_SIZE 4
+#define SCENE_BVH_NO_NODE 0xFFFFFFFF
+
+struct SceneBVH {
+    BVH bvh;
+    BVHBuilder *builder;
+    AABB *geometry_aabbs;  // World-space bounds of each geometry
+    u32 *geometry_ids;     // Of the geometries of each leaf node (from its first_index on)
+    u32 *leaf_node_ids;    // Of each geometry (SCENE_BVH_NO_NODE for the ones that are not rasterized)
+    u32 *parent_ids;       // Of each node
+    u32 *node_stack;       // Of nodes to visit while culling, along with the planes they are yet to be tested against
+    u8 *plane_mask_stack;
+    u32 *visible_passes;   // Of each geometry: The last culling pass that found it to intersect the view frustum
+    u32 pass{0};
+    u32 geometry_count{0};
+    u32 visible_count{0};  // Of the last culling pass
+
+    static u64 GetMemorySize(u32 geometry_count) {
+        return sizeof(BVHBuilder) + BVHBuilder::getSizeInBytes(geometry_count) + (u64)geometry_count * (
+                sizeof(BVHNode) * 2 + sizeof(AABB) + sizeof(u32) * 3 + (sizeof(u32) * 2 + sizeof(u8)) * 2
+        );
+    }
+
+    explicit SceneBVH(const Scene &scene, memory::MonotonicAllocator *memory_allocator = nullptr) {
+        memory::MonotonicAllocator temp_allocator;
+        const u32 count = scene.counts.geometries;
+        if (!memory_allocator) {
+            temp_allocator = memory::MonotonicAllocator{GetMemorySize(count)};
+            memory_allocator = &temp_allocator;
+        }
+        builder = (BVHBuilder*)memory_allocator->allocate(sizeof(BVHBuilder));
+        *builder = BVHBuilder{count, memory_allocator};
+        bvh.nodes        = (BVHNode*)memory_allocator->allocate(sizeof(BVHNode) * count * 2);
+        geometry_aabbs   = (AABB*   )memory_allocator->allocate(sizeof(AABB)    * count);
+        geometry_ids     = (u32*    )memory_allocator->allocate(sizeof(u32)     * count);
+        leaf_node_ids    = (u32*    )memory_allocator->allocate(sizeof(u32)     * count);
+        visible_passes   = (u32*    )memory_allocator->allocate(sizeof(u32)     * count);
+        parent_ids       = (u32*    )memory_allocator->allocate(sizeof(u32)     * count * 2);
+        node_stack       = (u32*    )memory_allocator->allocate(sizeof(u32)     * count * 2);
+        plane_mask_stack = (u8*     )memory_allocator->allocate(sizeof(u8)      * count * 2);
+        for (u32 i = 0; i < count; i++) visible_passes[i] = 0;
+        build(scene);
+    }
+
+    // The world-space bounds of a geometry, transformed as the rasterizer transforms its vertices (padded a bit,
+    // for rounding), given its bounds in model space:
+    static AABB GetWorldBounds(const Geometry &geometry, const AABB &model_bounds) {
+        const mat4 model_to_world = Mat4(geometry.transform.rotation, geometry.transform.scale, geometry.transform.position);
+        AABB world_bounds{INFINITY, -INFINITY};
+        for (u8 corner = 0; corner < 8; corner++) {
+            vec3 position = Vec3(model_to_world * Vec4(vec3{
+                    corner & 1 ? model_bounds.max.x : model_bounds.min.x,
+                    corner & 2 ? model_bounds.max.y : model_bounds.min.y,
+                    corner & 4 ? model_bounds.max.z : model_bounds.min.z
+            }, 1.0f));
+            world_bounds.min = minimum(world_bounds.min, position);
+            world_bounds.max = maximum(world_bounds.max, position);
+        }
+        world_bounds.min -= EPS;
+        world_bounds.max += EPS;
+        return world_bounds;
+    }
+
+    static bool GetWorldBounds(const Scene &scene, u32 geometry_id, AABB &world_bounds) {
+        const Geometry &geometry = scene.geometries[geometry_id];
+        if (geometry.type == GeometryType_Box)
+            world_bounds = GetWorldBounds(geometry, AABB{-1, 1});
+        else if (geometry.type == GeometryType_Mesh)
+            world_bounds = GetWorldBounds(geometry, scene.meshes[geometry.id].aabb);
+        else
+            return false;
+
+        return true;
+    }
+
+    void build(const Scene &scene) {
+        geometry_count = scene.counts.geometries;
+        u32 leaf_count = 0;
+        for (u32 i = 0; i < geometry_count; i++) {
+            leaf_node_ids[i] = SCENE_BVH_NO_NODE;
+            if (GetWorldBounds(scene, i, geometry_aabbs[i])) {
+                BVHNode &node = builder->nodes[leaf_count];
+                node.aabb = geometry_aabbs[i];
+                node.first_index = i;
+                builder->node_ids[leaf_count] = leaf_count;
+                leaf_count++;
+            }
+        }
+
+        bvh.node_count = 0;
+        bvh.height = 0;
+        if (!leaf_count)
+            return;
+
+        builder->build(bvh, leaf_count, SCENE_BVH_MAX_LEAF_SIZE);
+        for (u32 i = 0; i < leaf_count; i++) geometry_ids[i] = builder->leaf_ids[i];
+
+        parent_ids[0] = SCENE_BVH_NO_NODE;
+        for (u32 node_id = 0; node_id < bvh.node_count; node_id++) {
+            const BVHNode &node = bvh.nodes[node_id];
+            if (node.isLeaf())
+                for (u32 i = 0; i < node.leaf_count; i++)
+                    leaf_node_ids[geometry_ids[node.first_index + i]] = node_id;
+            else
+                parent_ids[node.first_index] = parent_ids[node.first_index + 1] = node_id;
+        }
+    }
+
+    // Update the bounds of a geometry (once its Transform changed), and of the nodes above it:
+    void refit(const Scene &scene, u32 geometry_id) {
+        u32 node_id = leaf_node_ids[geometry_id];
+        if (node_id == SCENE_BVH_NO_NODE)
+            return;
+
+        GetWorldBounds(scene, geometry_id, geometry_aabbs[geometry_id]);
+        BVHNode *node = bvh.nodes + node_id;
+        node->aabb = geometry_aabbs[geometry_ids[node->first_index]];
+        for (u32 i = 1; i < node->leaf_count; i++)
+            node->aabb += geometry_aabbs[geometry_ids[node->first_index + i]];
+
+        while (node_id) {
+            node_id = parent_ids[node_id];
+            node = bvh.nodes + node_id;
+            node->aabb = bvh.nodes[node->first_index].aabb + bvh.nodes[node->first_index + 1].aabb;
+        }
+    }
+
+    // Find the geometries whose bounds intersect the view frustum (given the world-to-clip-space matrix),
+    // skipping subtrees that are outside of any of its planes and testing subtrees that are inside of some of them
+    // only against the rest (see isVisible):
+    void cull(const mat4 &world_to_clip) {
+        pass++;
+        visible_count = 0;
+        if (!bvh.node_count)
+            return;
+
+        vec4 planes[6];
+        getFrustumPlanes(world_to_clip, planes);
+
+        i32 top = 0;
+        node_stack[0] = 0;
+        plane_mask_stack[0] = 0b111111;
+        while (top >= 0) {
+            const BVHNode &node = bvh.nodes[node_stack[top]];
+            u8 plane_mask = plane_mask_stack[top--];
+            if (plane_mask && !intersectsFrustum(node.aabb, planes, plane_mask))
+                continue;
+
+            if (node.isLeaf()) {
+                for (u32 i = 0; i < node.leaf_count; i++) {
+                    const u32 geometry_id = geometry_ids[node.first_index + i];
+                    u8 geometry_plane_mask = plane_mask;
+                    if (!geometry_plane_mask || intersectsFrustum(geometry_aabbs[geometry_id], planes, geometry_plane_mask)) {
+                        visible_passes[geometry_id] = pass;
+                        visible_count++;
+                    }
+                }
+            } else {
+                node_stack[++top] = node.first_index + 1;
+                plane_mask_stack[top] = plane_mask;
+                node_stack[++top] = node.first_index;
+                plane_mask_stack[top] = plane_mask;
+            }
+        }
+    }
+
+    INLINE bool isVisible(u32 geometry_id) const {
+        return visible_passes[geometry_id] == pass;
+    }
+};
@@ -5,20 +5,74 @@
 #include "./bvh.h"
 
 
+// Mesh files start with this tag followed by a version number and flags.
+// Files of the original (unversioned) format start with the vertex count instead, and are loaded as such.
+// Meshes that have meshlets store their counts in the header (after the other counts) and their content at the end,
+// and so do meshes that have levels of detail (after those of the meshlets).
+// Files of a newer version, or with flags that are unknown to this one, are not loaded.
+#define MESH_FILE_TAG 0x484D4C53 // 'SLMH'
+#define MESH_FILE_VERSION 4
+#define MESH_FILE_FLAG_WELDED 1
+#define MESH_FILE_FLAG_LEAF_ORDERED 2
+#define MESH_FILE_FLAG_MESHLETS 4
+#define MESH_FILE_FLAG_LODS 8
+#define MESH_FILE_FLAGS (MESH_FILE_FLAG_WELDED | MESH_FILE_FLAG_LEAF_ORDERED | MESH_FILE_FLAG_MESHLETS | MESH_FILE_FLAG_LODS)
+
+u32 getMeshletsSizeInBytes(const Mesh &mesh) {
+    return sizeof(Meshlet) * mesh.meshlet_count +
+           sizeof(u32) * (mesh.meshlet_position_id_count + mesh.meshlet_normal_id_count);
+}
+
+bool allocateMeshlets(Mesh &mesh, memory::MonotonicAllocator *memory_allocator) {
+    if (getMeshletsSizeInBytes(mesh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
+    mesh.meshlets             = (Meshlet*)memory_allocator->allocate(sizeof(Meshlet) * mesh.meshlet_count);
+    mesh.meshlet_position_ids = (u32*    )memory_allocator->allocate(sizeof(u32)     * mesh.meshlet_position_id_count);
+    mesh.meshlet_normal_ids   = mesh.meshlet_normal_id_count ?
+                                (u32*    )memory_allocator->allocate(sizeof(u32)     * mesh.meshlet_normal_id_count) :
+                                mesh.meshlet_position_ids;
+    return true;
+}
+
+u32 getLODsSizeInBytes(const Mesh &mesh) {
+    u32 index_lists = 1;
+    if (!mesh.welded && mesh.normals_count) index_lists++;
+    if (!mesh.welded && mesh.uvs_count) index_lists++;
+    return sizeof(MeshLOD) * mesh.lod_count +
+           sizeof(TriangleVertexIndices) * mesh.lod_triangle_count * index_lists +
+           sizeof(u32) * (mesh.lod_position_id_count + mesh.lod_normal_id_count);
+}
+
+bool allocateLODs(Mesh &mesh, memory::MonotonicAllocator *memory_allocator) {
+    if (getLODsSizeInBytes(mesh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
+    mesh.lods                        = (MeshLOD*              )memory_allocator->allocate(sizeof(MeshLOD)               * mesh.lod_count);
+    mesh.lod_vertex_position_indices = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.lod_triangle_count);
+    mesh.lod_vertex_normal_indices   = mesh.welded || !mesh.normals_count ? mesh.lod_vertex_position_indices :
+                                       (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.lod_triangle_count);
+    mesh.lod_vertex_uvs_indices      = mesh.welded || !mesh.uvs_count ? mesh.lod_vertex_position_indices :
+                                       (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.lod_triangle_count);
+    mesh.lod_position_ids            = (u32*                  )memory_allocator->allocate(sizeof(u32)                   * mesh.lod_position_id_count);
+    mesh.lod_normal_ids              = mesh.lod_normal_id_count ?
+                                       (u32*                  )memory_allocator->allocate(sizeof(u32)                   * mesh.lod_normal_id_count) :
+                                       mesh.lod_position_ids;
+    return true;
+}
+
 u32 getSizeInBytes(const Mesh &mesh) {
     u32 memory_size = getSizeInBytes(mesh.bvh);
     memory_size += sizeof(Triangle) * mesh.triangle_count;
     memory_size += sizeof(vec3) * mesh.vertex_count;
     memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
     memory_size += sizeof(EdgeVertexIndices) * mesh.edge_count;
+    memory_size += getMeshletsSizeInBytes(mesh);
+    memory_size += getLODsSizeInBytes(mesh);
 
     if (mesh.uvs_count) {
         memory_size += sizeof(vec2) * mesh.uvs_count;
-        memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
+        if (!mesh.welded) memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
     }
     if (mesh.normals_count) {
         memory_size += sizeof(vec3) * mesh.normals_count;
-        memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
+        if (!mesh.welded) memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
     }
 
     return memory_size;
@@ -33,30 +87,157 @@ bool allocateMemory(Mesh &mesh, memory::MonotonicAllocator *memory_allocator) {
     mesh.edge_vertex_indices     = (EdgeVertexIndices*    )memory_allocator->allocate(sizeof(EdgeVertexIndices)     * mesh.edge_count);
     if (mesh.uvs_count) {
         mesh.vertex_uvs         = (vec2*                 )memory_allocator->allocate(sizeof(vec2)                  * mesh.uvs_count);
-        mesh.vertex_uvs_indices = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+        mesh.vertex_uvs_indices = mesh.welded ? mesh.vertex_position_indices :
+                                  (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
     }
     if (mesh.normals_count) {
         mesh.vertex_normals          = (vec3*                 )memory_allocator->allocate(sizeof(vec3)                  * mesh.normals_count);
-        mesh.vertex_normal_indices   = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+        mesh.vertex_normal_indices   = mesh.welded ? mesh.vertex_position_indices :
+                                       (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    }
+    if (mesh.meshlet_count) allocateMeshlets(mesh, memory_allocator);
+    if (mesh.lod_count) allocateLODs(mesh, memory_allocator);
+    return true;
+}
+
+u32 getVertexStreamsSizeInBytes(const Mesh &mesh) {
+    return sizeof(f32) * 3 * (SIMD_PADDED_COUNT(mesh.vertex_count) + SIMD_PADDED_COUNT(mesh.normals_count));
+}
+
+void allocateVertexStreams(vec3_streams &streams, const vec3 *vectors, u32 count, memory::MonotonicAllocator *memory_allocator) {
+    u32 padded_count = SIMD_PADDED_COUNT(count);
+    streams.x = (f32*)memory_allocator->allocate(sizeof(f32) * padded_count);
+    streams.y = (f32*)memory_allocator->allocate(sizeof(f32) * padded_count);
+    streams.z = (f32*)memory_allocator->allocate(sizeof(f32) * padded_count);
+    for (u32 i = 0; i < count; i++) {
+        streams.x[i] = vectors[i].x;
+        streams.y[i] = vectors[i].y;
+        streams.z[i] = vectors[i].z;
+    }
+    for (u32 i = count; i < padded_count; i++)
+        streams.x[i] = streams.y[i] = streams.z[i] = 0;
+}
+
+// Add structure-of-arrays copies of a loaded mesh's vertex positions and normals
+// (opting the mesh into batched SIMD transformation of its vertices, see shadeMesh):
+bool allocateVertexStreams(Mesh &mesh, memory::MonotonicAllocator *memory_allocator) {
+    if (getVertexStreamsSizeInBytes(mesh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
+    allocateVertexStreams(mesh.vertex_position_streams, mesh.vertex_positions, mesh.vertex_count, memory_allocator);
+    if (mesh.normals_count)
+        allocateVertexStreams(mesh.vertex_normal_streams, mesh.vertex_normals, mesh.normals_count, memory_allocator);
+    return true;
+}
+
+// Clusters list the vertices of each leaf node once, so take at most 3 ids per triangle:
+u32 getClustersSizeInBytes(const Mesh &mesh) {
+    u32 lists = !mesh.welded && mesh.normals_count ? 2 : 1;
+    return sizeof(u32) * lists * (mesh.bvh.node_count + 1 + mesh.triangle_count * 3);
+}
+
+void allocateClusters(const Mesh &mesh, const TriangleVertexIndices *indices, u32 *&offsets, u32 *&ids, memory::MonotonicAllocator *memory_allocator) {
+    const BVH &bvh = mesh.bvh;
+    offsets = (u32*)memory_allocator->allocate(sizeof(u32) * (bvh.node_count + 1));
+    ids     = (u32*)memory_allocator->allocate(sizeof(u32) * mesh.triangle_count * 3);
+    u32 count = 0;
+    for (u32 node_id = 0; node_id < bvh.node_count; node_id++) {
+        const BVHNode &node = bvh.nodes[node_id];
+        offsets[node_id] = count;
+        if (!node.isLeaf())
+            continue;
+
+        const u32 first_id = count;
+        for (u32 t = node.first_index; t < node.first_index + node.leaf_count; t++)
+            for (u32 id : indices[t].ids) {
+                bool listed = false;
+                for (u32 i = first_id; i < count; i++)
+                    if (ids[i] == id) {
+                        listed = true;
+                        break;
+                    }
+                if (!listed) ids[count++] = id;
+            }
+    }
+    offsets[bvh.node_count] = count;
+}
+
+// Add the per-leaf vertex lists of a loaded leaf-ordered mesh
+// (opting the mesh into culling its BVH's leaves against the view frustum, see ClusterCulling):
+bool allocateClusters(Mesh &mesh, memory::MonotonicAllocator *memory_allocator) {
+    if (!mesh.leaf_ordered || !mesh.bvh.node_count) return false;
+    if (getClustersSizeInBytes(mesh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
+    allocateClusters(mesh, mesh.vertex_position_indices, mesh.cluster_position_offsets, mesh.cluster_position_ids, memory_allocator);
+    if (mesh.normals_count && !mesh.welded)
+        allocateClusters(mesh, mesh.vertex_normal_indices, mesh.cluster_normal_offsets, mesh.cluster_normal_ids, memory_allocator);
+    else if (mesh.normals_count) {
+        mesh.cluster_normal_offsets = mesh.cluster_position_offsets;
+        mesh.cluster_normal_ids     = mesh.cluster_position_ids;
     }
     return true;
 }
 
 void writeHeader(const Mesh &mesh, void *file) {
+    u32 tag = MESH_FILE_TAG;
+    u32 version = MESH_FILE_VERSION;
+    u32 flags = (mesh.welded ? MESH_FILE_FLAG_WELDED : 0) | (mesh.leaf_ordered ? MESH_FILE_FLAG_LEAF_ORDERED : 0) |
+                (mesh.meshlet_count ? MESH_FILE_FLAG_MESHLETS : 0) | (mesh.lod_count ? MESH_FILE_FLAG_LODS : 0);
+    os::writeToFile((void*)&tag,                 sizeof(u32),  file);
+    os::writeToFile((void*)&version,             sizeof(u32),  file);
+    os::writeToFile((void*)&flags,               sizeof(u32),  file);
     os::writeToFile((void*)&mesh.vertex_count,   sizeof(u32),  file);
     os::writeToFile((void*)&mesh.triangle_count, sizeof(u32),  file);
     os::writeToFile((void*)&mesh.edge_count,     sizeof(u32),  file);
     os::writeToFile((void*)&mesh.uvs_count,      sizeof(u32),  file);
     os::writeToFile((void*)&mesh.normals_count,  sizeof(u32),  file);
+    if (mesh.meshlet_count) {
+        os::writeToFile((void*)&mesh.meshlet_count,             sizeof(u32), file);
+        os::writeToFile((void*)&mesh.meshlet_position_id_count, sizeof(u32), file);
+        os::writeToFile((void*)&mesh.meshlet_normal_id_count,   sizeof(u32), file);
+    }
+    if (mesh.lod_count) {
+        os::writeToFile((void*)&mesh.lod_count,             sizeof(u32), file);
+        os::writeToFile((void*)&mesh.lod_triangle_count,    sizeof(u32), file);
+        os::writeToFile((void*)&mesh.lod_position_id_count, sizeof(u32), file);
+        os::writeToFile((void*)&mesh.lod_normal_id_count,   sizeof(u32), file);
+    }
     writeHeader(mesh.bvh, file);
 }
-void readHeader(Mesh &mesh, void *file) {
-    os::readFromFile(&mesh.vertex_count,   sizeof(u32),  file);
+bool readHeader(Mesh &mesh, void *file) {
+    u32 first, flags = 0;
+    os::readFromFile(&first, sizeof(u32), file);
+    if (first == MESH_FILE_TAG) {
+        u32 version;
+        os::readFromFile(&version, sizeof(u32), file);
+        os::readFromFile(&flags,   sizeof(u32), file);
+        if (version > MESH_FILE_VERSION || (flags & ~(u32)MESH_FILE_FLAGS))
+            return false;
+
+        os::readFromFile(&mesh.vertex_count, sizeof(u32), file);
+        mesh.welded = flags & MESH_FILE_FLAG_WELDED;
+        mesh.leaf_ordered = flags & MESH_FILE_FLAG_LEAF_ORDERED;
+    } else {
+        mesh.vertex_count = first;
+        mesh.welded = false;
+        mesh.leaf_ordered = false;
+    }
     os::readFromFile(&mesh.triangle_count, sizeof(u32),  file);
     os::readFromFile(&mesh.edge_count,     sizeof(u32),  file);
     os::readFromFile(&mesh.uvs_count,      sizeof(u32),  file);
     os::readFromFile(&mesh.normals_count,  sizeof(u32),  file);
+    mesh.meshlet_count = mesh.meshlet_position_id_count = mesh.meshlet_normal_id_count = 0;
+    if (flags & MESH_FILE_FLAG_MESHLETS) {
+        os::readFromFile(&mesh.meshlet_count,             sizeof(u32), file);
+        os::readFromFile(&mesh.meshlet_position_id_count, sizeof(u32), file);
+        os::readFromFile(&mesh.meshlet_normal_id_count,   sizeof(u32), file);
+    }
+    mesh.lod_count = mesh.lod_triangle_count = mesh.lod_position_id_count = mesh.lod_normal_id_count = 0;
+    if (flags & MESH_FILE_FLAG_LODS) {
+        os::readFromFile(&mesh.lod_count,             sizeof(u32), file);
+        os::readFromFile(&mesh.lod_triangle_count,    sizeof(u32), file);
+        os::readFromFile(&mesh.lod_position_id_count, sizeof(u32), file);
+        os::readFromFile(&mesh.lod_normal_id_count,   sizeof(u32), file);
+    }
     readHeader(mesh.bvh, file);
+    return true;
 }
 
 bool saveHeader(const Mesh &mesh, char *file_path) {
@@ -70,9 +251,9 @@ bool saveHeader(const Mesh &mesh, char *file_path) {
 bool loadHeader(Mesh &mesh, char *file_path) {
     void *file = os::openFileForReading(file_path);
     if (!file) return false;
-    readHeader(mesh, file);
+    bool read = readHeader(mesh, file);
     os::closeFile(file);
-    return true;
+    return read;
 }
 
 void readContent(Mesh &mesh, void *file) {
@@ -84,13 +265,32 @@ void readContent(Mesh &mesh, void *file) {
     os::readFromFile(mesh.edge_vertex_indices,          sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
     if (mesh.uvs_count) {
         os::readFromFile(mesh.vertex_uvs,               sizeof(vec2)                  * mesh.uvs_count,      file);
-        os::readFromFile(mesh.vertex_uvs_indices,       sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+        if (!mesh.welded)
+            os::readFromFile(mesh.vertex_uvs_indices,   sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
     if (mesh.normals_count) {
         os::readFromFile(mesh.vertex_normals,                sizeof(vec3)                  * mesh.normals_count,  file);
-        os::readFromFile(mesh.vertex_normal_indices,         sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+        if (!mesh.welded)
+            os::readFromFile(mesh.vertex_normal_indices,     sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
     readContent(mesh.bvh, file);
+    if (mesh.meshlet_count) {
+        os::readFromFile(mesh.meshlets,             sizeof(Meshlet) * mesh.meshlet_count,             file);
+        os::readFromFile(mesh.meshlet_position_ids, sizeof(u32)     * mesh.meshlet_position_id_count, file);
+        if (mesh.meshlet_normal_id_count)
+            os::readFromFile(mesh.meshlet_normal_ids, sizeof(u32)   * mesh.meshlet_normal_id_count,   file);
+    }
+    if (mesh.lod_count) {
+        os::readFromFile(mesh.lods,                        sizeof(MeshLOD)               * mesh.lod_count,          file);
+        os::readFromFile(mesh.lod_vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        if (!mesh.welded && mesh.normals_count)
+            os::readFromFile(mesh.lod_vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        if (!mesh.welded && mesh.uvs_count)
+            os::readFromFile(mesh.lod_vertex_uvs_indices,    sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        os::readFromFile(mesh.lod_position_ids,            sizeof(u32)                   * mesh.lod_position_id_count, file);
+        if (mesh.lod_normal_id_count)
+            os::readFromFile(mesh.lod_normal_ids,          sizeof(u32)                   * mesh.lod_normal_id_count,   file);
+    }
 }
 void writeContent(const Mesh &mesh, void *file) {
     os::writeToFile((void*)&mesh.aabb.min,       sizeof(vec3), file);
@@ -101,13 +301,32 @@ void writeContent(const Mesh &mesh, void *file) {
     os::writeToFile((void*)mesh.edge_vertex_indices,     sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
     if (mesh.uvs_count) {
         os::writeToFile(mesh.vertex_uvs,          sizeof(vec2)                  * mesh.uvs_count,      file);
-        os::writeToFile(mesh.vertex_uvs_indices,  sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+        if (!mesh.welded)
+            os::writeToFile(mesh.vertex_uvs_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
     if (mesh.normals_count) {
         os::writeToFile(mesh.vertex_normals,        sizeof(vec3)                  * mesh.normals_count,  file);
-        os::writeToFile(mesh.vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+        if (!mesh.welded)
+            os::writeToFile(mesh.vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
     writeContent(mesh.bvh, file);
+    if (mesh.meshlet_count) {
+        os::writeToFile(mesh.meshlets,             sizeof(Meshlet) * mesh.meshlet_count,             file);
+        os::writeToFile(mesh.meshlet_position_ids, sizeof(u32)     * mesh.meshlet_position_id_count, file);
+        if (mesh.meshlet_normal_id_count)
+            os::writeToFile(mesh.meshlet_normal_ids, sizeof(u32)   * mesh.meshlet_normal_id_count,   file);
+    }
+    if (mesh.lod_count) {
+        os::writeToFile(mesh.lods,                        sizeof(MeshLOD)               * mesh.lod_count,          file);
+        os::writeToFile(mesh.lod_vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        if (!mesh.welded && mesh.normals_count)
+            os::writeToFile(mesh.lod_vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        if (!mesh.welded && mesh.uvs_count)
+            os::writeToFile(mesh.lod_vertex_uvs_indices,    sizeof(TriangleVertexIndices) * mesh.lod_triangle_count, file);
+        os::writeToFile(mesh.lod_position_ids,            sizeof(u32)                   * mesh.lod_position_id_count, file);
+        if (mesh.lod_normal_id_count)
+            os::writeToFile(mesh.lod_normal_ids,          sizeof(u32)                   * mesh.lod_normal_id_count,   file);
+    }
 }
 
 bool saveContent(const Mesh &mesh, char *file_path) {
@@ -141,8 +360,10 @@ bool load(Mesh &mesh, char *file_path, memory::MonotonicAllocator *memory_alloca
 
     if (memory_allocator) {
         mesh = Mesh{};
-        readHeader(mesh, file);
-        if (!allocateMemory(mesh, memory_allocator)) return false;
+        if (!readHeader(mesh, file) || !allocateMemory(mesh, memory_allocator)) {
+            os::closeFile(file);
+            return false;
+        }
     } else if (!mesh.vertex_positions) return false;
     readContent(mesh, file);
     os::closeFile(file);
@@ -155,7 +376,9 @@ u32 getTotalMemoryForMeshes(String *mesh_files, u32 mesh_count, u8 *max_bvh_heig
     if (max_triangle_count) *max_triangle_count = 0;
     for (u32 i = 0; i < mesh_count; i++) {
         Mesh mesh;
-        loadHeader(mesh, mesh_files[i].char_ptr);
+        if (!loadHeader(mesh, mesh_files[i].char_ptr))
+            continue;
+
         memory_size += getSizeInBytes(mesh);
 
         if (max_bvh_height && mesh.bvh.height > *max_bvh_height) *max_bvh_height = mesh.bvh.height;
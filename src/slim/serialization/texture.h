@@ -9,13 +9,11 @@ u32 getSizeInBytes(const Texture &texture) {
     u32 mip_height = texture.height;
     u32 memory_size = 0;
 
-    do {
+    // Mip chains may end early (as in the pages of a texture atlas), so the count from the header is what's followed:
+    for (u32 mip_level = 0; mip_level < texture.mip_count; mip_level++, mip_width /= 2, mip_height /= 2) {
         memory_size += sizeof(TextureMip);
-        memory_size += (mip_width + 1) * (mip_height + 1) * sizeof(TexelQuad);
-
-        mip_width /= 2;
-        mip_height /= 2;
-    } while (texture.flags.mipmap && mip_width > 2 && mip_height > 2);
+        memory_size += TextureMip::GetContentSize(mip_width, mip_height, texture.flags.tile, texture.flags.compression);
+    }
 
     return memory_size;
 }
@@ -28,12 +26,12 @@ bool allocateMemory(Texture &texture, memory::MonotonicAllocator *memory_allocat
     u32 mip_width  = texture.width;
     u32 mip_height = texture.height;
 
-    do {
-        texture_mip->texel_quads = (TexelQuad*)memory_allocator->allocate(sizeof(TexelQuad) * (mip_height + 1) * (mip_width + 1));
-        mip_width /= 2;
-        mip_height /= 2;
-        texture_mip++;
-    } while (texture.flags.mipmap && mip_width > 2 && mip_height > 2);
+    for (u32 mip_level = 0; mip_level < texture.mip_count; mip_level++, mip_width /= 2, mip_height /= 2, texture_mip++) {
+        texture_mip->blocks = (u8*)memory_allocator->allocate(TextureMip::GetContentSize(mip_width, mip_height, texture.flags.tile, texture.flags.compression));
+        texture_mip->tiled = texture.flags.tile;
+        texture_mip->wrap = texture.flags.wrap;
+        texture_mip->compression = (u8)texture.flags.compression;
+    }
 
     return true;
 }
@@ -43,7 +41,10 @@ void readContent(Texture &texture, void *file) {
     for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
         os::readFromFile(&texture_mip->width,  sizeof(u32), file);
         os::readFromFile(&texture_mip->height, sizeof(u32), file);
-        os::readFromFile(texture_mip->texel_quads, sizeof(TexelQuad) * (texture_mip->width + 1) * (texture_mip->height + 1), file);
+        texture_mip->tiled = texture.flags.tile;
+        texture_mip->wrap = texture.flags.wrap;
+        texture_mip->compression = (u8)texture.flags.compression;
+        os::readFromFile(texture_mip->blocks, TextureMip::GetContentSize(texture_mip->width, texture_mip->height, texture_mip->tiled, texture_mip->compression), file);
     }
 }
 void writeContent(const Texture &texture, void *file) {
@@ -51,7 +52,156 @@ void writeContent(const Texture &texture, void *file) {
     for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
         os::writeToFile(&texture_mip->width,  sizeof(u32), file);
         os::writeToFile(&texture_mip->height, sizeof(u32), file);
-        os::writeToFile(texture_mip->texel_quads, sizeof(TexelQuad) * (texture_mip->width + 1) * (texture_mip->height + 1), file);
+        os::writeToFile(texture_mip->blocks, TextureMip::GetContentSize(texture_mip->width, texture_mip->height, texture_mip->tiled, texture_mip->compression), file);
+    }
+}
+
+// Block compression (done offline, by bmp2texture). Each block is fit to its 4x4 texels, as given row by row:
+
+INLINE u16 encodeRGB565(f32 R, f32 G, f32 B) {
+    R = clampedValue(R, 0.0f, 255.0f);
+    G = clampedValue(G, 0.0f, 255.0f);
+    B = clampedValue(B, 0.0f, 255.0f);
+    return (u16)(((u32)(R * (31.0f / 255.0f) + 0.5f) << 11) |
+                 ((u32)(G * (63.0f / 255.0f) + 0.5f) << 5) |
+                  (u32)(B * (31.0f / 255.0f) + 0.5f));
+}
+
+void encodeBC1Block(const u8 *R, const u8 *G, const u8 *B, BC1Block &block) {
+    // The endpoints are the extremes of the texels along their principal axis
+    // (the dominant eigenvector of their covariance, found by power iteration):
+    f32 mean[3] = {0, 0, 0};
+    for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+        mean[0] += (f32)R[i];
+        mean[1] += (f32)G[i];
+        mean[2] += (f32)B[i];
+    }
+    for (f32 &component : mean) component *= 1.0f / TEXTURE_BLOCK_TEXEL_COUNT;
+
+    f32 rr = 0, rg = 0, rb = 0, gg = 0, gb = 0, bb = 0, r, g, b;
+    for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+        r = (f32)R[i] - mean[0];
+        g = (f32)G[i] - mean[1];
+        b = (f32)B[i] - mean[2];
+        rr += r*r; rg += r*g; rb += r*b;
+        gg += g*g; gb += g*b;
+        bb += b*b;
+    }
+
+    f32 axis[3] = {1, 1, 1}, next_axis[3], length;
+    for (u32 iteration = 0; iteration < 8; iteration++) {
+        next_axis[0] = rr*axis[0] + rg*axis[1] + rb*axis[2];
+        next_axis[1] = rg*axis[0] + gg*axis[1] + gb*axis[2];
+        next_axis[2] = rb*axis[0] + gb*axis[1] + bb*axis[2];
+        length = sqrtf(next_axis[0]*next_axis[0] + next_axis[1]*next_axis[1] + next_axis[2]*next_axis[2]);
+        if (length == 0) {
+            axis[0] = axis[1] = axis[2] = 0; // All texels are the same
+            break;
+        }
+        for (u32 c = 0; c < 3; c++) axis[c] = next_axis[c] / length;
+    }
+
+    f32 min_t = 0, max_t = 0, t;
+    for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+        t = ((f32)R[i] - mean[0])*axis[0] + ((f32)G[i] - mean[1])*axis[1] + ((f32)B[i] - mean[2])*axis[2];
+        if (t < min_t) min_t = t;
+        if (t > max_t) max_t = t;
+    }
+
+    block.color0 = encodeRGB565(mean[0] + axis[0]*max_t, mean[1] + axis[1]*max_t, mean[2] + axis[2]*max_t);
+    block.color1 = encodeRGB565(mean[0] + axis[0]*min_t, mean[1] + axis[1]*min_t, mean[2] + axis[2]*min_t);
+    if (block.color0 < block.color1) {
+        u16 color = block.color0;
+        block.color0 = block.color1;
+        block.color1 = color;
+    }
+    block.indices = 0;
+    if (block.color0 == block.color1)
+        return; // Every texel gets the first color
+
+    // Pick the nearest color of the palette for each texel:
+    u8 palette_R[4], palette_G[4], palette_B[4];
+    TextureBlockDecoder::GetPalette(block, palette_R, palette_G, palette_B);
+    for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+        u32 nearest_index = 0;
+        i32 nearest_distance = 0x7FFFFFFF;
+        for (u32 index = 0; index < 4; index++) {
+            i32 dr = (i32)R[i] - (i32)palette_R[index];
+            i32 dg = (i32)G[i] - (i32)palette_G[index];
+            i32 db = (i32)B[i] - (i32)palette_B[index];
+            i32 distance = dr*dr + dg*dg + db*db;
+            if (distance < nearest_distance) {
+                nearest_distance = distance;
+                nearest_index = index;
+            }
+        }
+        block.indices |= nearest_index << (2 * i);
+    }
+}
+
+void encodeBC4Block(const u8 *values, BC4Block &block) {
+    u8 min_value = 255, max_value = 0;
+    for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+        if (values[i] < min_value) min_value = values[i];
+        if (values[i] > max_value) max_value = values[i];
+    }
+    block.value0 = max_value;
+    block.value1 = min_value;
+
+    u64 indices = 0;
+    if (max_value > min_value) {
+        u8 palette[8];
+        TextureBlockDecoder::GetPalette(block, palette);
+        for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+            u64 nearest_index = 0;
+            i32 nearest_distance = 256;
+            for (u32 index = 0; index < 8; index++) {
+                i32 distance = (i32)values[i] - (i32)palette[index];
+                if (distance < 0) distance = -distance;
+                if (distance < nearest_distance) {
+                    nearest_distance = distance;
+                    nearest_index = index;
+                }
+            }
+            indices |= nearest_index << (3 * i);
+        }
+    }
+    for (u32 i = 0; i < 6; i++) block.indices[i] = (u8)(indices >> (8 * i));
+}
+
+// Compress the texels of a mip (given as rows of components) into its blocks,
+// clamping texels beyond its edges to them (for blocks that reach beyond).
+// Only the given range of block rows is compressed (all of them by default), so bands of rows can be done in parallel:
+void compressTextureMip(TextureMip &texture_mip, const u8 *R, const u8 *G, const u8 *B,
+                        u32 first_block_row = 0, u32 end_block_row = (u32)-1) {
+    u8 block_R[TEXTURE_BLOCK_TEXEL_COUNT];
+    u8 block_G[TEXTURE_BLOCK_TEXEL_COUNT];
+    u8 block_B[TEXTURE_BLOCK_TEXEL_COUNT];
+    const u32 block_rows = (texture_mip.height + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT;
+    const u32 first_block = first_block_row * ((texture_mip.width + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT);
+    if (end_block_row > block_rows) end_block_row = block_rows;
+    BC1Block *bc1_block = (BC1Block*)texture_mip.blocks + first_block;
+    BC5Block *bc5_block = (BC5Block*)texture_mip.blocks + first_block;
+    for (u32 block_y = first_block_row << TEXTURE_BLOCK_SHIFT; block_y < (end_block_row << TEXTURE_BLOCK_SHIFT); block_y += TEXTURE_BLOCK_SIZE) {
+        for (u32 block_x = 0; block_x < texture_mip.width; block_x += TEXTURE_BLOCK_SIZE) {
+            for (u32 i = 0; i < TEXTURE_BLOCK_TEXEL_COUNT; i++) {
+                u32 x = block_x + (i & TEXTURE_BLOCK_MASK);
+                u32 y = block_y + (i >> TEXTURE_BLOCK_SHIFT);
+                if (x >= texture_mip.width)  x = texture_mip.width - 1;
+                if (y >= texture_mip.height) y = texture_mip.height - 1;
+                u32 offset = texture_mip.width * y + x;
+                block_R[i] = R[offset];
+                block_G[i] = G[offset];
+                block_B[i] = B[offset];
+            }
+            if (texture_mip.compression == TextureCompression_BC1)
+                encodeBC1Block(block_R, block_G, block_B, *bc1_block++);
+            else {
+                encodeBC4Block(block_R, bc5_block->red);
+                encodeBC4Block(block_G, bc5_block->green);
+                bc5_block++;
+            }
+        }
     }
 }
 
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "./texture.h"
+
+// Texture atlas files (.atlas, see bmp2texture's atlas mode) start with the page and rectangle counts,
+// followed by the header of each page, the rectangles and then the content of each page (as in a texture file).
+
+u32 getSizeInBytes(const TextureAtlas &atlas) {
+    u32 memory_size = sizeof(TextureAtlasRect) * atlas.rect_count;
+    for (u32 i = 0; i < atlas.page_count; i++)
+        memory_size += getSizeInBytes(atlas.pages[i]);
+
+    return memory_size;
+}
+
+bool allocateMemory(TextureAtlas &atlas, memory::MonotonicAllocator *memory_allocator) {
+    if (getSizeInBytes(atlas) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
+    atlas.rects = (TextureAtlasRect*)memory_allocator->allocate(sizeof(TextureAtlasRect) * atlas.rect_count);
+    for (u32 i = 0; i < atlas.page_count; i++)
+        allocateMemory(atlas.pages[i], memory_allocator);
+
+    return true;
+}
+
+void writeHeader(const TextureAtlas &atlas, void *file) {
+    os::writeToFile((void*)&atlas.page_count, sizeof(u32), file);
+    os::writeToFile((void*)&atlas.rect_count, sizeof(u32), file);
+    for (u32 i = 0; i < atlas.page_count; i++)
+        writeHeader((const ImageInfo&)atlas.pages[i], file);
+}
+void readHeader(TextureAtlas &atlas, void *file) {
+    os::readFromFile(&atlas.page_count, sizeof(u32), file);
+    os::readFromFile(&atlas.rect_count, sizeof(u32), file);
+    if (atlas.page_count > TEXTURE_ATLAS_MAX_PAGE_COUNT) atlas.page_count = TEXTURE_ATLAS_MAX_PAGE_COUNT;
+    for (u32 i = 0; i < atlas.page_count; i++)
+        readHeader((ImageInfo&)atlas.pages[i], file);
+}
+
+void writeContent(const TextureAtlas &atlas, void *file) {
+    os::writeToFile(atlas.rects, sizeof(TextureAtlasRect) * atlas.rect_count, file);
+    for (u32 i = 0; i < atlas.page_count; i++)
+        writeContent(atlas.pages[i], file);
+}
+void readContent(TextureAtlas &atlas, void *file) {
+    os::readFromFile(atlas.rects, sizeof(TextureAtlasRect) * atlas.rect_count, file);
+    for (u32 i = 0; i < atlas.page_count; i++)
+        readContent(atlas.pages[i], file);
+}
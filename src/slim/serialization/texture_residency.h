@@ -0,0 +1,276 @@
+#pragma once
+
+#include "./texture.h"
+
+// Streams the mip levels of textures in on demand, instead of loading all of them up front (as TexturePack does):
+// Only their mip tails (the levels no larger than a given size) are loaded at startup, while finer levels are
+// loaded on background threads once the rasterizer requests them (see Texture::requestMipLevels), within a budget.
+// The resident levels of a texture are always a contiguous range ending at its last level (see first_resident_mip),
+// so levels are streamed in from coarse to fine and evicted from fine to coarse. When over budget, the finest
+// resident level of the least recently requested texture is evicted first (levels requested this frame never are).
+//
+// Residency only changes in update(), which is to be called between frames (while not rasterizing), so that
+// sampling never sees a level going away or being half-loaded.
+// A level that fails to load (e.g. its file went missing or got truncated) is not retried, so its texture stays at
+// the coarser levels it has.
+
+#define TEXTURE_RESIDENCY_MAX_MIP_COUNT 16
+#define TEXTURE_RESIDENCY_MAX_LOADS 64
+#define TEXTURE_RESIDENCY_MIP_TAIL_SIZE 128
+
+enum TextureMipLoadState {
+    TextureMipLoad_Free,
+    TextureMipLoad_Queued,
+    TextureMipLoad_Done
+};
+
+struct TextureMipLoad {
+    char *file_path;
+    u64 file_position;
+    u64 size;
+    u8 *content;
+    u32 texture_index;
+    u8 mip_level;
+    bool loaded;
+    volatile i32 state;
+};
+
+struct ResidentTexture {
+    u64 mip_file_positions[TEXTURE_RESIDENCY_MAX_MIP_COUNT];
+    u32 mip_last_requested_frames[TEXTURE_RESIDENCY_MAX_MIP_COUNT];
+    u8 mip_tail;      // The first level of the mip tail (always resident)
+    u8 requested_mip; // The finest level requested in the last frame (if any)
+    u8 loadable_mip;  // The finest level that can be streamed in (levels finer than one that failed to load can't)
+    bool loading;
+};
+
+struct TextureResidency {
+    Texture *textures{nullptr};
+    String *texture_files{nullptr};
+    ResidentTexture *resident_textures{nullptr};
+    u32 texture_count{0};
+
+    TextureMipLoad loads[TEXTURE_RESIDENCY_MAX_LOADS];
+    void *load_semaphore{nullptr};
+    volatile i32 taken_load_count{0};
+    i32 queued_load_count{0};
+
+    u64 memory_budget{0};    // For streamed in levels (mip tails are allocated separately, up front)
+    u64 streamed_memory{0};  // Of streamed in levels, including the ones being loaded
+    u32 frame{0};
+
+    TextureResidency(u32 count, Texture *textures, String *texture_files, u64 memory_budget,
+                     u32 loader_count = 1, u32 mip_tail_size = TEXTURE_RESIDENCY_MIP_TAIL_SIZE) :
+            textures{textures}, texture_files{texture_files}, texture_count{count}, memory_budget{memory_budget} {
+        for (TextureMipLoad &load : loads) load.state = TextureMipLoad_Free;
+
+        u64 memory_size = sizeof(ResidentTexture) * count;
+        for (u32 i = 0; i < count; i++) {
+            Texture &texture = textures[i];
+            new(&texture) Texture{};
+            loadHeader(texture, texture_files[i].char_ptr);
+            memory_size += getMipTailSizeInBytes(texture, mip_tail_size);
+        }
+        memory::MonotonicAllocator memory_allocator{memory_size};
+        resident_textures = (ResidentTexture*)memory_allocator.allocate(sizeof(ResidentTexture) * count);
+        for (u32 i = 0; i < count; i++)
+            loadMipTail(textures[i], resident_textures[i], texture_files[i].char_ptr, mip_tail_size, &memory_allocator);
+
+        if (loader_count) {
+            load_semaphore = os::createSemaphore();
+            for (u32 i = 0; i < loader_count; i++) os::createThread(_loaderProc, this);
+        }
+    }
+
+    // Apply the levels that finished loading, then stream in the next finer level of each texture that was requested
+    // at a finer level than it has resident (evicting levels as needed to stay within budget):
+    void update() {
+        frame++;
+
+        for (TextureMipLoad &load : loads) {
+            if (load.state != TextureMipLoad_Done)
+                continue;
+
+            Texture &texture = textures[load.texture_index];
+            if (load.loaded) {
+                texture.mips[load.mip_level].blocks = load.content;
+                texture.first_resident_mip = load.mip_level;
+            } else {
+                os::freeMemory(load.content, load.size);
+                streamed_memory -= load.size;
+                resident_textures[load.texture_index].loadable_mip = (u8)(load.mip_level + 1);
+            }
+            resident_textures[load.texture_index].loading = false;
+            load.state = TextureMipLoad_Free;
+        }
+
+        // Stamp the requests of all textures before streaming any in, so that no level requested this frame gets
+        // evicted to make room for another one:
+        for (u32 i = 0; i < texture_count; i++) {
+            Texture &texture = textures[i];
+            ResidentTexture &resident_texture = resident_textures[i];
+            resident_texture.requested_mip = texture.finest_requested_mip;
+            texture.finest_requested_mip = TEXTURE_NO_MIP_REQUESTED;
+            if (resident_texture.requested_mip == TEXTURE_NO_MIP_REQUESTED)
+                continue;
+
+            for (u32 mip_level = resident_texture.requested_mip; mip_level < texture.mip_count && mip_level < TEXTURE_RESIDENCY_MAX_MIP_COUNT; mip_level++)
+                resident_texture.mip_last_requested_frames[mip_level] = frame;
+        }
+
+        for (u32 i = 0; i < texture_count; i++) {
+            const ResidentTexture &resident_texture = resident_textures[i];
+            if (resident_texture.requested_mip != TEXTURE_NO_MIP_REQUESTED &&
+                resident_texture.requested_mip < textures[i].first_resident_mip && !resident_texture.loading &&
+                resident_texture.loadable_mip < textures[i].first_resident_mip)
+                if (!streamIn(i))
+                    break;
+        }
+    }
+
+    // Queue the loading of the next finer level of a texture, returning false if no more loads can be queued:
+    bool streamIn(u32 texture_index) {
+        TextureMipLoad &load = loads[(u32)queued_load_count % TEXTURE_RESIDENCY_MAX_LOADS];
+        if (load.state != TextureMipLoad_Free)
+            return false;
+
+        Texture &texture = textures[texture_index];
+        const u8 mip_level = texture.first_resident_mip - 1;
+        const TextureMip &mip = texture.mips[mip_level];
+        const u64 size = TextureMip::GetContentSize(mip.width, mip.height, mip.tiled, mip.compression);
+        while (streamed_memory + size > memory_budget)
+            if (!evictLeastRecentlyRequested())
+                return true;
+
+        load.content = (u8*)os::getMemory(size);
+        if (!load.content)
+            return true;
+
+        streamed_memory += size;
+        load.file_path = texture_files[texture_index].char_ptr;
+        load.file_position = resident_textures[texture_index].mip_file_positions[mip_level];
+        load.size = size;
+        load.texture_index = texture_index;
+        load.mip_level = mip_level;
+        load.loaded = false;
+        load.state = TextureMipLoad_Queued;
+        resident_textures[texture_index].loading = true;
+        queued_load_count++;
+        if (load_semaphore)
+            os::signalSemaphore(load_semaphore);
+        else
+            loadMip(load);
+
+        return true;
+    }
+
+    // Evict the finest streamed in level of the texture that was least recently requested (not counting the ones
+    // requested this frame or being streamed in), returning false if there is none:
+    bool evictLeastRecentlyRequested() {
+        u32 evicted_texture_index = texture_count;
+        u32 oldest_frame = frame;
+        for (u32 i = 0; i < texture_count; i++) {
+            const ResidentTexture &resident_texture = resident_textures[i];
+            const u8 mip_level = textures[i].first_resident_mip;
+            if (resident_texture.loading || mip_level >= resident_texture.mip_tail)
+                continue;
+
+            if (resident_texture.mip_last_requested_frames[mip_level] < oldest_frame) {
+                oldest_frame = resident_texture.mip_last_requested_frames[mip_level];
+                evicted_texture_index = i;
+            }
+        }
+        if (evicted_texture_index == texture_count)
+            return false;
+
+        Texture &texture = textures[evicted_texture_index];
+        TextureMip &mip = texture.mips[texture.first_resident_mip];
+        const u64 size = TextureMip::GetContentSize(mip.width, mip.height, mip.tiled, mip.compression);
+        os::freeMemory(mip.blocks, size);
+        mip.blocks = nullptr;
+        streamed_memory -= size;
+        texture.first_resident_mip++;
+        return true;
+    }
+
+    static void loadMip(TextureMipLoad &load) {
+        void *file = os::openFileForReading(load.file_path);
+        if (file) {
+            load.loaded = os::setFilePosition(load.file_position, file) && os::readFromFile(load.content, load.size, file);
+            os::closeFile(file);
+        }
+
+        // Publish the loaded content along with the state (the increment being a full memory barrier):
+        os::atomicIncrement(&load.state);
+    }
+
+    static u64 getMipTailSizeInBytes(const Texture &texture, u32 mip_tail_size) {
+        u64 memory_size = sizeof(TextureMip) * texture.mip_count;
+        u32 mip_width  = texture.width;
+        u32 mip_height = texture.height;
+        for (u32 mip_level = 0; mip_level < texture.mip_count; mip_level++, mip_width /= 2, mip_height /= 2)
+            if (isInMipTail(texture, mip_level, mip_width, mip_height, mip_tail_size))
+                memory_size += TextureMip::GetContentSize(mip_width, mip_height, texture.flags.tile, texture.flags.compression);
+
+        return memory_size;
+    }
+
+    // Textures without mips (or with too many of them) are resident as a whole:
+    static bool isInMipTail(const Texture &texture, u32 mip_level, u32 mip_width, u32 mip_height, u32 mip_tail_size) {
+        return !texture.flags.mipmap || texture.mip_count > TEXTURE_RESIDENCY_MAX_MIP_COUNT ||
+               mip_level == texture.mip_count - 1 || (mip_width <= mip_tail_size && mip_height <= mip_tail_size);
+    }
+
+    // Set up all the levels of a texture (as laid out in its file, see readContent), loading just its mip tail:
+    static void loadMipTail(Texture &texture, ResidentTexture &resident_texture, char *file_path, u32 mip_tail_size,
+                            memory::MonotonicAllocator *memory_allocator) {
+        resident_texture.loading = false;
+        resident_texture.requested_mip = TEXTURE_NO_MIP_REQUESTED;
+        resident_texture.loadable_mip = 0;
+        resident_texture.mip_tail = (u8)(texture.mip_count - 1);
+        texture.mips = (TextureMip*)memory_allocator->allocate(sizeof(TextureMip) * texture.mip_count);
+
+        void *file = os::openFileForReading(file_path);
+        u64 file_position = sizeof(ImageInfo);
+        u32 mip_width  = texture.width;
+        u32 mip_height = texture.height;
+        for (u8 mip_level = 0; mip_level < texture.mip_count; mip_level++, mip_width /= 2, mip_height /= 2) {
+            TextureMip &mip = texture.mips[mip_level];
+            mip.width = mip_width;
+            mip.height = mip_height;
+            mip.blocks = nullptr;
+            mip.tiled = texture.flags.tile;
+            mip.wrap = texture.flags.wrap;
+            mip.compression = (u8)texture.flags.compression;
+
+            file_position += sizeof(u32) * 2;
+            const u64 size = TextureMip::GetContentSize(mip_width, mip_height, mip.tiled, mip.compression);
+            if (isInMipTail(texture, mip_level, mip_width, mip_height, mip_tail_size)) {
+                if (mip_level < resident_texture.mip_tail) resident_texture.mip_tail = mip_level;
+                mip.blocks = (u8*)memory_allocator->allocate(size);
+                if (file) {
+                    os::setFilePosition(file_position, file);
+                    os::readFromFile(mip.blocks, size, file);
+                }
+            }
+            if (mip_level < TEXTURE_RESIDENCY_MAX_MIP_COUNT) {
+                resident_texture.mip_file_positions[mip_level] = file_position;
+                resident_texture.mip_last_requested_frames[mip_level] = 0;
+            }
+            file_position += size;
+        }
+        if (file) os::closeFile(file);
+
+        texture.first_resident_mip = resident_texture.mip_tail;
+    }
+
+private:
+    static void _loaderProc(void *data) {
+        TextureResidency &residency = *(TextureResidency*)data;
+        while (true) {
+            os::waitForSemaphore(residency.load_semaphore);
+            const i32 load_index = os::atomicIncrement(&residency.taken_load_count) - 1;
+            loadMip(residency.loads[(u32)load_index % TEXTURE_RESIDENCY_MAX_LOADS]);
+        }
+    }
+};
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string.h>
+
+#ifdef _WIN32
+#include "./slim/platforms/win32_base.h"
+#else
+#include "./slim/platforms/linux_base.h"
+#endif
+#include "./slim/serialization/texture_residency.h"
+
+// Compares the row-major and the block-tiled texel quad layouts and BC1 compression (see TextureMip) when sampling
+// along various directions in texture space. Miss rates are of a simulated cache of the texel quads (or blocks)
+// fetched by each sample, while throughput is measured sampling for real (with both the scalar and SIMD code paths).
+// Then streams the levels of a mip-mapped texture in through TextureResidency (see benchmarkStreaming).
+
+#define SCREEN_SIZE 512
+#define RUN_COUNT 5
+
+// An 8-way set-associative cache of 64 byte lines with LRU replacement (32KB, as a typical L1 data cache):
+#define CACHE_LINE_SHIFT 6
+#define CACHE_SET_COUNT 64
+#define CACHE_WAY_COUNT 8
+
+struct SimulatedCache {
+    u64 lines[CACHE_SET_COUNT][CACHE_WAY_COUNT]; // Most recently used first
+    u64 accesses{0};
+    u64 misses{0};
+
+    SimulatedCache() { for (auto &set : lines) for (u64 &line : set) line = (u64)-1; }
+
+    void access(const void *address, u32 size) {
+        u64 first_line = (u64)address >> CACHE_LINE_SHIFT;
+        u64 last_line = ((u64)address + size - 1) >> CACHE_LINE_SHIFT;
+        for (u64 line = first_line; line <= last_line; line++) {
+            accesses++;
+            u64 *set = lines[line % CACHE_SET_COUNT];
+            u32 way = 0;
+            while (way < CACHE_WAY_COUNT - 1 && set[way] != line) way++;
+            if (set[way] != line) misses++; // Evicting the least recently used line (the last one)
+            for (; way; way--) set[way] = set[way - 1];
+            set[0] = line;
+        }
+    }
+};
+
+// Access the texel quad that TextureMip::sample(u, v) reads (or the blocks of its texels when compressed):
+void accessSampledTexels(SimulatedCache &cache, const TextureMip &mip, f32 u, f32 v) {
+    if (u > 1) u -= (f32)((u32)u);
+    if (v > 1) v -= (f32)((u32)v);
+    u32 x = (u32)(u * (f32)mip.width  + 0.5f);
+    u32 y = (u32)(v * (f32)mip.height + 0.5f);
+    if (!mip.compression) {
+        cache.access(mip.texel_quads + mip.texelQuadOffset(x, y), sizeof(TexelQuad));
+        return;
+    }
+
+    u32 block_columns = (mip.width + TEXTURE_BLOCK_MASK) >> TEXTURE_BLOCK_SHIFT;
+    u32 xs[2] = {x ? x - 1 : mip.width - 1, x < mip.width ? x : 0};
+    u32 ys[2] = {y ? y - 1 : mip.height - 1, y < mip.height ? y : 0};
+    for (u32 texel_y : ys)
+        for (u32 texel_x : xs)
+            cache.access(mip.blocks + ((texel_y >> TEXTURE_BLOCK_SHIFT) * block_columns + (texel_x >> TEXTURE_BLOCK_SHIFT)) * sizeof(BC1Block), sizeof(BC1Block));
+}
+
+// Texture coordinates of each screen pixel, for a texture mapped at about a texel per pixel (as mip-mapping would)
+// at a given rotation, and optionally receding into the distance (as a floor would):
+void generateUVs(f32 *us, f32 *vs, u32 texture_size, f32 angle, bool receding) {
+    f32 c = cosf(angle);
+    f32 s = sinf(angle);
+    for (u32 y = 0; y < SCREEN_SIZE; y++) {
+        f32 scale = (f32)SCREEN_SIZE / (f32)texture_size;
+        if (receding) scale *= 64.0f / (f32)(y + 64);
+        for (u32 x = 0; x < SCREEN_SIZE; x++) {
+            f32 sx = ((f32)x / SCREEN_SIZE - 0.5f) * scale;
+            f32 sy = ((f32)y / SCREEN_SIZE - 0.5f) * (receding ? 1.0f : scale);
+            f32 u = c * sx - s * sy + 0.5f;
+            f32 v = s * sx + c * sy + 0.5f;
+            u -= floorf(u);
+            v -= floorf(v);
+            us[y * SCREEN_SIZE + x] = u;
+            vs[y * SCREEN_SIZE + x] = v;
+        }
+    }
+}
+
+void initMip(TextureMip &mip, u32 size, bool tiled, const TextureMip *source) {
+    mip.width = mip.height = size;
+    mip.tiled = tiled;
+    mip.texel_quads = new TexelQuad[TextureMip::GetTexelQuadCount(size, size, tiled)]();
+    for (u32 y = 0; y <= size; y++)
+        for (u32 x = 0; x <= size; x++) {
+            TexelQuad &texel_quad = mip.texel_quads[mip.texelQuadOffset(x, y)];
+            if (source)
+                texel_quad = source->texel_quads[source->texelQuadOffset(x, y)];
+            else {
+                u8 *bytes = (u8*)&texel_quad;
+                for (u32 i = 0; i < sizeof(TexelQuad); i++) bytes[i] = (u8)rand();
+            }
+        }
+}
+
+// Compress the texels of a texel quad mip (the bottom-right corners of its texel quads) as BC1:
+void initCompressedMip(TextureMip &mip, const TextureMip &source) {
+    u32 size = source.width;
+    mip.width = mip.height = size;
+    mip.wrap = true;
+    mip.compression = TextureCompression_BC1;
+    mip.blocks = new u8[TextureMip::GetContentSize(size, size, false, mip.compression)];
+
+    u8 *R = new u8[size * size];
+    u8 *G = new u8[size * size];
+    u8 *B = new u8[size * size];
+    for (u32 y = 0; y < size; y++)
+        for (u32 x = 0; x < size; x++) {
+            const TexelQuad &texel_quad = source.texel_quads[source.texelQuadOffset(x, y)];
+            R[y * size + x] = texel_quad.R.BR;
+            G[y * size + x] = texel_quad.G.BR;
+            B[y * size + x] = texel_quad.B.BR;
+        }
+    compressTextureMip(mip, R, G, B);
+    delete[] R;
+    delete[] G;
+    delete[] B;
+}
+
+// Stream all the levels of a mip-mapped texture in, starting from just its mip tail (loading on the calling thread),
+// then again from a copy of its file that gets truncated once its mip tail is loaded, so that its finer levels fail
+// to load (each of which should only be tried once, rather than every frame):
+#define STREAMING_FILE_PATH "texture_benchmark_streaming.texture"
+#define STREAMING_MIP_TAIL_SIZE 16
+#define STREAMING_FRAME_COUNT 64
+
+u32 streamAllLevels(Texture &texture, String &file, u32 &frame_count, bool truncate_file) {
+    TextureResidency residency{1, &texture, &file, Gigabytes(1), 0, STREAMING_MIP_TAIL_SIZE};
+    if (truncate_file) {
+        void *truncated = os::openFileForWriting(file.char_ptr);
+        if (truncated) {
+            writeHeader((const ImageInfo&)texture, truncated);
+            os::closeFile(truncated);
+        }
+    }
+
+    for (frame_count = 0; frame_count < STREAMING_FRAME_COUNT; frame_count++) {
+        texture.requestMipLevels(0);
+        residency.update();
+        if (!texture.first_resident_mip)
+            break;
+    }
+    return (u32)residency.queued_load_count;
+}
+
+void benchmarkStreaming(u32 size) {
+    Texture texture;
+    texture.flags.mipmap = true;
+    texture.updateDimensions(size, size);
+    texture.mip_count = 1;
+    for (u32 mip_size = size; mip_size > 4; mip_size /= 2) texture.mip_count++;
+    texture.mips = new TextureMip[texture.mip_count];
+    for (u32 mip_level = 0; mip_level < texture.mip_count; mip_level++)
+        initMip(texture.mips[mip_level], size >> mip_level, false, nullptr);
+
+    String file{(char*)STREAMING_FILE_PATH};
+    if (!save(texture, file.char_ptr)) {
+        printf("Failed to write %s\n", file.char_ptr);
+        return;
+    }
+
+    Texture streamed;
+    u32 frame_count;
+    auto start = std::chrono::high_resolution_clock::now();
+    u32 load_count = streamAllLevels(streamed, file, frame_count, false);
+    std::chrono::duration<f64> elapsed = std::chrono::high_resolution_clock::now() - start;
+    bool matches = !streamed.first_resident_mip;
+    for (u32 mip_level = 0; mip_level < texture.mip_count && matches; mip_level++) {
+        const TextureMip &mip = texture.mips[mip_level];
+        matches = !memcmp(streamed.mips[mip_level].texel_quads, mip.texel_quads, TextureMip::GetContentSize(mip.width, mip.height, false, 0));
+    }
+    printf("\nStreaming %u levels: %u loads over %u frames in %.1fms (%s)\n", texture.mip_count, load_count, frame_count + 1,
+           elapsed.count() * 1000.0, matches ? "matching the texture" : "NOT matching the texture");
+
+    Texture truncated;
+    load_count = streamAllLevels(truncated, file, frame_count, true);
+    printf("Streaming from a truncated file: %u loads over %u frames, stuck at level %u of %u\n",
+           load_count, frame_count, truncated.first_resident_mip, texture.mip_count);
+
+    remove(file.char_ptr);
+}
+
+volatile f32 sink;
+
+int main(int argc, char *argv[]) {
+    u32 size = argc > 1 ? (u32)atoi(argv[1]) : 2048;
+    if (size < 4) size = 4;
+
+    TextureMip linear, tiled, compressed;
+    initMip(linear, size, false, nullptr);
+    initMip(tiled,  size, true, &linear);
+    initCompressedMip(compressed, linear);
+
+    f32 *us = new f32[SCREEN_SIZE * SCREEN_SIZE];
+    f32 *vs = new f32[SCREEN_SIZE * SCREEN_SIZE];
+
+    struct Pattern { const char *name; f32 angle; bool receding; } patterns[] = {
+            {"Horizontal", 0.0f, false},
+            {"Rotated 45", 45.0f * DEG_TO_RAD, false},
+            {"Vertical  ", 90.0f * DEG_TO_RAD, false},
+            {"Receding  ", 0.0f, true},
+            {"Receding rotated 90", 90.0f * DEG_TO_RAD, true}
+    };
+
+    printf("Texture: %ux%u, screen: %ux%u samples\n", size, size, SCREEN_SIZE, SCREEN_SIZE);
+    printf("Throughput in Msamples/s, sampling one texture coordinate at a time and SIMD_WIDTH (%u) at a time\n", SIMD_WIDTH);
+    printf("%-20s | %-28s | %-28s | %-28s\n", "Pattern", "Linear: miss rate, 1, SIMD", "Tiled: miss rate, 1, SIMD", "BC1: miss rate, 1, SIMD");
+    for (const Pattern &pattern : patterns) {
+        generateUVs(us, vs, size, pattern.angle, pattern.receding);
+        printf("%-20s", pattern.name);
+
+        const TextureMip *mips[3] = {&linear, &tiled, &compressed};
+        for (const TextureMip *mip : mips) {
+            SimulatedCache cache;
+            for (u32 i = 0; i < SCREEN_SIZE * SCREEN_SIZE; i++)
+                accessSampledTexels(cache, *mip, us[i], vs[i]);
+
+            f64 best_seconds = 1e9;
+            f64 best_simd_seconds = 1e9;
+            f32 sum = 0;
+            for (u32 run = 0; run < RUN_COUNT; run++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                for (u32 i = 0; i < SCREEN_SIZE * SCREEN_SIZE; i++)
+                    sum += mip->sample(us[i], vs[i]).color.g;
+                std::chrono::duration<f64> elapsed = std::chrono::high_resolution_clock::now() - start;
+                if (elapsed.count() < best_seconds) best_seconds = elapsed.count();
+#if SIMD_WIDTH > 1
+                start = std::chrono::high_resolution_clock::now();
+                f32_lanes R, G, B, G_sum = simd::set(0.0f);
+                for (u32 i = 0; i < SCREEN_SIZE * SCREEN_SIZE; i += SIMD_WIDTH) {
+                    mip->sample(simd::load(us + i), simd::load(vs + i), R, G, B);
+                    G_sum = simd::add(G_sum, G);
+                }
+                elapsed = std::chrono::high_resolution_clock::now() - start;
+                if (elapsed.count() < best_simd_seconds) best_simd_seconds = elapsed.count();
+                f32 lanes_G_sum[SIMD_WIDTH];
+                simd::store(lanes_G_sum, G_sum);
+                for (f32 lane_G_sum : lanes_G_sum) sum += lane_G_sum;
+#endif
+            }
+
+            sink = sum; // Keeps the sampling from being optimized away
+            printf(" | %8.2f%%, %7.1f, %7.1f",
+                   100.0 * (f64)cache.misses / (f64)cache.accesses,
+                   (f64)(SCREEN_SIZE * SCREEN_SIZE) / best_seconds / 1000000.0,
+                   SIMD_WIDTH > 1 ? (f64)(SCREEN_SIZE * SCREEN_SIZE) / best_simd_seconds / 1000000.0 : 0.0);
+        }
+        printf("\n");
+    }
+
+    benchmarkStreaming(size);
+
+    return 0;
+}